@@ -0,0 +1,402 @@
+/**
+ * benchmark of the external sort: sweeps input size, block size, memory size, thread count and key distribution
+ * and reports throughput, merge passes, bytes read / written and peak RSS as csv or json
+ * every configuration is sorted in a forked child, so the peak RSS belongs to that configuration alone
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "command_line.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+enum class Distribution {
+    random,
+    sorted,
+    reverse,
+    nearly_sorted,
+    few_unique
+};
+
+const std::pair<const char*, Distribution> distributions[] = {
+    {"random", Distribution::random},
+    {"sorted", Distribution::sorted},
+    {"reverse", Distribution::reverse},
+    {"nearly_sorted", Distribution::nearly_sorted},
+    {"few_unique", Distribution::few_unique},
+};
+
+const char* distribution_name(Distribution distribution) {
+    for (auto& [name, value] : distributions) {
+        if (value == distribution) return name;
+    }
+    return "?";
+}
+
+const char* io_backend_name(IoBackend backend) {
+    switch (backend) {
+    case IoBackend::stream: return "stream";
+    case IoBackend::mmap: return "mmap";
+    case IoBackend::direct: return "direct";
+    case IoBackend::pread: break;
+    }
+    return "pread";
+}
+
+const size_t MB = 1024 * 1024;
+
+struct BenchmarkOptions {
+    std::vector<double> sizes_mb = {64};
+    std::vector<double> blocks_mb = {1};
+    std::vector<double> memory_mb = {16, 64};
+    std::vector<size_t> threads;
+    std::vector<Distribution> distributions = {Distribution::random, Distribution::sorted};
+    size_t repeat = 1;
+    bool json = false;
+    std::string output;
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    SortOptions sort_options;
+    RecordType record_type = RecordType::i64;
+};
+
+// one sorted configuration, sent from the child to the parent as plain bytes, so it is a summary of SortStats
+struct Measurement {
+    bool ok = false;
+    double seconds = 0;
+    size_t peak_rss_kb = 0;
+    size_t runs = 0;
+    size_t merge_passes = 0;
+    size_t fan_in = 0;
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+    double run_generation_seconds = 0;
+    double merge_seconds = 0;
+    double read_stall_seconds = 0;
+    double write_stall_seconds = 0;
+};
+
+struct Row {
+    std::string distribution;
+    double size_mb;
+    double block_mb;
+    double memory_mb;
+    size_t threads;
+    size_t repetition;
+    Measurement measurement;
+};
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+/**
+ * write bytes of records with the given key distribution to filename
+ * sorted inputs are produced by the external sort itself, so inputs larger than memory can be generated
+ */
+template <typename Record>
+bool generate_input(const std::string& filename, size_t bytes, Distribution distribution, const BenchmarkOptions& bench) {
+    const size_t chunk_elements = std::max<size_t>(1, MB / sizeof(Record));
+    size_t elements = bytes / sizeof(Record);
+    std::mt19937_64 gen(42);
+    Buffer<Record> buffer(chunk_elements);
+
+    if (distribution == Distribution::random || distribution == Distribution::few_unique) {
+        std::vector<Record> pool(64);
+        for (auto& record : pool) {
+            record = RecordTraits<Record>::random(gen);
+        }
+        std::unique_ptr<File> file = file_open_and_clear(filename, IoBackend::pread);
+        if (!file) return false;
+        for (size_t start = 0; start < elements; start += chunk_elements) {
+            size_t count = std::min(chunk_elements, elements - start);
+            for (size_t i = 0; i < count; i++) {
+                buffer[i] = distribution == Distribution::random ? RecordTraits<Record>::random(gen) : pool[gen() % pool.size()];
+            }
+            write_data(*file, buffer.data(), start, count);
+        }
+        return true;
+    }
+
+    std::string random_name = filename + ".random";
+    std::string sorted_name = distribution == Distribution::sorted ? filename : filename + ".sorted";
+    if (!generate_input<Record>(random_name, bytes, Distribution::random, bench)) return false;
+    SortOptions options;
+    options.temp_directories = {bench.directory.string()};
+    SortStats stats;
+    bool sorted = sort_file_external<Record>(random_name, sorted_name, bytes, 64 * MB, MB, options, stats) != nullptr;
+    std::filesystem::remove(random_name);
+    if (!sorted || distribution == Distribution::sorted) return sorted;
+
+    std::unique_ptr<File> input = file_open(sorted_name, IoBackend::pread);
+    std::unique_ptr<File> output = file_open_and_clear(filename, IoBackend::pread);
+    if (!input || !output) return false;
+    for (size_t start = 0; start < elements; start += chunk_elements) {
+        size_t count = std::min(chunk_elements, elements - start);
+        if (distribution == Distribution::reverse) {
+            // the last chunk of the sorted file, reversed, is the first chunk of the output
+            read_data(*input, buffer, elements - start - count, 0, count);
+            std::reverse(buffer.begin(), buffer.begin() + count);
+        } else {
+            // nearly sorted: one percent of the records swapped with a random record of the same chunk
+            read_data(*input, buffer, start, 0, count);
+            for (size_t swap = 0; swap < count / 100; swap++) {
+                std::swap(buffer[gen() % count], buffer[gen() % count]);
+            }
+        }
+        write_data(*output, buffer.data(), start, count);
+    }
+    input.reset();
+    std::filesystem::remove(sorted_name);
+    return true;
+}
+
+template <typename Record>
+Measurement sort_once(const std::string& in_filename, const std::string& out_filename, size_t bytes, size_t block_size, size_t memory_size, const SortOptions& options) {
+    Measurement measurement;
+    SortStats stats;
+    auto start_time = std::chrono::steady_clock::now();
+    measurement.ok = sort_file_external<Record>(in_filename, out_filename, bytes, memory_size, block_size, options, stats) != nullptr;
+    measurement.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    measurement.runs = stats.runs;
+    measurement.merge_passes = stats.merge_passes.size();
+    measurement.fan_in = stats.fan_in;
+    measurement.bytes_read = stats.bytes_read;
+    measurement.bytes_written = stats.bytes_written;
+    measurement.run_generation_seconds = stats.run_generation.seconds;
+    measurement.read_stall_seconds = stats.run_generation.read_stall_seconds;
+    measurement.write_stall_seconds = stats.run_generation.write_stall_seconds;
+    for (const PhaseStats& pass : stats.merge_passes) {
+        measurement.merge_seconds += pass.seconds;
+        measurement.read_stall_seconds += pass.read_stall_seconds;
+        measurement.write_stall_seconds += pass.write_stall_seconds;
+    }
+    return measurement;
+}
+
+/**
+ * run work in a child process and collect its measurement and its peak RSS
+ * the generation of the inputs runs in a child as well, so the parent stays small
+ * and its pages do not show up in the peak RSS of the forked sorts
+ */
+template <typename Work>
+Measurement in_child(Work&& work) {
+    int channel[2];
+    if (pipe(channel) != 0) {
+        return Measurement{};
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(channel[0]);
+        Measurement measurement = work();
+        ssize_t written = write(channel[1], &measurement, sizeof(measurement));
+        _exit(written == sizeof(measurement) ? 0 : 1);
+    }
+    close(channel[1]);
+    Measurement measurement;
+    if (child < 0 || read(channel[0], &measurement, sizeof(measurement)) != sizeof(measurement)) {
+        measurement.ok = false;
+    }
+    close(channel[0]);
+    if (child > 0) {
+        int status;
+        struct rusage usage;
+        wait4(child, &status, 0, &usage);
+        measurement.peak_rss_kb = usage.ru_maxrss;
+    }
+    return measurement;
+}
+
+template <typename Record>
+std::vector<Row> run_benchmark(const BenchmarkOptions& bench) {
+    std::vector<Row> rows;
+    std::string in_filename = (bench.directory / "benchmark_input").string();
+    std::string out_filename = (bench.directory / "benchmark_output").string();
+    for (double size_mb : bench.sizes_mb) {
+        size_t bytes = static_cast<size_t>(size_mb * MB) / sizeof(Record) * sizeof(Record);
+        for (Distribution distribution : bench.distributions) {
+            std::cerr << "generating " << size_mb << " MB " << distribution_name(distribution) << " input" << std::endl;
+            Measurement generated = in_child([&] {
+                Measurement measurement;
+                measurement.ok = generate_input<Record>(in_filename, bytes, distribution, bench);
+                return measurement;
+            });
+            if (!generated.ok) {
+                std::cerr << "Error: (benchmark) generating the input in " << bench.directory << " failed" << std::endl;
+                return rows;
+            }
+            for (double block_mb : bench.blocks_mb) {
+                for (double memory_mb : bench.memory_mb) {
+                    for (size_t threads : bench.threads) {
+                        SortOptions options = bench.sort_options;
+                        options.threads = threads;
+                        for (size_t repetition = 0; repetition < bench.repeat; repetition++) {
+                            std::cerr << "sorting: block " << block_mb << " MB, memory " << memory_mb << " MB, " << threads << " threads" << std::endl;
+                            Measurement measurement = in_child([&] {
+                                return sort_once<Record>(in_filename, out_filename, bytes, block_mb * MB, memory_mb * MB, options);
+                            });
+                            rows.push_back(Row{distribution_name(distribution), size_mb, block_mb, memory_mb, threads, repetition, measurement});
+                        }
+                    }
+                }
+            }
+        }
+    }
+    std::filesystem::remove(in_filename);
+    std::filesystem::remove(out_filename);
+    return rows;
+}
+
+const char* columns[] = {"record", "io", "distribution", "size_mb", "block_mb", "memory_mb", "threads", "repetition", "ok",
+                         "seconds", "mb_per_s", "runs", "merge_passes", "fan_in", "bytes_read", "bytes_written", "peak_rss_mb",
+                         "run_generation_s", "merge_s", "read_stall_s", "write_stall_s"};
+
+// the values of a row in the order of columns, strings already quoted for json
+std::vector<std::string> row_values(const Row& row, const BenchmarkOptions& bench, const char* record, bool json) {
+    auto quote = [json](const std::string& value) { return json ? "\"" + value + "\"" : value; };
+    auto number = [](double value) {
+        std::ostringstream out;
+        out << value;
+        return out.str();
+    };
+    const Measurement& m = row.measurement;
+    double throughput = m.seconds > 0 ? row.size_mb / m.seconds : 0;
+    return {quote(record), quote(io_backend_name(bench.sort_options.io_backend)), quote(row.distribution),
+            number(row.size_mb), number(row.block_mb), number(row.memory_mb), std::to_string(row.threads),
+            std::to_string(row.repetition), m.ok ? "true" : "false", number(m.seconds), number(throughput),
+            std::to_string(m.runs), std::to_string(m.merge_passes), std::to_string(m.fan_in),
+            std::to_string(m.bytes_read), std::to_string(m.bytes_written), number(m.peak_rss_kb / 1024.0),
+            number(m.run_generation_seconds), number(m.merge_seconds), number(m.read_stall_seconds), number(m.write_stall_seconds)};
+}
+
+void report(std::ostream& out, const std::vector<Row>& rows, const BenchmarkOptions& bench, const char* record) {
+    size_t column_count = std::size(columns);
+    if (!bench.json) {
+        for (size_t i = 0; i < column_count; i++) {
+            out << columns[i] << (i + 1 < column_count ? "," : "\n");
+        }
+        for (const Row& row : rows) {
+            std::vector<std::string> values = row_values(row, bench, record, false);
+            for (size_t i = 0; i < column_count; i++) {
+                out << values[i] << (i + 1 < column_count ? "," : "\n");
+            }
+        }
+        return;
+    }
+    out << "[\n";
+    for (size_t r = 0; r < rows.size(); r++) {
+        std::vector<std::string> values = row_values(rows[r], bench, record, true);
+        out << "  {";
+        for (size_t i = 0; i < column_count; i++) {
+            out << "\"" << columns[i] << "\": " << values[i] << (i + 1 < column_count ? ", " : "");
+        }
+        out << (r + 1 < rows.size() ? "},\n" : "}\n");
+    }
+    out << "]\n";
+}
+
+bool parse_benchmark_option(const std::string& arg, BenchmarkOptions& bench) {
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+    std::string name = arg.substr(2, equals - 2);
+    std::string value = arg.substr(equals + 1);
+    // a list with a value that is not a number is rejected as a whole
+    auto numbers = [&value](std::vector<double>& list) {
+        list.clear();
+        for (auto& item : split(value)) {
+            double number;
+            if (!parse_number(item, number)) return false;
+            list.push_back(number);
+        }
+        return true;
+    };
+    if (name == "sizes") {
+        return numbers(bench.sizes_mb);
+    } else if (name == "blocks") {
+        return numbers(bench.blocks_mb);
+    } else if (name == "memory") {
+        return numbers(bench.memory_mb);
+    } else if (name == "threads") {
+        bench.threads.clear();
+        for (auto& item : split(value)) {
+            size_t threads;
+            if (!parse_count(item, threads)) return false;
+            bench.threads.push_back(std::max<size_t>(1, threads));
+        }
+    } else if (name == "distributions") {
+        bench.distributions.clear();
+        for (auto& item : split(value)) {
+            auto known = std::find_if(std::begin(distributions), std::end(distributions), [&item](auto& entry) { return item == entry.first; });
+            if (known == std::end(distributions)) return false;
+            bench.distributions.push_back(known->second);
+        }
+    } else if (name == "repeat") {
+        if (!parse_count(value, bench.repeat)) return false;
+        bench.repeat = std::max<size_t>(1, bench.repeat);
+    } else if (name == "format" && (value == "csv" || value == "json")) {
+        bench.json = value == "json";
+    } else if (name == "output") {
+        bench.output = value;
+    } else if (name == "dir") {
+        bench.directory = value;
+    } else {
+        return parse_option(arg, bench.sort_options, bench.record_type);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions bench;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.rfind("--", 0) != 0 || !parse_benchmark_option(arg, bench)) {
+            std::cout << "unknown option or bad value: " << arg << std::endl;
+            std::cout << "benchmark options (lists are comma separated, sizes in MB):" << std::endl;
+            std::cout << "    --sizes=64 --blocks=1 --memory=16,64 --threads=1,<all cores>" << std::endl;
+            std::cout << "    --distributions=random,sorted (also: reverse, nearly_sorted, few_unique)" << std::endl;
+            std::cout << "    --repeat=<n> --format=csv|json --output=<file> (default: stdout) --dir=<directory for the input files>" << std::endl;
+            std::cout << "    and the sort-external options --record, --io, --strategy, --sort, --runs, --tmp, --smallest, --largest" << std::endl;
+            return 1;
+        }
+    }
+    if (bench.threads.empty()) {
+        bench.threads = {1};
+        if (bench.sort_options.threads > 1) bench.threads.push_back(bench.sort_options.threads);
+    }
+
+    return with_record_type(bench.record_type, [&](auto record) {
+        using Record = decltype(record);
+        std::vector<Row> rows = run_benchmark<Record>(bench);
+        if (bench.output.empty()) {
+            report(std::cout, rows, bench, RecordTraits<Record>::name);
+        } else {
+            std::ofstream out(bench.output);
+            report(out, rows, bench, RecordTraits<Record>::name);
+        }
+        return rows.empty() ? 1 : 0;
+    });
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+
+// alignment of I/O buffers and of O_DIRECT offsets and sizes, a page covers every common sector size
+constexpr size_t io_alignment = 4096;
+
+// buffers from this size on are mapped on their own, so the memory is given back as soon as they are freed
+// and the next phase does not add to what the heap kept from the last one
+constexpr size_t mapped_buffer_bytes = 1024 * 1024;
+
+// allocator of the I/O buffers, they start on a page so O_DIRECT can transfer straight into them
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n * sizeof(T) >= mapped_buffer_bytes) {
+            void* region = mmap(nullptr, n * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(region);
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(io_alignment)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (n * sizeof(T) >= mapped_buffer_bytes) {
+            munmap(p, n * sizeof(T));
+            return;
+        }
+        ::operator delete(p, std::align_val_t(io_alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const {
+        return true;
+    }
+};
+
+template <typename Record>
+using Buffer = std::vector<Record, AlignedAllocator<Record>>;
+
+/**
+ * number of records that fit into bytes and fill whole pages, at least one page worth
+ * chunks and blocks of this length keep the file offsets of consecutive transfers page aligned
+ */
+template <typename Record>
+size_t aligned_elements(size_t bytes) {
+    size_t unit = io_alignment / std::gcd(sizeof(Record), io_alignment);
+    return std::max(unit, bytes / sizeof(Record) / unit * unit);
+}
+
+/**
+ * the memory size given to a sort is the whole footprint of its buffers, every phase checks that its
+ * buffers add up to at most that, a block rounded up to whole pages can push a small memory over
+ * throws if they do not fit
+ */
+inline void check_buffer_memory(size_t bytes, size_t internal_memory_size, const std::string& phase) {
+    if (bytes > internal_memory_size) {
+        throw std::runtime_error(phase + " needs " + std::to_string(bytes) + " bytes of buffers, more than the memory of "
+                                 + std::to_string(internal_memory_size) + " bytes");
+    }
+}
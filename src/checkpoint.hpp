@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "buffer.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_codec.hpp"
+#include "sort_config.hpp"
+
+/**
+ * manifest of a resumable sort: the finished runs that together hold a prefix of the input (or all of it),
+ * their sizes and the hash of their records, so a sort that died can go on from its last finished run
+ *
+ *   external-sort-checkpoint 2
+ *   input <bytes> <modification time> <record type> <compressed runs 0|1> <path>
+ *   hash <records> <sum> <mixed sum>
+ *   state generating|merging
+ *   run <elements> <file bytes> <sum> <mixed sum> <path>
+ *   pending <path>
+ *   delete <path>
+ *
+ * pending files are runs that were started but not finished, a resumed sort removes what is left of them,
+ * delete files are the runs a merge just replaced, which the sort may have died before removing
+ * every run has the hash of its records, check_runs reads the runs of a resumed sort once and compares them
+ * while generating, the runs are the input up to the sum of their elements in input order,
+ * once merging they are all of it, an intermediate merge pass replaces merged runs by their result
+ * the manifest is rewritten through a temporary file and a rename whenever a run is finished,
+ * so it always describes a complete state; a manifest of another input is ignored and the sort starts over,
+ * one with a missing or truncated run as well, after its files were removed
+ */
+class Checkpoint {
+public:
+    Checkpoint(std::string path, const std::string& input_filename, size_t input_size, const char* record_name, bool compressed)
+        : path(std::move(path)), input(identify(input_filename, input_size, record_name, compressed)) {
+        load();
+    }
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    const std::vector<Run>& runs() const {
+        return saved_runs;
+    }
+
+    // hash of the records in runs()
+    const MultisetHash& hash() const {
+        return saved_hash;
+    }
+
+    // the run generation finished, runs() hold the whole input
+    bool merging() const {
+        return saved_merging;
+    }
+
+    // number of input records in runs(), where a resumed run generation goes on
+    size_t input_elements() const {
+        size_t elements = 0;
+        for (const Run& run : saved_runs) {
+            elements += run.elements;
+        }
+        return elements;
+    }
+
+    // a run file is about to be created
+    void begin_run(const std::string& file) {
+        pending.push_back(file);
+        write();
+    }
+
+    // runs are finished, closed and hold the records of hash, the saved runs that are not among them are
+    // recorded to be deleted, the caller removes them right after
+    void save(const std::vector<Run>& runs, const MultisetHash& hash, bool merging) {
+        std::map<std::string, size_t> sizes;
+        for (const Run& run : runs) {
+            auto known = file_bytes.find(run.file);
+            sizes[run.file] = known != file_bytes.end() ? known->second : std::filesystem::file_size(run.file);
+        }
+        deleted.clear();
+        for (const Run& run : saved_runs) {
+            if (sizes.count(run.file) == 0) {
+                deleted.push_back(run.file);
+            }
+        }
+        file_bytes = std::move(sizes);
+        saved_runs = runs;
+        saved_hash = hash;
+        saved_merging = merging;
+        std::erase_if(pending, [&](const std::string& file) { return file_bytes.count(file) > 0; });
+        write();
+    }
+
+    /**
+     * read every run once and compare its records with the hash of the manifest, block_elements at a time
+     * if a run does not hold the records it had, all runs are removed and the sort starts over
+     */
+    template <typename Record>
+    void check_runs(const SortOptions& options, size_t block_elements) {
+        std::string problem;
+        Buffer<Record> block(block_elements);
+        for (const Run& run : saved_runs) {
+            MultisetHash hash;
+            try {
+                std::unique_ptr<File> file = run_open<Record>(run.file, options);
+                for (size_t start = 0; start < run.elements; start += block_elements) {
+                    size_t elements = std::min(block_elements, run.elements - start);
+                    read_data(*file, block, start, 0, elements);
+                    hash.add(block.data(), elements);
+                }
+            } catch (const std::exception& e) {
+                problem = "run " + run.file + " can not be read: " + e.what();
+                break;
+            }
+            if (!(hash == run.hash)) {
+                problem = "run " + run.file + " does not hold the records it was saved with";
+                break;
+            }
+        }
+        if (problem.empty()) return;
+        std::cerr << "checkpoint " << path << ": " << problem << ", starting over" << std::endl;
+        for (const Run& run : saved_runs) {
+            std::error_code error;
+            std::filesystem::remove(run.file, error);
+        }
+        saved_runs.clear();
+        saved_hash = MultisetHash();
+        saved_merging = false;
+        file_bytes.clear();
+        write();
+    }
+
+    // the sort is done, the manifest is not needed anymore
+    void finish() {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+
+private:
+    std::string path;
+    std::string input;
+    std::vector<Run> saved_runs;
+    MultisetHash saved_hash;
+    bool saved_merging = false;
+    std::vector<std::string> pending;
+    // runs the last save replaced
+    std::vector<std::string> deleted;
+    // sizes of the run files in the manifest, each file is measured once after it was closed
+    std::map<std::string, size_t> file_bytes;
+
+    void write() {
+        std::ostringstream manifest;
+        manifest << "external-sort-checkpoint 2\n" << input << "\n";
+        manifest << "hash " << saved_hash.count << " " << saved_hash.sum << " " << saved_hash.mixed_sum << "\n";
+        manifest << "state " << (saved_merging ? "merging" : "generating") << "\n";
+        for (const Run& run : saved_runs) {
+            manifest << "run " << run.elements << " " << file_bytes[run.file] << " " << run.hash.sum << " " << run.hash.mixed_sum << " " << run.file << "\n";
+        }
+        for (const std::string& file : pending) {
+            manifest << "pending " << file << "\n";
+        }
+        for (const std::string& file : deleted) {
+            manifest << "delete " << file << "\n";
+        }
+
+        std::string temporary = path + ".tmp";
+        std::FILE* file = std::fopen(temporary.c_str(), "w");
+        if (file == nullptr) {
+            throw std::runtime_error("unable to write checkpoint " + temporary);
+        }
+        std::string text = manifest.str();
+        bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size() && std::fflush(file) == 0 && ::fsync(fileno(file)) == 0;
+        if (std::fclose(file) != 0 || !written) {
+            throw std::runtime_error("unable to write checkpoint " + temporary);
+        }
+        std::filesystem::rename(temporary, path);
+    }
+
+    static std::string identify(const std::string& input_filename, size_t input_size, const char* record_name, bool compressed) {
+        std::filesystem::path input_path = std::filesystem::absolute(input_filename);
+        auto modified = std::filesystem::last_write_time(input_path).time_since_epoch().count();
+        std::ostringstream line;
+        line << "input " << input_size << " " << modified << " " << record_name << " " << compressed << " " << input_path.string();
+        return line.str();
+    }
+
+    void load() {
+        std::ifstream file(path);
+        if (!file.is_open()) return;
+        std::string header;
+        std::string input_line;
+        std::getline(file, header);
+        std::getline(file, input_line);
+        if (header != "external-sort-checkpoint 2" || input_line != input) {
+            std::cerr << "checkpoint " << path << " belongs to another input, starting over" << std::endl;
+            return;
+        }
+
+        std::vector<Run> runs;
+        MultisetHash hash;
+        bool merging = false;
+        std::map<std::string, size_t> sizes;
+        std::vector<std::string> unfinished;
+        std::string problem;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string kind;
+            fields >> kind;
+            if (kind == "hash") {
+                fields >> hash.count >> hash.sum >> hash.mixed_sum;
+            } else if (kind == "state") {
+                std::string state;
+                fields >> state;
+                merging = state == "merging";
+            } else if (kind == "run") {
+                Run run;
+                size_t bytes = 0;
+                fields >> run.elements >> bytes >> run.hash.sum >> run.hash.mixed_sum;
+                run.hash.count = run.elements;
+                std::getline(fields >> std::ws, run.file);
+                std::error_code error;
+                if (problem.empty() && (std::filesystem::file_size(run.file, error) != bytes || error)) {
+                    problem = "run " + run.file + " is missing or has another size";
+                }
+                sizes[run.file] = bytes;
+                runs.push_back(run);
+            } else if (kind == "pending" || kind == "delete") {
+                unfinished.emplace_back();
+                std::getline(fields >> std::ws, unfinished.back());
+            }
+            if (!fields && problem.empty()) {
+                problem = "it is damaged";
+            }
+        }
+        // the files are this sort's, what can not be resumed is removed with the unfinished runs
+        if (!problem.empty()) {
+            std::cerr << "checkpoint " << path << ": " << problem << ", starting over" << std::endl;
+            for (const Run& run : runs) {
+                unfinished.push_back(run.file);
+            }
+            sizes.clear();
+            runs.clear();
+        }
+        for (const std::string& name : unfinished) {
+            if (sizes.count(name) == 0) {
+                std::error_code error;
+                std::filesystem::remove(name, error);
+            }
+        }
+        if (!problem.empty()) return;
+        saved_runs = std::move(runs);
+        saved_hash = hash;
+        saved_merging = merging;
+        file_bytes = std::move(sizes);
+    }
+};
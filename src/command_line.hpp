@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include "record.hpp"
+#include "sort_config.hpp"
+
+inline bool parse_record_type(const std::string& value, RecordType& record_type) {
+    const std::pair<const char*, RecordType> types[] = {
+        {RecordTraits<int64_t>::name, RecordType::i64},
+        {RecordTraits<uint64_t>::name, RecordType::u64},
+        {RecordTraits<uint32_t>::name, RecordType::u32},
+        {RecordTraits<double>::name, RecordType::f64},
+        {RecordTraits<KeyPayload16>::name, RecordType::kv16},
+        {RecordTraits<SortBenchmarkRecord>::name, RecordType::sb100},
+    };
+    for (auto& [name, type] : types) {
+        if (value == name) {
+            record_type = type;
+            return true;
+        }
+    }
+    return false;
+}
+
+// value as a count, false unless it is only digits, std::stoul would take -1 and wrap it around
+inline bool parse_count(const std::string& value, size_t& count) {
+    if (value.empty() || !std::all_of(value.begin(), value.end(), [](unsigned char c) { return std::isdigit(c); })) {
+        return false;
+    }
+    try {
+        count = std::stoul(value);
+    } catch (const std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
+
+// value as a number that is not negative, false if it is not one or has anything after it
+inline bool parse_number(const std::string& value, double& number) {
+    size_t used = 0;
+    try {
+        number = std::stod(value, &used);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return used == value.size() && number >= 0;
+}
+
+// parse one --name=value option of the sort, false if it is unknown or its value is not a number where one belongs
+inline bool parse_option(const std::string& arg, SortOptions& options, RecordType& record_type) {
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+    std::string name = arg.substr(2, equals - 2);
+    std::string value = arg.substr(equals + 1);
+    auto bad_value = [&arg, &value](const char* expected) {
+        std::cerr << "Error: (options) " << arg << ": " << value << " is not " << expected << std::endl;
+        return false;
+    };
+    if (name == "threads") {
+        size_t threads;
+        if (!parse_count(value, threads)) return bad_value("a count");
+        options.threads = std::max<size_t>(1, threads);
+    } else if (name == "strategy" && value == "merge") {
+        options.strategy = SortStrategy::merge;
+    } else if (name == "strategy" && value == "distribute") {
+        options.strategy = SortStrategy::distribution;
+    } else if (name == "sort" && value == "merge") {
+        options.sort_algorithm = SortAlgorithm::merge;
+    } else if (name == "sort" && value == "radix") {
+        options.sort_algorithm = SortAlgorithm::radix;
+    } else if (name == "runs" && value == "sort") {
+        options.run_generation = RunGeneration::sort;
+    } else if (name == "runs" && value == "replacement") {
+        options.run_generation = RunGeneration::replacement_selection;
+    } else if (name == "io" && value == "stream") {
+        options.io_backend = IoBackend::stream;
+    } else if (name == "io" && value == "pread") {
+        options.io_backend = IoBackend::pread;
+    } else if (name == "io" && value == "mmap") {
+        options.io_backend = IoBackend::mmap;
+    } else if (name == "io" && value == "direct") {
+        options.io_backend = IoBackend::direct;
+    } else if (name == "tmp") {
+        // a comma separated list of directories
+        options.temp_directories.clear();
+        for (size_t start = 0; start <= value.size();) {
+            size_t comma = std::min(value.find(',', start), value.size());
+            if (comma > start) {
+                options.temp_directories.push_back(value.substr(start, comma - start));
+            }
+            start = comma + 1;
+        }
+    } else if (name == "simd" && value == "auto") {
+        options.simd = SimdLevel::automatic;
+    } else if (name == "simd" && value == "scalar") {
+        options.simd = SimdLevel::scalar;
+    } else if (name == "simd" && value == "avx2") {
+        options.simd = SimdLevel::avx2;
+    } else if (name == "simd" && value == "avx512") {
+        options.simd = SimdLevel::avx512;
+    } else if (name == "compress" && value == "on") {
+        options.compress_runs = true;
+    } else if (name == "compress" && value == "off") {
+        options.compress_runs = false;
+    } else if (name == "verify" && value == "on") {
+        options.verify = true;
+    } else if (name == "verify" && value == "off") {
+        options.verify = false;
+    } else if (name == "smallest") {
+        if (!parse_count(value, options.limit)) return bad_value("a count of records");
+        options.order = SortOrder::ascending;
+    } else if (name == "largest") {
+        // the smallest records of the descending order
+        if (!parse_count(value, options.limit)) return bad_value("a count of records");
+        options.order = SortOrder::descending;
+    } else if (name == "checkpoint") {
+        options.checkpoint = value;
+    } else if (name == "progress") {
+        if (!parse_number(value, options.progress_seconds)) return bad_value("a number of seconds");
+    } else if (name == "record") {
+        return parse_record_type(value, record_type);
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "external_merge.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_generation.hpp"
+#include "scratch.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+// a key range of the input in a file of its own, equal_keys if it is a single key that many records have,
+// then its records are in order as they are
+struct Bucket {
+    std::string file;
+    size_t elements = 0;
+    bool equal_keys = false;
+};
+
+// every bucket has an open file and two write buffers of at least this size (and whole pages) during the distribution
+constexpr size_t min_bucket_block_size = 16 * 1024;
+constexpr size_t max_buckets = 512;
+
+/**
+ * number of key range buckets for an input, each is planned to fill half a memory load (internal_memory_size / 4,
+ * what the bucket sort sorts at once), so that the error of the sampled splitters does not push it over
+ * the buckets are limited by their write buffers, larger inputs get fuller buckets
+ * 1 means the input is a single memory load and is not distributed
+ */
+template <typename Record>
+size_t distribution_buckets(size_t input_size, size_t internal_memory_size) {
+    size_t bucket_bytes = aligned_elements<Record>(internal_memory_size / 4) * sizeof(Record) / 2;
+    size_t bucket_block_bytes = std::max(min_bucket_block_size, aligned_elements<Record>(0) * sizeof(Record));
+    size_t limit = std::clamp<size_t>(internal_memory_size * 3 / 4 / (2 * bucket_block_bytes), 1, max_buckets);
+    return std::clamp<size_t>((input_size + bucket_bytes - 1) / bucket_bytes, 1, limit);
+}
+
+/**
+ * bucket boundaries, a key that takes more than one bucket of the sample is heavy and gets a bucket of its own,
+ * so inputs with few distinct keys do not pile them up in one range
+ * bucket 2 * j holds the records after keys[j - 1] up to keys[j], bucket 2 * j + 1 the records equal to a heavy keys[j]
+ */
+template <typename Record>
+struct Splitters {
+    std::vector<Record> keys;
+    std::vector<bool> heavy;
+
+    size_t buckets() const {
+        return 2 * keys.size() + 1;
+    }
+
+    size_t bucket(const Record& record) const {
+        auto less = [](const Record& a, const Record& b) { return RecordTraits<Record>::less(a, b); };
+        size_t j = std::lower_bound(keys.begin(), keys.end(), record, less) - keys.begin();
+        return 2 * j + (j < keys.size() && heavy[j] && !less(record, keys[j]));
+    }
+};
+
+/**
+ * up to buckets - 1 splitters from a sample of the input
+ * the sample is read in short pieces spread evenly over the file, a few thousand small reads at most,
+ * and sees every part of an input that is sorted in places
+ */
+template <typename Record>
+Splitters<Record> sample_splitters(File& input, size_t elements, size_t buckets, size_t block_elements) {
+    const size_t oversampling = 64;
+    const size_t pieces_per_bucket = 32;
+    size_t samples = std::min(elements, std::max(buckets * oversampling, block_elements));
+    size_t pieces = std::min(samples, std::clamp<size_t>(buckets * pieces_per_bucket, 256, 4096));
+    size_t piece_elements = samples / pieces;
+    samples = pieces * piece_elements;
+
+    Buffer<Record> sample(samples);
+    for (size_t piece = 0; piece < pieces; piece++) {
+        size_t start = (elements - piece_elements) / std::max<size_t>(1, pieces - 1) * piece;
+        read_data(input, sample, start, piece * piece_elements, piece_elements);
+    }
+    std::sort(sample.begin(), sample.end(), [](const Record& a, const Record& b) { return RecordTraits<Record>::less(a, b); });
+
+    Splitters<Record> splitters;
+    for (size_t bucket = 1; bucket < buckets; bucket++) {
+        const Record& key = sample[bucket * samples / buckets];
+        if (!splitters.keys.empty() && !RecordTraits<Record>::less(splitters.keys.back(), key)) {
+            splitters.heavy.back() = true;
+        } else {
+            splitters.keys.push_back(key);
+            splitters.heavy.push_back(false);
+        }
+    }
+    return splitters;
+}
+
+/**
+ * first pass of the distribution sort: scatter the input into key range buckets in one streaming read
+ * the input is read in double buffered blocks, every bucket has a double buffered writer (see BlockWriter)
+ * with a share of the memory, so all of them are written in the background by one I/O thread
+ * buckets hold unsorted records and are not compressed, delta coding only pays off for sorted runs
+ * if options.verify is set, the records are added to input_hash
+ */
+template <typename Record>
+std::vector<Bucket> distribute(File& input, size_t file_size, ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options, PhaseStats& phase, MultisetHash& input_hash) {
+    size_t elements = whole_records<Record>(file_size, "input");
+    size_t input_block_elements = aligned_elements<Record>(std::min(block_size, internal_memory_size / 8));
+
+    IoThread reader;
+    IoThread writer;
+    PhaseMeasurement measurement({&reader}, {&writer});
+    Splitters<Record> splitters = sample_splitters<Record>(input, elements, distribution_buckets<Record>(file_size, internal_memory_size), input_block_elements);
+
+    // only the heavy keys have an equal key bucket
+    size_t slots = splitters.buckets();
+    size_t buckets = splitters.keys.size() + 1 + std::count(splitters.heavy.begin(), splitters.heavy.end(), true);
+    size_t bucket_block_elements = aligned_elements<Record>(std::min(block_size, (internal_memory_size - 2 * input_block_elements * sizeof(Record)) / (2 * buckets)));
+    check_buffer_memory((2 * input_block_elements + 2 * buckets * bucket_block_elements) * sizeof(Record), internal_memory_size, "distribution");
+    std::vector<Bucket> runs(slots);
+    std::vector<std::unique_ptr<File>> files(slots);
+    std::vector<Buffer<Record>> buffers;
+    buffers.reserve(2 * buckets);
+    std::vector<std::unique_ptr<BlockWriter<Record>>> writers(slots);
+    for (size_t slot = 0; slot < slots; slot++) {
+        runs[slot].equal_keys = slot % 2 == 1;
+        if (runs[slot].equal_keys && !splitters.heavy[slot / 2]) continue;
+        runs[slot].file = scratch_space.create_name();
+        files[slot] = file_create(runs[slot].file, options.io_backend);
+        buffers.emplace_back(bucket_block_elements);
+        buffers.emplace_back(bucket_block_elements);
+        writers[slot] = std::make_unique<BlockWriter<Record>>(buffers[buffers.size() - 2], buffers.back(), writer);
+        writers[slot]->start(*files[slot]);
+    }
+
+    MergeSource<Record> source;
+    source.block_elements = input_block_elements;
+    source.end_element_file = elements;
+    source.request(reader, input);
+    while (source.refill(reader, input)) {
+        const Record* records = source.data;
+        for (size_t i = 0; i < source.filled; i++) {
+            size_t bucket = splitters.bucket(records[i]);
+            writers[bucket]->push(records[i]);
+            runs[bucket].elements++;
+        }
+        if (options.verify) {
+            input_hash.add(records, source.filled);
+        }
+    }
+    double write_stall = 0;
+    for (size_t slot = 0; slot < slots; slot++) {
+        if (!writers[slot]) continue;
+        writers[slot]->finish();
+        write_stall += writers[slot]->stall_seconds();
+        files[slot]->close();
+    }
+    std::erase_if(runs, [](const Bucket& bucket) { return bucket.file.empty(); });
+    measurement.finish(phase);
+    phase.runs_out = buckets;
+    phase.read_stall_seconds = source.stall_seconds;
+    phase.write_stall_seconds = write_stall;
+    phase.sort_seconds = phase.seconds - phase.read_stall_seconds - phase.write_stall_seconds;
+    return runs;
+}
+
+/**
+ * sort the buckets [first, last), each one a memory load at most, into output from element offset on
+ * the same pipeline as the run formation: while bucket n is sorted with all threads,
+ * bucket n + 1 is read and bucket n - 1 is written; a bucket file is deleted once it was read
+ * nothing past options.limit records of the output is written
+ */
+template <typename Record>
+void sort_buckets_in_memory(const std::vector<Bucket>& buckets, size_t first, size_t last, File& output, size_t offset, ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options, PhaseStats& phase) {
+    size_t chunk_elements = aligned_elements<Record>(internal_memory_size / 4);
+    size_t block_elements = aligned_elements<Record>(block_size);
+    check_buffer_memory(4 * chunk_elements * sizeof(Record), internal_memory_size, "bucket sort");
+    std::vector<Buffer<Record>> buffers(3, Buffer<Record>(chunk_elements));
+    Buffer<Record> scratch(chunk_elements);
+    std::future<void> writes[3];
+    std::future<void> reading;
+    IoThread reader;
+    IoThread writer;
+    PhaseStats segment;
+    PhaseMeasurement measurement({&reader}, {&writer});
+
+    auto request_read = [&](size_t bucket) {
+        Buffer<Record>& buffer = buffers[bucket % 3];
+        if (writes[bucket % 3].valid()) {
+            wait_io(writes[bucket % 3], phase.write_stall_seconds);
+        }
+        const Bucket& run = buckets[bucket];
+        reading = reader.submit([&buffer, &run, &scratch_space, &options, block_elements] {
+            std::unique_ptr<File> file = file_open(run.file, options.io_backend);
+            if (!file || read_chunk(*file, buffer, 0, run.elements, block_elements) != run.elements) {
+                throw std::runtime_error("bucket " + run.file + " is shorter than it was written");
+            }
+            file.reset();
+            scratch_space.release(run.file);
+        });
+    };
+
+    request_read(first);
+    for (size_t bucket = first; bucket < last; bucket++) {
+        wait_io(reading, phase.read_stall_seconds);
+        if (bucket + 1 < last) {
+            request_read(bucket + 1);
+        }
+        Buffer<Record>& buffer = buffers[bucket % 3];
+        size_t elements = buckets[bucket].elements;
+        auto sort_start = StatsClock::now();
+        if (elements > 0 && !buckets[bucket].equal_keys) {
+            sort_internal(buffer, scratch, 0, elements, options);
+        }
+        phase.sort_seconds += seconds_since(sort_start);
+        size_t keep = offset < options.limit ? std::min(elements, options.limit - offset) : 0;
+        writes[bucket % 3] = writer.submit([&output, &buffer, offset, keep, block_elements] {
+            write_chunk(output, buffer.data(), offset, keep, block_elements);
+        });
+        offset += elements;
+    }
+    for (auto& write : writes) {
+        if (write.valid()) {
+            wait_io(write, phase.write_stall_seconds);
+        }
+    }
+    measurement.finish(segment);
+    phase.read_seconds += segment.read_seconds;
+    phase.write_seconds += segment.write_seconds;
+}
+
+// copy elements records from the start of input to output at element offset, block by block
+template <typename Record>
+void copy_records(File& input, File& output, size_t offset, size_t elements, size_t block_size) {
+    size_t block_elements = aligned_elements<Record>(block_size);
+    Buffer<Record> block(block_elements);
+    for (size_t start = 0; start < elements; start += block_elements) {
+        size_t count = std::min(block_elements, elements - start);
+        read_data(input, block, start, 0, count);
+        write_data(output, block.data(), offset + start, count);
+    }
+}
+
+/**
+ * a bucket larger than a memory load: one key is copied as it is, a range the sample underestimated
+ * is sorted like a whole input, its runs and merge passes stay on the half of the scratch directories the
+ * buckets were not written to, which is split again for the passes (see ScratchSpace::narrow)
+ * and the last merge pass writes it straight to its place in output
+ * only the records up to options.limit of the whole output are written, offset has to be below it
+ */
+template <typename Record>
+void sort_bucket_external(const Bucket& bucket, File& output, size_t offset, ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options) {
+    std::unique_ptr<File> input = file_open(bucket.file, options.io_backend);
+    if (!input) {
+        throw std::runtime_error("unable to open bucket " + bucket.file);
+    }
+    size_t keep = std::min(bucket.elements, options.limit - offset);
+    if (bucket.equal_keys) {
+        copy_records<Record>(*input, output, offset, keep, block_size);
+        input.reset();
+        scratch_space.release(bucket.file);
+        return;
+    }
+
+    SortOptions bucket_options = options;
+    bucket_options.verify = false;
+    bucket_options.limit = keep;
+    SortStats bucket_stats;
+    MultisetHash unused;
+    NarrowedScratch narrowed(scratch_space, 1);
+    std::vector<Run> runs = partition<Record>(*input, bucket.elements * sizeof(Record), scratch_space, internal_memory_size, block_size, bucket_options, bucket_stats.run_generation, unused, nullptr);
+    input.reset();
+    scratch_space.release(bucket.file);
+
+    MergePasses<Record> passes(scratch_space, internal_memory_size, block_size, bucket_options, bucket_stats, nullptr);
+    passes.merge_all(passes.reduce(std::move(runs)), output, offset);
+}
+
+/**
+ * distribution sort of a file: sample splitters, scatter the records into key range buckets in one pass
+ * (see distribute) and sort every bucket in memory straight into its place in the output
+ * two passes over the disk for any input whose buckets fit, which holds for a few hundred memory loads of
+ * evenly spread keys; a bucket that got too large is merge sorted on its own (see sort_bucket_external),
+ * unless it is one heavy key
+ * the input has to be a file that can be sampled, stdin goes through the merge sort
+ * with options.limit the buckets after the one that reaches the limit are not read at all
+ */
+template <typename Record>
+void distribution_sort(File& input, size_t file_size, const std::string& out_filename, ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options, SortStats& stats, ProgressReporter* progress) {
+    stats.distribution = true;
+    stats.run_generation.name = "distribution";
+    if (progress != nullptr) {
+        progress->phase(stats.run_generation.name);
+    }
+    std::vector<Bucket> buckets = distribute<Record>(input, file_size, scratch_space, internal_memory_size, block_size, options, stats.run_generation, stats.input_hash);
+    stats.runs = buckets.size();
+    for (const Bucket& bucket : buckets) {
+        stats.input_records += bucket.elements;
+    }
+
+    stats.merge_passes.push_back(PhaseStats{"bucket sort"});
+    PhaseStats& phase = stats.merge_passes.back();
+    phase.runs_in = buckets.size();
+    if (progress != nullptr) {
+        progress->phase(phase.name);
+    }
+    PhaseMeasurement measurement({}, {});
+    std::unique_ptr<File> output = file_create(out_filename, options.io_backend);
+    size_t chunk_elements = aligned_elements<Record>(internal_memory_size / 4);
+    size_t offset = 0;
+    size_t first = 0;
+    while (first < buckets.size() && offset < options.limit) {
+        if (buckets[first].elements > chunk_elements) {
+            sort_bucket_external<Record>(buckets[first], *output, offset, scratch_space, internal_memory_size, block_size, options);
+            offset += buckets[first].elements;
+            stats.merged_buckets += buckets[first].equal_keys ? 0 : 1;
+            first++;
+            continue;
+        }
+        size_t last = first;
+        size_t elements = 0;
+        while (last < buckets.size() && buckets[last].elements <= chunk_elements && offset + elements < options.limit) {
+            elements += buckets[last].elements;
+            last++;
+        }
+        sort_buckets_in_memory<Record>(buckets, first, last, *output, offset, scratch_space, internal_memory_size, block_size, options, phase);
+        offset += elements;
+        first = last;
+    }
+    for (; first < buckets.size(); first++) {
+        scratch_space.release(buckets[first].file);
+    }
+    output->close();
+    // busy times are summed up by the segments, the rest covers the whole phase
+    double read_seconds = phase.read_seconds;
+    double write_seconds = phase.write_seconds;
+    measurement.finish(phase);
+    phase.read_seconds = read_seconds;
+    phase.write_seconds = write_seconds;
+    phase.runs_out = 1;
+}
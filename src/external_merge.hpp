@@ -0,0 +1,637 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_codec.hpp"
+#include "scratch.hpp"
+#include "sort_config.hpp"
+#include "sort_kernels.hpp"
+#include "sort_stats.hpp"
+
+/**
+ * tournament tree over the heads of k sorted runs
+ * internal nodes store the loser of the match played there, tree[0] the overall winner
+ * the heads are pointers into the input blocks, so large records are not copied into the tree
+ * exhausted ways lose against everything, so the merge is done once the winner is exhausted
+ * a tree has at least one way, its root is a way even if all of them are exhausted
+ */
+template <typename Record>
+class LoserTree {
+public:
+    explicit LoserTree(size_t ways) : ways(ways), tree(ways), heads(ways, nullptr) {
+        if (ways == 0) {
+            throw std::invalid_argument("a loser tree needs at least one way");
+        }
+    }
+
+    void set(size_t way, const Record* head) {
+        heads[way] = head;
+    }
+
+    void set_exhausted(size_t way) {
+        heads[way] = nullptr;
+    }
+
+    // play all matches once after the initial heads are set
+    void build() {
+        std::vector<size_t> winners(ways);
+        for (size_t node = ways - 1; node > 0; node--) {
+            size_t left = child_winner(winners, 2 * node);
+            size_t right = child_winner(winners, 2 * node + 1);
+            if (beats(left, right)) {
+                winners[node] = left;
+                tree[node] = right;
+            } else {
+                winners[node] = right;
+                tree[node] = left;
+            }
+        }
+        tree[0] = ways > 1 ? winners[1] : 0;
+    }
+
+    size_t winner() const {
+        return tree[0];
+    }
+
+    const Record& winner_record() const {
+        return *heads[tree[0]];
+    }
+
+    bool empty() const {
+        return heads[tree[0]] == nullptr;
+    }
+
+    // matches played so far
+    size_t comparisons() const {
+        return matches;
+    }
+
+    // replace the head of the current winner and replay its path to the root
+    void push(const Record* head) {
+        heads[tree[0]] = head;
+        replay();
+    }
+
+    // the current winner has no more elements
+    void pop() {
+        heads[tree[0]] = nullptr;
+        replay();
+    }
+
+private:
+    size_t ways;
+    std::vector<size_t> tree;
+    std::vector<const Record*> heads;
+    mutable size_t matches = 0;
+
+    bool beats(size_t a, size_t b) const {
+        matches++;
+        if (heads[a] == nullptr) return false;
+        if (heads[b] == nullptr) return true;
+        if (RecordTraits<Record>::less(*heads[a], *heads[b])) return true;
+        return !RecordTraits<Record>::less(*heads[b], *heads[a]) && a < b;
+    }
+
+    // leaves are stored implicitly at positions ways..2*ways-1
+    size_t child_winner(const std::vector<size_t>& winners, size_t node) const {
+        return node >= ways ? node - ways : winners[node];
+    }
+
+    void replay() {
+        size_t current = tree[0];
+        for (size_t node = (current + ways) / 2; node > 0; node /= 2) {
+            if (beats(tree[node], current)) {
+                std::swap(tree[node], current);
+            }
+        }
+        tree[0] = current;
+    }
+};
+
+/**
+ * buffers and I/O threads of one merging thread, a parallel merge has one worker per thread
+ * every way and the output get two blocks (one in use, one in flight)
+ */
+template <typename Record>
+struct MergeWorker {
+    std::vector<MergeSource<Record>> sources;
+    Buffer<Record> output_buffer;
+    Buffer<Record> output_in_flight;
+    IoThread reader;
+    IoThread writer;
+    BlockWriter<Record> output;
+    // int64 kernel of the two way merges of the sort, nullptr for the loser tree
+    MergeInt64 kernel;
+    size_t comparisons = 0;
+    double read_stall_seconds = 0;
+
+    MergeWorker(size_t ways, size_t block_elements, MergeInt64 kernel = nullptr)
+        : sources(ways), output_buffer(block_elements), output_in_flight(block_elements), output(output_buffer, output_in_flight, writer), kernel(kernel) {
+        for (auto& source : sources) {
+            source.block_elements = block_elements;
+        }
+    }
+
+    // merge the ranges [begin[way], end[way]) of the inputs into output from element output_start on,
+    // the merge stops after limit records and the blocks that were read ahead of it are dropped
+    void merge(std::vector<std::unique_ptr<File>>& inputs, const std::vector<size_t>& begin, const std::vector<size_t>& end, File& output_file, size_t output_start, size_t limit = SIZE_MAX) {
+        size_t ways = inputs.size();
+        output.start(output_file, output_start);
+        if constexpr (std::is_same_v<Record, int64_t>) {
+            if (ways == 2 && kernel != nullptr) {
+                merge_two(inputs, begin, end, limit);
+                return;
+            }
+        }
+        LoserTree<Record> tree(ways);
+        for (size_t way = 0; way < ways; way++) {
+            MergeSource<Record>& source = sources[way];
+            source.stall_seconds = 0;
+            source.next_element_file = begin[way];
+            source.end_element_file = end[way];
+            source.request(reader, *inputs[way]);
+        }
+        for (size_t way = 0; way < ways; way++) {
+            MergeSource<Record>& source = sources[way];
+            if (source.refill(reader, *inputs[way])) {
+                tree.set(way, source.data);
+            }
+        }
+        tree.build();
+
+        for (size_t merged = 0; merged < limit && !tree.empty(); merged++) {
+            size_t way = tree.winner();
+            output.push(tree.winner_record());
+
+            MergeSource<Record>& source = sources[way];
+            source.position++;
+            if (source.position < source.filled || source.refill(reader, *inputs[way])) {
+                tree.push(source.data + source.position);
+            } else {
+                tree.pop();
+            }
+        }
+        output.finish();
+        comparisons += tree.comparisons();
+        for (size_t way = 0; way < ways; way++) {
+            sources[way].abandon();
+            read_stall_seconds += sources[way].stall_seconds;
+        }
+    }
+
+    /**
+     * two way merge block by block with the merge kernel instead of the loser tree
+     * every round merges the records up to the smaller of the two last records of the current blocks,
+     * those cannot be preceded by a record of a later block, and cuts the round to the free output space
+     * the kernel does not count its comparisons
+     */
+    void merge_two(std::vector<std::unique_ptr<File>>& inputs, const std::vector<size_t>& begin, const std::vector<size_t>& end, size_t limit) {
+        MergeSource<Record>& a = sources[0];
+        MergeSource<Record>& b = sources[1];
+        for (size_t way = 0; way < 2; way++) {
+            sources[way].stall_seconds = 0;
+            sources[way].next_element_file = begin[way];
+            sources[way].end_element_file = end[way];
+            sources[way].request(reader, *inputs[way]);
+        }
+        bool has_a = a.refill(reader, *inputs[0]);
+        bool has_b = b.refill(reader, *inputs[1]);
+
+        size_t merged = 0;
+        while (has_a && has_b && merged < limit) {
+            const Record* a_begin = a.data + a.position;
+            const Record* b_begin = b.data + b.position;
+            const Record* a_end = a.data + a.filled;
+            const Record* b_end = b.data + b.filled;
+            Record bound = std::min(a_end[-1], b_end[-1]);
+            size_t a_safe = std::upper_bound(a_begin, a_end, bound) - a_begin;
+            size_t b_safe = std::upper_bound(b_begin, b_end, bound) - b_begin;
+            size_t n = std::min({a_safe + b_safe, output.available(), limit - merged});
+
+            // i records of a and n - i of b are the n smallest, ties go to a like in the loser tree
+            size_t low = n > b_safe ? n - b_safe : 0;
+            size_t high = std::min(n, a_safe);
+            while (low < high) {
+                size_t i = low + (high - low) / 2;
+                if (b_begin[n - i - 1] < a_begin[i]) {
+                    high = i;
+                } else {
+                    low = i + 1;
+                }
+            }
+            ::merge(a_begin, a_begin + low, b_begin, b_begin + (n - low), output.space(), kernel);
+            output.commit(n);
+            merged += n;
+
+            a.position += low;
+            b.position += n - low;
+            if (a.position == a.filled) has_a = a.refill(reader, *inputs[0]);
+            if (b.position == b.filled) has_b = b.refill(reader, *inputs[1]);
+        }
+
+        MergeSource<Record>& rest = has_a ? a : b;
+        File& rest_input = has_a ? *inputs[0] : *inputs[1];
+        bool has_rest = has_a || has_b;
+        while (has_rest && merged < limit) {
+            size_t n = std::min({rest.filled - rest.position, output.available(), limit - merged});
+            std::copy(rest.data + rest.position, rest.data + rest.position + n, output.space());
+            output.commit(n);
+            merged += n;
+            rest.position += n;
+            if (rest.position == rest.filled) has_rest = rest.refill(reader, rest_input);
+        }
+        output.finish();
+        a.abandon();
+        b.abandon();
+        read_stall_seconds += a.stall_seconds + b.stall_seconds;
+    }
+};
+
+// first position in [low, high) of the run whose record satisfies the monotone predicate, high if there is none
+template <typename Record, typename Predicate>
+size_t search_run(File& run, size_t low, size_t high, Predicate predicate) {
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        Record record;
+        run.read(&record, middle * sizeof(Record), sizeof(Record));
+        if (predicate(record)) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+/**
+ * split the merge of the runs into parts of about equal size with disjoint key ranges,
+ * bounds[part][way] is the first element of run way that belongs to the part, bounds[parts] the run lengths
+ * splitters are weighted quantiles of a sample of every run, a splitter is located in a run by binary search
+ * between the two samples around it, so only a few records are read
+ * records equal to a splitter are divided so the parts stay balanced, the lower ways go first
+ * as in the loser tree, so equal keys keep the order of a serial merge
+ */
+template <typename Record>
+std::vector<std::vector<size_t>> split_merge(std::vector<std::unique_ptr<File>>& inputs, const std::vector<size_t>& lengths, size_t parts) {
+    using Traits = RecordTraits<Record>;
+    size_t ways = inputs.size();
+    size_t total = 0;
+    for (size_t length : lengths) {
+        total += length;
+    }
+
+    struct Sample {
+        Record record;
+        double weight;
+    };
+    const size_t samples_per_run = 8 * parts;
+    std::vector<std::vector<size_t>> sample_positions(ways);
+    std::vector<std::vector<Record>> sample_records(ways);
+    std::vector<Sample> samples;
+    for (size_t way = 0; way < ways; way++) {
+        for (size_t i = 0; i < samples_per_run && lengths[way] > 0; i++) {
+            size_t position = lengths[way] * i / samples_per_run;
+            if (!sample_positions[way].empty() && sample_positions[way].back() == position) continue;
+            Record record;
+            inputs[way]->read(&record, position * sizeof(Record), sizeof(Record));
+            sample_positions[way].push_back(position);
+            sample_records[way].push_back(record);
+        }
+        for (const Record& record : sample_records[way]) {
+            samples.push_back(Sample{record, double(lengths[way]) / sample_records[way].size()});
+        }
+    }
+    std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return Traits::less(a.record, b.record); });
+
+    // first position of run way whose record satisfies predicate, narrowed down with the samples first
+    auto locate = [&](size_t way, auto predicate) {
+        const std::vector<Record>& records = sample_records[way];
+        size_t next = std::partition_point(records.begin(), records.end(), [&](const Record& r) { return !predicate(r); }) - records.begin();
+        size_t low = next == 0 ? 0 : sample_positions[way][next - 1] + 1;
+        size_t high = next == records.size() ? lengths[way] : sample_positions[way][next];
+        return search_run<Record>(*inputs[way], low, high, predicate);
+    };
+
+    std::vector<std::vector<size_t>> bounds(parts + 1, std::vector<size_t>(ways, 0));
+    bounds[parts] = lengths;
+    double seen = 0;
+    size_t sample = 0;
+    for (size_t part = 1; part < parts; part++) {
+        size_t target = total * part / parts;
+        while (sample + 1 < samples.size() && seen + samples[sample].weight < target) {
+            seen += samples[sample].weight;
+            sample++;
+        }
+        const Record& splitter = samples[sample].record;
+        std::vector<size_t> lower(ways);
+        std::vector<size_t> upper(ways);
+        size_t below = 0;
+        for (size_t way = 0; way < ways; way++) {
+            lower[way] = locate(way, [&](const Record& r) { return !Traits::less(r, splitter); });
+            upper[way] = locate(way, [&](const Record& r) { return Traits::less(splitter, r); });
+            below += lower[way];
+        }
+        size_t equal_taken = target > below ? target - below : 0;
+        for (size_t way = 0; way < ways; way++) {
+            size_t take = std::min(upper[way] - lower[way], equal_taken);
+            bounds[part][way] = lower[way] + take;
+            equal_taken -= take;
+        }
+    }
+    return bounds;
+}
+
+/**
+ * merge the runs [first, last) into one run written to output from element offset on, returns its length
+ * with several workers the merge is split into key ranges that the workers merge at the same time,
+ * each writing its range at its own offset of the output
+ * with options.limit only the first limit records are merged: no run is read past its first limit records,
+ * parts that start after the limit are skipped and the part that crosses it stops there
+ * the comparisons and the time spent waiting for input are added to phase
+ */
+template <typename Record>
+size_t external_merge_runs(const std::vector<Run>& runs, size_t first, size_t last, std::vector<std::unique_ptr<MergeWorker<Record>>>& workers, File& output, size_t offset, const SortOptions& options, PhaseStats& phase) {
+    size_t ways = last - first;
+    std::vector<std::unique_ptr<File>> inputs(ways);
+    std::vector<size_t> lengths(ways);
+    size_t run_elements = 0;
+    for (size_t way = 0; way < ways; way++) {
+        inputs[way] = run_open<Record>(runs[first + way].file, options);
+        lengths[way] = std::min(runs[first + way].elements, options.limit);
+        run_elements += lengths[way];
+    }
+    size_t output_elements = std::min(run_elements, options.limit);
+
+    // a part should at least fill a few output blocks, otherwise splitting costs more than it saves
+    // a pipe takes the output in order, so it is merged by one worker
+    size_t min_part_elements = 4 * workers[0]->output_buffer.size();
+    size_t parts = std::max<size_t>(1, std::min(workers.size(), output_elements / min_part_elements));
+    if (!output.seekable()) {
+        parts = 1;
+    }
+    std::vector<std::vector<size_t>> bounds = parts > 1 ? split_merge<Record>(inputs, lengths, parts) : std::vector<std::vector<size_t>>{std::vector<size_t>(ways, 0), lengths};
+
+    std::vector<std::exception_ptr> errors(parts);
+    std::vector<std::function<void()>> tasks;
+    size_t output_start = offset;
+    for (size_t part = 0; part < parts && output_start < offset + output_elements; part++) {
+        size_t part_limit = offset + output_elements - output_start;
+        tasks.push_back([&, part, output_start, part_limit] {
+            try {
+                workers[part]->merge(inputs, bounds[part], bounds[part + 1], output, output_start, part_limit);
+            } catch (...) {
+                errors[part] = std::current_exception();
+            }
+        });
+        for (size_t way = 0; way < ways; way++) {
+            output_start += bounds[part + 1][way] - bounds[part][way];
+        }
+    }
+    run_parallel(tasks);
+    for (auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+
+    for (size_t part = 0; part < parts; part++) {
+        phase.comparisons += workers[part]->comparisons;
+        phase.read_stall_seconds += workers[part]->read_stall_seconds;
+        workers[part]->comparisons = 0;
+        workers[part]->read_stall_seconds = 0;
+    }
+    return output_elements;
+}
+
+// buffers of a merge of fan_in ways split across threads: two blocks of every way and of the output, for every thread
+template <typename Record>
+size_t merge_buffer_bytes(size_t block_size, size_t fan_in, size_t threads) {
+    return 2 * (fan_in + 1) * threads * aligned_elements<Record>(block_size / threads) * sizeof(Record);
+}
+
+// the thread count, lowered until the shares of the blocks, rounded up to whole pages, fit into the memory
+template <typename Record>
+size_t merge_threads(size_t internal_memory_size, size_t block_size, size_t fan_in, size_t threads) {
+    threads = std::max<size_t>(1, threads);
+    while (threads > 1 && merge_buffer_bytes<Record>(block_size, fan_in, threads) > internal_memory_size) {
+        threads--;
+    }
+    return threads;
+}
+
+/**
+ * merge passes over the runs of one sort, every pass is measured on its own in stats.merge_passes
+ * every run and the output get two block sized buffers (one in use, one in flight),
+ * so each pass merges up to internal_memory_size / (2 * block_size) - 1 runs at once
+ * with options.threads threads every merge is split across the threads, each thread gets
+ * its share of the blocks, so the memory use does not depend on the thread count (fewer threads
+ * merge if the shares would be rounded up past the memory, see merge_threads)
+ * the workers are created by the first pass, which merges the most runs, and shared by the later ones
+ * with options.limit every merged run keeps only its first limit records, the rest can not be in the output
+ */
+template <typename Record>
+class MergePasses {
+public:
+    const size_t fan_in;
+
+    MergePasses(ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options, SortStats& stats, ProgressReporter* progress, Checkpoint* checkpoint = nullptr)
+        : fan_in(std::max<size_t>(3, internal_memory_size / (2 * block_size)) - 1),
+          scratch_space(scratch_space), options(options), stats(stats), progress(progress), checkpoint(checkpoint),
+          threads(merge_threads<Record>(internal_memory_size, block_size, fan_in, options.threads)), block_elements(aligned_elements<Record>(block_size / threads)) {
+        check_buffer_memory(merge_buffer_bytes<Record>(block_size, fan_in, threads), internal_memory_size, "merge");
+    }
+
+    // intermediate passes write new run files and delete the merged ones right away, until at most fan_in runs are left
+    // with a checkpoint every merged run is saved, together with the runs still to merge, before its inputs go
+    // every pass writes to the scratch directories the previous one did not write to
+    std::vector<Run> reduce(std::vector<Run> runs) {
+        while (runs.size() > fan_in) {
+            scratch_space.start_pass(scratch_space.current_pass() + 1);
+            PhaseMeasurement measurement = start_pass(runs.size());
+            std::vector<Run> merged_runs;
+            for (size_t first = 0; first < runs.size(); first += fan_in) {
+                size_t last = std::min(first + fan_in, runs.size());
+                if (last - first == 1) {
+                    // a single leftover run goes to the next pass as it is
+                    merged_runs.push_back(runs[first]);
+                    continue;
+                }
+                std::string file = scratch_space.create_name();
+                if (checkpoint != nullptr) {
+                    checkpoint->begin_run(file);
+                }
+                std::unique_ptr<File> output = run_create<Record>(file, options);
+                size_t elements = merge_into(runs, first, last, *output, 0);
+                output->close();
+                merged_runs.push_back(Run{file, elements});
+                for (size_t i = first; i < last; i++) {
+                    merged_runs.back().hash.add(runs[i].hash);
+                }
+                if (checkpoint != nullptr) {
+                    std::vector<Run> state = merged_runs;
+                    state.insert(state.end(), runs.begin() + last, runs.end());
+                    checkpoint->save(state, stats.input_hash, true);
+                    scratch_space.forget(file);
+                }
+                release(runs, first, last);
+            }
+            finish_pass(measurement, merged_runs.size());
+            runs = std::move(merged_runs);
+        }
+        return runs;
+    }
+
+    // one pass that merges all runs into the output file filename
+    void merge_all(const std::vector<Run>& runs, const std::string& filename) {
+        std::unique_ptr<File> file = file_create(filename, options.io_backend);
+        merge_all(runs, *file, 0);
+    }
+
+    // one pass that merges all runs into output from element offset on
+    void merge_all(const std::vector<Run>& runs, File& output, size_t offset) {
+        PhaseMeasurement measurement = start_pass(runs.size());
+        merge_into(runs, 0, runs.size(), output, offset);
+        release(runs, 0, runs.size());
+        finish_pass(measurement, 1);
+    }
+
+private:
+    ScratchSpace& scratch_space;
+    const SortOptions& options;
+    SortStats& stats;
+    ProgressReporter* progress;
+    Checkpoint* checkpoint;
+    size_t threads;
+    size_t block_elements;
+    std::vector<std::unique_ptr<MergeWorker<Record>>> workers;
+    std::vector<const IoThread*> readers;
+    std::vector<const IoThread*> writers;
+    double pass_output_stall = 0;
+
+    size_t merge_into(const std::vector<Run>& runs, size_t first, size_t last, File& output, size_t offset) {
+        return external_merge_runs(runs, first, last, workers, output, offset, options, stats.merge_passes.back());
+    }
+
+    void release(const std::vector<Run>& runs, size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            scratch_space.release(runs[i].file);
+        }
+    }
+
+    double output_stall() const {
+        double stall = 0;
+        for (auto& worker : workers) {
+            stall += worker->output.stall_seconds();
+        }
+        return stall;
+    }
+
+    PhaseMeasurement start_pass(size_t runs_in) {
+        if (workers.empty()) {
+            for (size_t i = 0; i < threads; i++) {
+                workers.push_back(std::make_unique<MergeWorker<Record>>(std::min(fan_in, runs_in), block_elements, select_merge_int64(options.simd)));
+                readers.push_back(&workers.back()->reader);
+                writers.push_back(&workers.back()->writer);
+            }
+        }
+        stats.merge_passes.push_back(PhaseStats{"merge pass " + std::to_string(stats.merge_passes.size() + 1)});
+        stats.merge_passes.back().runs_in = runs_in;
+        pass_output_stall = output_stall();
+        if (progress != nullptr) {
+            progress->phase(stats.merge_passes.back().name);
+        }
+        return PhaseMeasurement(readers, writers);
+    }
+
+    void finish_pass(const PhaseMeasurement& measurement, size_t runs_out) {
+        PhaseStats& phase = stats.merge_passes.back();
+        measurement.finish(phase);
+        phase.runs_out = runs_out;
+        phase.write_stall_seconds = output_stall() - pass_output_stall;
+    }
+};
+
+/**
+ * k-way merge of the sorted runs produced by run formation
+ * the last pass streams into the output file, or into stdout if out_filename is -
+ */
+template <typename Record>
+void external_merge(std::vector<Run> runs, const std::string& out_filename, ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options, SortStats& stats, ProgressReporter* progress, Checkpoint* checkpoint = nullptr) {
+    MergePasses<Record> passes(scratch_space, internal_memory_size, block_size, options, stats, progress, checkpoint);
+    runs = passes.reduce(std::move(runs));
+
+    // a single run already is the result, it only has to be moved unless it is on another file system,
+    // goes to a pipe, is compressed or longer than options.limit, then it is copied by a merge of one way
+    bool to_pipe = is_pipe_name(out_filename);
+    bool copy = to_pipe || options.compress_runs || (runs.size() == 1 && runs[0].elements > options.limit);
+    std::error_code error;
+    if (runs.size() == 1 && !copy) {
+        std::filesystem::rename(runs[0].file, out_filename, error);
+        if (!error) {
+            scratch_space.forget(runs[0].file);
+        }
+    }
+    if (runs.empty()) {
+        file_create(out_filename, options.io_backend);
+    } else if (runs.size() > 1 || error || copy) {
+        passes.merge_all(runs, out_filename);
+    }
+    stats.fan_in = passes.fan_in;
+}
+
+/**
+ * k-way merge that hands the records out one by one instead of writing them to a file,
+ * the last pass of a Sorter whose output is pulled by the caller
+ */
+template <typename Record>
+class MergeStream {
+public:
+    MergeStream(const std::vector<Run>& runs, size_t block_elements, const SortOptions& options)
+        : inputs(runs.size()), sources(runs.size()), tree(runs.size()) {
+        for (size_t way = 0; way < runs.size(); way++) {
+            inputs[way] = run_open<Record>(runs[way].file, options);
+            sources[way].block_elements = block_elements;
+            sources[way].end_element_file = runs[way].elements;
+            sources[way].request(reader, *inputs[way]);
+        }
+        for (size_t way = 0; way < runs.size(); way++) {
+            if (sources[way].refill(reader, *inputs[way])) {
+                tree.set(way, sources[way].data);
+            }
+        }
+        tree.build();
+    }
+
+    // the next record in sorted order, false after the last one
+    bool next(Record& record) {
+        if (tree.empty()) return false;
+        size_t way = tree.winner();
+        record = tree.winner_record();
+
+        MergeSource<Record>& source = sources[way];
+        source.position++;
+        if (source.position < source.filled || source.refill(reader, *inputs[way])) {
+            tree.push(source.data + source.position);
+        } else {
+            tree.pop();
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::unique_ptr<File>> inputs;
+    std::vector<MergeSource<Record>> sources;
+    LoserTree<Record> tree;
+    // destroyed first, so the pending reads finish while their sources still exist
+    IoThread reader;
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "distribution_sort.hpp"
+#include "external_merge.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_generation.hpp"
+#include "scratch.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+#include "top_k.hpp"
+#include "verify.hpp"
+
+/**
+ * sort in_filename into out_filename, the input is only read
+ * block_size is lowered to max_block_size(internal_memory_size) if it is larger, so the buffers stay within the memory
+ * runs live in temporary files in options.temp_directories (next to the output by default), see ScratchSpace
+ * - reads stdin and writes stdout, input_file_size may be unknown_size, then a file is sorted
+ * completely and stdin until it ends; a file whose size is not a whole number of records is rejected
+ * with options.strategy distribution a file is sorted by sampled key range buckets (see distribution_sort),
+ * stdin and an input that fits into memory still go through runs and merging
+ * with options.limit only the first limit records of the sorted output are written: a limit that fits into
+ * memory is selected in one pass (see select_smallest), otherwise the merges stop at the limit and
+ * the distribution sort at the bucket that reaches it
+ * with options.order descending the records are sorted as OrderedBy<Record, RecordGreater<Record>>, which has
+ * no radix key and no SIMD merge kernel, so a descending sort runs the comparison sort and the scalar merge
+ * with options.checkpoint the finished runs are recorded in a manifest and a sort of the same input
+ * with the same manifest goes on from there (see Checkpoint), after its runs were read once and checked against
+ * their hashes; the manifest is removed when the merge is done
+ * with options.verify the output is read back once and checked against a hash of the input (see verify_sorted),
+ * a limited output only for its order and length, an output to stdout can not be read back and is not checked
+ * returns the sorted output opened for reading (stdout, which can not be read back, for -),
+ * nullptr if sorting or the verification failed
+ */
+template <typename Record>
+std::unique_ptr<File> sort_file_external(const std::string& in_filename, const std::string& out_filename, size_t input_file_size, size_t internal_memory_size, size_t block_size, const SortOptions& options, SortStats& stats) {
+    if (options.order == SortOrder::descending) {
+        if constexpr (is_ordered_by<Record>) {
+            std::cerr << "Error: (sort external) records with a comparator of their own can not be sorted in descending order" << std::endl;
+            return nullptr;
+        } else {
+            SortOptions ascending = options;
+            ascending.order = SortOrder::ascending;
+            return sort_file_external<OrderedBy<Record, RecordGreater<Record>>>(in_filename, out_filename, input_file_size, internal_memory_size, block_size, ascending, stats);
+        }
+    }
+    auto start_time = StatsClock::now();
+    block_size = std::min(block_size, max_block_size(internal_memory_size));
+    size_t bytes_read = io_counters.bytes_read;
+    size_t bytes_written = io_counters.bytes_written;
+
+    if (!options.checkpoint.empty() && is_pipe_name(in_filename)) {
+        std::cerr << "Error: (sort external checkpoint) a sort of a pipe can not be resumed" << std::endl;
+        return nullptr;
+    }
+    if (!options.checkpoint.empty() && options.strategy == SortStrategy::distribution) {
+        std::cerr << "Error: (sort external checkpoint) a distribution sort can not be resumed" << std::endl;
+        return nullptr;
+    }
+    if (!options.checkpoint.empty() && options.limit != SIZE_MAX) {
+        std::cerr << "Error: (sort external checkpoint) a sort with a limit can not be resumed" << std::endl;
+        return nullptr;
+    }
+    std::unique_ptr<File> file_input = file_open(in_filename, options.io_backend);
+    if (!file_input) {
+        std::cerr << "Error: (sort external input) Unable to open file " << in_filename << std::endl;
+        return nullptr;
+    }
+    if (file_input->seekable()) {
+        // a file that ends inside a record would lose its tail, a smaller size given for it is cut to whole records
+        size_t file_size = file_input->size();
+        if (file_size % sizeof(Record) != 0) {
+            std::cerr << "Error: (sort external input) " << in_filename << " has " << file_size << " bytes, which is not a whole number of "
+                      << sizeof(Record) << " byte " << RecordTraits<Record>::name << " records" << std::endl;
+            return nullptr;
+        }
+        input_file_size = std::min(input_file_size, file_size) / sizeof(Record) * sizeof(Record);
+    }
+
+    // fail before the run formation if the output can not be written
+    std::unique_ptr<File> file_output = file_open_and_clear(out_filename, options.io_backend);
+    if (!file_output) {
+        std::cerr << "Error: (sort external output) Unable to open file " << out_filename << std::endl;
+        return nullptr;
+    }
+    file_output.reset();
+
+    std::unique_ptr<ProgressReporter> progress;
+    if (options.progress_seconds > 0) {
+        progress = std::make_unique<ProgressReporter>(options.progress_seconds, input_file_size);
+    }
+    bool select_input = selects_in_memory<Record>(internal_memory_size, options);
+    bool distribute_input = options.strategy == SortStrategy::distribution && file_input->seekable()
+        && distribution_buckets<Record>(input_file_size, internal_memory_size) > 1;
+    try {
+        ScratchSpace scratch_space(scratch_directories(options, std::filesystem::absolute(out_filename).parent_path()));
+        if (select_input) {
+            stats.selected = true;
+            stats.run_generation.name = "selection";
+            if (progress) {
+                progress->phase(stats.run_generation.name);
+            }
+            stats.input_records = select_smallest<Record>(*file_input, input_file_size, out_filename, internal_memory_size, block_size, options, stats.run_generation, stats.input_hash);
+        } else if (distribute_input) {
+            distribution_sort<Record>(*file_input, input_file_size, out_filename, scratch_space, internal_memory_size, block_size, options, stats, progress.get());
+        } else {
+            std::unique_ptr<Checkpoint> checkpoint;
+            if (!options.checkpoint.empty()) {
+                checkpoint = std::make_unique<Checkpoint>(options.checkpoint, in_filename, input_file_size, RecordTraits<Record>::name, options.compress_runs);
+                checkpoint->check_runs<Record>(options, aligned_elements<Record>(block_size));
+                stats.resumed_runs = checkpoint->runs().size();
+            }
+            std::vector<Run> runs;
+            stats.run_generation.name = "run generation";
+            if (progress) {
+                progress->phase(stats.run_generation.name);
+            }
+            if (checkpoint && checkpoint->merging()) {
+                // the run generation of an earlier attempt finished
+                runs = checkpoint->runs();
+                stats.input_hash = checkpoint->hash();
+            } else if (options.run_generation == RunGeneration::replacement_selection) {
+                runs = partition_replacement_selection<Record>(*file_input, input_file_size, scratch_space, internal_memory_size, block_size, options, stats.run_generation, stats.input_hash, checkpoint.get());
+            } else {
+                runs = partition<Record>(*file_input, input_file_size, scratch_space, internal_memory_size, block_size, options, stats.run_generation, stats.input_hash, checkpoint.get());
+            }
+            if (checkpoint && !checkpoint->merging()) {
+                checkpoint->save(runs, stats.input_hash, true);
+                for (const Run& run : runs) {
+                    scratch_space.forget(run.file);
+                }
+            }
+            stats.runs = runs.size();
+            stats.run_generation.runs_out = runs.size();
+            for (const Run& run : runs) {
+                stats.input_records += run.elements;
+            }
+            file_input.reset();
+
+            // merge phase
+            external_merge<Record>(std::move(runs), out_filename, scratch_space, internal_memory_size, block_size, options, stats, progress.get(), checkpoint.get());
+            if (checkpoint) {
+                checkpoint->finish();
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: (sort external) " << e.what() << std::endl;
+        return nullptr;
+    }
+    stats.output_records = std::min(stats.input_records, options.limit);
+    stats.bytes_read = io_counters.bytes_read - bytes_read;
+    stats.bytes_written = io_counters.bytes_written - bytes_written;
+    stats.seconds = seconds_since(start_time);
+    if (is_pipe_name(out_filename)) {
+        return file_open_and_clear(out_filename, options.io_backend);
+    }
+    std::unique_ptr<File> result = file_open(out_filename, options.io_backend);
+    if (options.verify && result) {
+        auto verify_start = StatsClock::now();
+        VerifyResult check;
+        try {
+            check = verify_sorted<Record>(*result, aligned_elements<Record>(block_size));
+        } catch (const std::exception& e) {
+            std::cerr << "Error: (sort external verify) " << e.what() << std::endl;
+            return nullptr;
+        }
+        stats.verify_seconds = seconds_since(verify_start);
+        if (!check.sorted()) {
+            std::cerr << "Error: (sort external verify) output is not sorted at record " << check.first_unsorted << std::endl;
+            return nullptr;
+        }
+        if (stats.output_records < stats.input_records) {
+            // the records that were cut off are not known any more, only the length can be checked
+            if (check.elements != stats.output_records) {
+                std::cerr << "Error: (sort external verify) output has " << check.elements << " records instead of the first "
+                          << stats.output_records << " of the input" << std::endl;
+                return nullptr;
+            }
+        } else if (!(check.hash == stats.input_hash)) {
+            std::cerr << "Error: (sort external verify) output has " << check.hash.count << " records that are not the "
+                      << stats.input_hash.count << " records of the input" << std::endl;
+            return nullptr;
+        }
+        stats.verified = true;
+    }
+    return result;
+}
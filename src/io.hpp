@@ -0,0 +1,838 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+/**
+ * positional access to a file, offsets and sizes are in bytes
+ * reads and writes of one File may come from different threads, but a File is never read
+ * while it is written, the pipeline always reads from one file and writes to another
+ * errors are thrown as std::runtime_error and surface through the futures of the I/O threads
+ */
+class File {
+public:
+    virtual ~File() = default;
+
+    virtual void read(void* buffer, size_t offset, size_t bytes) = 0;
+    virtual void write(const void* buffer, size_t offset, size_t bytes) = 0;
+    virtual size_t size() = 0;
+
+    // read at most bytes, less only at the end of a pipe, returns the bytes read
+    // the size of a file is known, so a file reads all of them
+    virtual size_t read_up_to(void* buffer, size_t offset, size_t bytes) {
+        read(buffer, offset, bytes);
+        return bytes;
+    }
+
+    // false for pipes, which are read and written front to back only
+    virtual bool seekable() const {
+        return true;
+    }
+
+    // true if the file adds its transfers to io_counters itself, a compressed run counts its compressed bytes
+    virtual bool counts_io() const {
+        return false;
+    }
+
+    // write out what the file still holds back, unlike the destructor it throws on errors
+    virtual void close() {}
+
+    // pointer to the file contents if the backend can read them without a copy, nullptr otherwise
+    virtual const void* view(size_t /* offset */, size_t /* bytes */) {
+        return nullptr;
+    }
+
+    // hints: the range will be read soon / is not needed anymore
+    virtual void will_need(size_t /* offset */, size_t /* bytes */) {}
+    virtual void done(size_t /* offset */, size_t /* bytes */) {}
+};
+
+// std::fstream with a seek before every access, the baseline backend
+class StreamFile : public File {
+public:
+    explicit StreamFile(std::fstream stream) : stream(std::move(stream)) {}
+
+    void read(void* buffer, size_t offset, size_t bytes) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        stream.seekg(offset);
+        stream.read(static_cast<char*>(buffer), bytes);
+        if (!stream) {
+            throw std::runtime_error("read failed at offset " + std::to_string(offset));
+        }
+    }
+
+    void write(const void* buffer, size_t offset, size_t bytes) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        stream.seekp(offset);
+        stream.write(static_cast<const char*>(buffer), bytes);
+        if (!stream) {
+            throw std::runtime_error("write failed at offset " + std::to_string(offset));
+        }
+    }
+
+    size_t size() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        stream.seekg(0, std::ios::end);
+        return static_cast<size_t>(stream.tellg());
+    }
+
+private:
+    std::mutex mutex;
+    std::fstream stream;
+};
+
+// pread / pwrite on a file descriptor, no stream buffer and no shared file position
+class PosixFile : public File {
+public:
+    explicit PosixFile(int fd) : fd(fd) {}
+
+    ~PosixFile() override {
+        ::close(fd);
+    }
+
+    void read(void* buffer, size_t offset, size_t bytes) override {
+        char* dst = static_cast<char*>(buffer);
+        while (bytes > 0) {
+            ssize_t n = pread(fd, dst, bytes, offset);
+            if (n <= 0) {
+                throw std::runtime_error("read failed at offset " + std::to_string(offset) + ": " + std::strerror(errno));
+            }
+            dst += n;
+            offset += n;
+            bytes -= n;
+        }
+    }
+
+    void write(const void* buffer, size_t offset, size_t bytes) override {
+        const char* src = static_cast<const char*>(buffer);
+        while (bytes > 0) {
+            ssize_t n = pwrite(fd, src, bytes, offset);
+            if (n <= 0) {
+                throw std::runtime_error("write failed at offset " + std::to_string(offset) + ": " + std::strerror(errno));
+            }
+            src += n;
+            offset += n;
+            bytes -= n;
+        }
+    }
+
+    size_t size() override {
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            throw std::runtime_error(std::string("fstat failed: ") + std::strerror(errno));
+        }
+        return info.st_size;
+    }
+
+protected:
+    int fd;
+};
+
+/**
+ * memory mapped file: reads are served from one read only mapping of the whole file,
+ * which lets the merge readers work on the mapped pages without a copy
+ * writes grow the file and copy into a temporary mapping of the written range
+ * madvise tells the kernel to read ahead, to prefetch the next block and to drop consumed blocks
+ */
+class MmapFile : public PosixFile {
+public:
+    // a file with contents is mapped right away, so the threads of a parallel merge share one mapping
+    explicit MmapFile(int fd) : PosixFile(fd), file_size(PosixFile::size()) {
+        if (file_size > 0) {
+            map();
+        }
+    }
+
+    ~MmapFile() override {
+        unmap();
+    }
+
+    void read(void* buffer, size_t offset, size_t bytes) override {
+        if (bytes == 0) return;
+        std::memcpy(buffer, view(offset, bytes), bytes);
+    }
+
+    void write(const void* buffer, size_t offset, size_t bytes) override {
+        if (bytes == 0) return;
+        {
+            // the parts of a parallel merge write to one file from several threads, only the largest end may grow it
+            std::lock_guard<std::mutex> lock(mapping_mutex);
+            if (offset + bytes > file_size) {
+                unmap();
+                if (ftruncate(fd, offset + bytes) != 0) {
+                    throw std::runtime_error(std::string("growing mapped file failed: ") + std::strerror(errno));
+                }
+                file_size = offset + bytes;
+            }
+        }
+        size_t page_offset = offset & ~(page_size() - 1);
+        size_t map_bytes = offset + bytes - page_offset;
+        void* region = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, page_offset);
+        if (region == MAP_FAILED) {
+            throw std::runtime_error(std::string("mapping for write failed: ") + std::strerror(errno));
+        }
+        std::memcpy(static_cast<char*>(region) + (offset - page_offset), buffer, bytes);
+        munmap(region, map_bytes);
+    }
+
+    size_t size() override {
+        return file_size;
+    }
+
+    const void* view(size_t offset, size_t bytes) override {
+        if (offset + bytes > file_size) {
+            throw std::runtime_error("read past the end of a mapped file at offset " + std::to_string(offset));
+        }
+        // a file that was written is mapped again once it is read, by whichever thread comes first
+        std::lock_guard<std::mutex> lock(mapping_mutex);
+        if (mapping == nullptr && file_size > 0) {
+            map();
+        }
+        return mapping + offset;
+    }
+
+    void will_need(size_t offset, size_t bytes) override {
+        advise(offset, bytes, MADV_WILLNEED);
+    }
+
+    void done(size_t offset, size_t bytes) override {
+        advise(offset, bytes, MADV_DONTNEED);
+    }
+
+private:
+    // guards growing, unmapping and mapping the file
+    std::mutex mapping_mutex;
+    size_t file_size;
+    char* mapping = nullptr;
+    size_t mapping_size = 0;
+
+    static size_t page_size() {
+        static const size_t size = sysconf(_SC_PAGESIZE);
+        return size;
+    }
+
+    void map() {
+        void* region = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (region == MAP_FAILED) {
+            throw std::runtime_error(std::string("mapping for read failed: ") + std::strerror(errno));
+        }
+        mapping_size = file_size;
+        madvise(region, mapping_size, MADV_SEQUENTIAL);
+        mapping = static_cast<char*>(region);
+    }
+
+    void unmap() {
+        if (mapping != nullptr) {
+            munmap(mapping, mapping_size);
+            mapping = nullptr;
+        }
+    }
+
+    // only whole pages inside the range are advised, so neighbouring blocks are not affected
+    void advise(size_t offset, size_t bytes, int advice) {
+        if (mapping == nullptr) return;
+        size_t begin = (offset + page_size() - 1) & ~(page_size() - 1);
+        size_t end = std::min(offset + bytes, mapping_size) & ~(page_size() - 1);
+        if (begin < end) {
+            madvise(mapping + begin, end - begin, advice);
+        }
+    }
+};
+
+/**
+ * O_DIRECT file: transfers bypass the page cache, so the sort's own buffers are all the memory it uses
+ * page aligned requests on aligned buffers go straight to the device, anything else goes through a
+ * bounce buffer of whole pages, partially covered pages are read, patched and written back
+ * a write that ends inside a page pads it, close (or else the destructor) cuts the file back to its real size
+ */
+class DirectFile : public PosixFile {
+public:
+    explicit DirectFile(int fd) : PosixFile(fd), file_size(PosixFile::size()) {}
+
+    ~DirectFile() override {
+        if (padded && ftruncate(fd, file_size) != 0) {
+            std::cerr << "Error: (direct file) truncating the padded tail failed: " << std::strerror(errno) << std::endl;
+        }
+    }
+
+    void read(void* buffer, size_t offset, size_t bytes) override {
+        // the last page on disk is padded until the file is closed, the padding is not part of the file
+        if (offset + bytes > size()) {
+            throw std::runtime_error("read past the end of a direct file at offset " + std::to_string(offset));
+        }
+        if (aligned(buffer, offset, bytes)) {
+            PosixFile::read(buffer, offset, bytes);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        char* dst = static_cast<char*>(buffer);
+        size_t end = offset + bytes;
+        for (size_t chunk = round_down(offset); chunk < end; chunk += bounce_bytes) {
+            size_t chunk_end = std::min(chunk + bounce_bytes, round_up(end));
+            size_t copy_begin = std::max(chunk, offset);
+            size_t copy_end = std::min(chunk_end, end);
+            if (chunk + read_some(bounce_buffer(), chunk, chunk_end - chunk) < copy_end) {
+                throw std::runtime_error("read past the end of a direct file at offset " + std::to_string(copy_begin));
+            }
+            std::memcpy(dst + (copy_begin - offset), bounce.data() + (copy_begin - chunk), copy_end - copy_begin);
+        }
+    }
+
+    void write(const void* buffer, size_t offset, size_t bytes) override {
+        if (bytes == 0) return;
+        size_t end = offset + bytes;
+        if (aligned(buffer, offset, bytes)) {
+            PosixFile::write(buffer, offset, bytes);
+            std::lock_guard<std::mutex> lock(mutex);
+            file_size = std::max(file_size, end);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        const char* src = static_cast<const char*>(buffer);
+        char* page = bounce_buffer();
+        for (size_t chunk = round_down(offset); chunk < end; chunk += bounce_bytes) {
+            size_t chunk_end = std::min(chunk + bounce_bytes, round_up(end));
+            size_t copy_begin = std::max(chunk, offset);
+            size_t copy_end = std::min(chunk_end, end);
+            if (copy_begin > chunk) {
+                read_page(page, chunk);
+            }
+            if (copy_end < chunk_end) {
+                read_page(page + (chunk_end - chunk - io_alignment), chunk_end - io_alignment);
+            }
+            std::memcpy(page + (copy_begin - chunk), src + (copy_begin - offset), copy_end - copy_begin);
+            PosixFile::write(page, chunk, chunk_end - chunk);
+        }
+        padded = padded || end % io_alignment != 0;
+        file_size = std::max(file_size, end);
+    }
+
+    size_t size() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        return file_size;
+    }
+
+    // cut the padding off the last page, so the size on disk is the real one while the file is still open
+    void close() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (padded && ftruncate(fd, file_size) != 0) {
+            throw std::runtime_error(std::string("truncating the padded tail of a direct file failed: ") + std::strerror(errno));
+        }
+        padded = false;
+    }
+
+private:
+    static constexpr size_t bounce_bytes = 16 * io_alignment;
+
+    std::mutex mutex;
+    size_t file_size;
+    bool padded = false;
+    Buffer<char> bounce;
+
+    static bool aligned(const void* buffer, size_t offset, size_t bytes) {
+        return (reinterpret_cast<uintptr_t>(buffer) | offset | bytes) % io_alignment == 0;
+    }
+
+    static size_t round_down(size_t offset) {
+        return offset / io_alignment * io_alignment;
+    }
+
+    static size_t round_up(size_t offset) {
+        return round_down(offset + io_alignment - 1);
+    }
+
+    char* bounce_buffer() {
+        if (bounce.empty()) {
+            bounce.resize(bounce_bytes);
+        }
+        return bounce.data();
+    }
+
+    // read up to bytes, stops early at the end of the file, returns the bytes read
+    size_t read_some(char* dst, size_t offset, size_t bytes) {
+        size_t total = 0;
+        while (total < bytes) {
+            ssize_t n = pread(fd, dst + total, bytes - total, offset + total);
+            if (n < 0) {
+                throw std::runtime_error("read failed at offset " + std::to_string(offset + total) + ": " + std::strerror(errno));
+            }
+            if (n == 0) break;
+            total += n;
+        }
+        return total;
+    }
+
+    // the current contents of the page at offset, zeros past the end of the file
+    void read_page(char* dst, size_t offset) {
+        size_t got = read_some(dst, offset, io_alignment);
+        std::memset(dst + got, 0, io_alignment - got);
+    }
+};
+
+// size of an input that is only known once it was read to the end
+constexpr size_t unknown_size = SIZE_MAX;
+
+/**
+ * stdin or stdout, so the sort can sit in a shell pipeline
+ * the offsets have to follow each other, the read and write pipelines access the input and
+ * the output in order; size is the number of bytes that went through so far
+ * the file descriptor belongs to the process and stays open
+ */
+class PipeFile : public File {
+public:
+    explicit PipeFile(int fd) : fd(fd) {}
+
+    void read(void* buffer, size_t offset, size_t bytes) override {
+        if (read_up_to(buffer, offset, bytes) < bytes) {
+            throw std::runtime_error("pipe ended at offset " + std::to_string(position));
+        }
+    }
+
+    size_t read_up_to(void* buffer, size_t offset, size_t bytes) override {
+        check_position(offset);
+        char* dst = static_cast<char*>(buffer);
+        size_t total = 0;
+        while (total < bytes) {
+            ssize_t n = ::read(fd, dst + total, bytes - total);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                throw std::runtime_error("read failed at offset " + std::to_string(position) + ": " + std::strerror(errno));
+            }
+            if (n == 0) break;
+            total += n;
+            position += n;
+        }
+        return total;
+    }
+
+    void write(const void* buffer, size_t offset, size_t bytes) override {
+        check_position(offset);
+        const char* src = static_cast<const char*>(buffer);
+        while (bytes > 0) {
+            ssize_t n = ::write(fd, src, bytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                throw std::runtime_error("write failed at offset " + std::to_string(position) + ": " + std::strerror(errno));
+            }
+            src += n;
+            position += n;
+            bytes -= n;
+        }
+    }
+
+    size_t size() override {
+        return position;
+    }
+
+    bool seekable() const override {
+        return false;
+    }
+
+private:
+    int fd;
+    size_t position = 0;
+
+    void check_position(size_t offset) const {
+        if (offset != position) {
+            throw std::runtime_error("pipe accessed at offset " + std::to_string(offset) + " instead of " + std::to_string(position));
+        }
+    }
+};
+
+// the file name - stands for stdin when read and for stdout when written
+inline bool is_pipe_name(const std::string& filename) {
+    return filename == "-";
+}
+
+// clear opens the file for writing and truncates it, otherwise it is opened read only
+inline std::unique_ptr<File> open_with_backend(const std::string& filename, IoBackend backend, bool clear) {
+    if (is_pipe_name(filename)) {
+        return std::make_unique<PipeFile>(clear ? STDOUT_FILENO : STDIN_FILENO);
+    }
+    if (backend == IoBackend::stream) {
+        auto mode = clear ? std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc : std::ios::binary | std::ios::in;
+        std::fstream stream(filename, mode);
+        if (!stream.is_open()) return nullptr;
+        return std::make_unique<StreamFile>(std::move(stream));
+    }
+    int flags = clear ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY;
+    int fd = open(filename.c_str(), backend == IoBackend::direct ? flags | O_DIRECT : flags, 0644);
+    if (fd < 0) return nullptr;
+    if (backend == IoBackend::mmap) {
+        return std::make_unique<MmapFile>(fd);
+    }
+    if (backend == IoBackend::direct) {
+        return std::make_unique<DirectFile>(fd);
+    }
+    return std::make_unique<PosixFile>(fd);
+}
+
+// nullptr if the file can not be opened
+inline std::unique_ptr<File> file_open_and_clear(std::string filename, IoBackend backend) {
+    return open_with_backend(filename, backend, true);
+}
+
+inline std::unique_ptr<File> file_open(std::string filename, IoBackend backend) {
+    return open_with_backend(filename, backend, false);
+}
+
+// for the files the sort writes itself, throws if the file can not be created
+inline std::unique_ptr<File> file_create(const std::string& filename, IoBackend backend) {
+    std::unique_ptr<File> file = file_open_and_clear(filename, backend);
+    if (!file) {
+        throw std::runtime_error("unable to create file " + filename + ": " + std::strerror(errno));
+    }
+    return file;
+}
+
+template <typename Record, typename Allocator>
+void read_data(File& file, std::vector<Record, Allocator>& nums, size_t start_element_file, size_t start_element_buffer, size_t read_elements) {
+    file.read(nums.data() + start_element_buffer, start_element_file * sizeof(Record), read_elements * sizeof(Record));
+    if (!file.counts_io()) {
+        io_counters.bytes_read += read_elements * sizeof(Record);
+    }
+}
+
+// records in bytes of a file, throws if it ends inside a record, whose tail would be lost without a word
+template <typename Record>
+size_t whole_records(size_t bytes, const std::string& name) {
+    if (bytes % sizeof(Record) != 0) {
+        throw std::runtime_error(name + " of " + std::to_string(bytes) + " bytes ends inside a record of " + std::to_string(sizeof(Record)) + " bytes");
+    }
+    return bytes / sizeof(Record);
+}
+
+// read_data that stops at the end of a pipe, returns the records read
+template <typename Record, typename Allocator>
+size_t read_data_up_to(File& file, std::vector<Record, Allocator>& nums, size_t start_element_file, size_t start_element_buffer, size_t read_elements) {
+    size_t bytes = file.read_up_to(nums.data() + start_element_buffer, start_element_file * sizeof(Record), read_elements * sizeof(Record));
+    if (!file.counts_io()) {
+        io_counters.bytes_read += bytes;
+    }
+    if (bytes % sizeof(Record) != 0) {
+        throw std::runtime_error("input ends inside a record of " + std::to_string(sizeof(Record)) + " bytes");
+    }
+    return bytes / sizeof(Record);
+}
+
+template <typename Record>
+void write_data(File& file, const Record* nums, size_t start_element_file, size_t write_elements) {
+    file.write(nums, start_element_file * sizeof(Record), write_elements * sizeof(Record));
+    if (!file.counts_io()) {
+        io_counters.bytes_written += write_elements * sizeof(Record);
+    }
+}
+
+// background thread that executes I/O requests in submission order
+
+class IoThread {
+public:
+    IoThread() : worker([this] { run(); }) {}
+
+    ~IoThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+    std::future<void> submit(std::function<void()> request) {
+        std::packaged_task<void()> task([this, request = std::move(request)] {
+            auto start = StatsClock::now();
+            request();
+            busy_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(StatsClock::now() - start).count();
+        });
+        std::future<void> done = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        cv.notify_one();
+        return done;
+    }
+
+    // time the worker spent executing requests, complete for every request whose future is ready
+    double busy_seconds() const {
+        return busy_nanoseconds * 1e-9;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::packaged_task<void()>> tasks;
+    bool stopping = false;
+    std::atomic<uint64_t> busy_nanoseconds{0};
+    std::thread worker;
+
+    void run() {
+        while (true) {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+// snapshot of the counters at the start of a phase, finish stores what happened since
+class PhaseMeasurement {
+public:
+    PhaseMeasurement(std::vector<const IoThread*> readers, std::vector<const IoThread*> writers)
+        : readers(std::move(readers)), writers(std::move(writers)), start(StatsClock::now()),
+          bytes_read(io_counters.bytes_read), bytes_written(io_counters.bytes_written),
+          read_busy(busy_seconds(this->readers)), write_busy(busy_seconds(this->writers)) {}
+
+    void finish(PhaseStats& phase) const {
+        phase.seconds = seconds_since(start);
+        phase.bytes_read = io_counters.bytes_read - bytes_read;
+        phase.bytes_written = io_counters.bytes_written - bytes_written;
+        phase.read_seconds = busy_seconds(readers) - read_busy;
+        phase.write_seconds = busy_seconds(writers) - write_busy;
+    }
+
+private:
+    std::vector<const IoThread*> readers;
+    std::vector<const IoThread*> writers;
+    StatsClock::time_point start;
+    size_t bytes_read;
+    size_t bytes_written;
+    double read_busy;
+    double write_busy;
+
+    static double busy_seconds(const std::vector<const IoThread*>& threads) {
+        double seconds = 0;
+        for (const IoThread* thread : threads) {
+            seconds += thread->busy_seconds();
+        }
+        return seconds;
+    }
+};
+
+/**
+ * input buffers of one run during a merge (or of the whole input during run formation)
+ * the consumer works on data while the next block of the run is read into prefetch in the background
+ * if the file can be viewed without a copy (mmap), data points into the file and the buffers stay empty
+ */
+template <typename Record>
+struct MergeSource {
+    Buffer<Record> block;
+    Buffer<Record> prefetch;
+    const Record* data = nullptr;
+    std::future<void> pending;
+    const Record* pending_view = nullptr;
+    bool has_pending = false;
+    size_t pending_start = 0;
+    size_t pending_elements = 0;
+    size_t block_elements = 0;
+    size_t position = 0;
+    size_t filled = 0;
+    size_t data_start = 0;
+    size_t next_element_file = 0;
+    size_t end_element_file = 0;
+    double stall_seconds = 0;
+
+    // queue the read of the next block of the run
+    void request(IoThread& reader, File& input) {
+        if (next_element_file >= end_element_file) {
+            return;
+        }
+        pending_start = next_element_file;
+        pending_elements = std::min(block_elements, end_element_file - next_element_file);
+        // the read may shorten pending_elements at the end of a pipe, refill compares against this
+        next_element_file += pending_elements;
+        has_pending = true;
+        size_t offset = pending_start * sizeof(Record);
+        size_t bytes = pending_elements * sizeof(Record);
+        pending_view = static_cast<const Record*>(input.view(offset, bytes));
+        if (pending_view != nullptr) {
+            input.will_need(offset, bytes);
+            if (!input.counts_io()) {
+                io_counters.bytes_read += bytes;
+            }
+        } else {
+            if (prefetch.size() < block_elements) {
+                prefetch.resize(block_elements);
+            }
+            pending = reader.submit([this, &input] {
+                pending_elements = read_data_up_to(input, prefetch, pending_start, 0, pending_elements);
+            });
+        }
+    }
+
+    // switch to the prefetched block and request the one after, false if the run is consumed
+    bool refill(IoThread& reader, File& input) {
+        if (data != nullptr) {
+            input.done(data_start * sizeof(Record), filled * sizeof(Record));
+        }
+        if (!has_pending) {
+            data = nullptr;
+            return false;
+        }
+        if (pending_view != nullptr) {
+            data = pending_view;
+        } else {
+            wait_io(pending, stall_seconds);
+            std::swap(block, prefetch);
+            data = block.data();
+        }
+        has_pending = false;
+        // a pipe ended before the block was full, there is nothing after it
+        if (next_element_file != pending_start + pending_elements) {
+            end_element_file = next_element_file = pending_start + pending_elements;
+            if (pending_elements == 0) {
+                data = nullptr;
+                return false;
+            }
+        }
+        data_start = pending_start;
+        filled = pending_elements;
+        position = 0;
+        request(reader, input);
+        return true;
+    }
+
+    // the rest of the run is not needed, a read that is still queued uses the buffer and the file, so it is waited for
+    void abandon() {
+        if (has_pending && pending_view == nullptr) {
+            wait_io(pending, stall_seconds);
+        }
+        has_pending = false;
+        data = nullptr;
+    }
+};
+
+// double buffered output, a full buffer is written in the background while the other one is filled
+template <typename Record>
+class BlockWriter {
+public:
+    BlockWriter(Buffer<Record>& buffer, Buffer<Record>& in_flight, IoThread& writer)
+        : buffer(buffer), in_flight(in_flight), writer(writer) {}
+
+    ~BlockWriter() {
+        finish();
+    }
+
+    // the following elements are written to file from element start_element_file on
+    void start(File& file, size_t start_element_file = 0) {
+        output = &file;
+        offset = start_element_file;
+        k = 0;
+    }
+
+    void push(const Record& value) {
+        buffer[k++] = value;
+        if (k == buffer.size()) {
+            flush();
+        }
+    }
+
+    // free space of the buffer, a merge kernel writes up to available() elements there and commits them
+    Record* space() {
+        return buffer.data() + k;
+    }
+
+    size_t available() const {
+        return buffer.size() - k;
+    }
+
+    void commit(size_t elements) {
+        k += elements;
+        if (k == buffer.size()) {
+            flush();
+        }
+    }
+
+    // write the buffered elements and wait until everything reached the file
+    void finish() {
+        flush();
+        if (pending.valid()) {
+            wait_io(pending, stall);
+        }
+    }
+
+    // time spent waiting for a buffer to be written
+    double stall_seconds() const {
+        return stall;
+    }
+
+private:
+    Buffer<Record>& buffer;
+    Buffer<Record>& in_flight;
+    IoThread& writer;
+    File* output = nullptr;
+    size_t offset = 0;
+    std::future<void> pending;
+    size_t k = 0;
+    double stall = 0;
+
+    void flush() {
+        if (k == 0) return;
+        if (pending.valid()) {
+            wait_io(pending, stall);
+        }
+        std::swap(buffer, in_flight);
+        size_t write_elements = k;
+        size_t write_start = offset;
+        File* file = output;
+        pending = writer.submit([this, file, write_start, write_elements] {
+            write_data(*file, in_flight.data(), write_start, write_elements);
+        });
+        offset += k;
+        k = 0;
+    }
+};
+
+// read up to elements block by block, returns how many there were before the input ended
+template <typename Record>
+size_t read_chunk(File& input, Buffer<Record>& nums, size_t start_element_file, size_t elements, size_t block_elements) {
+    size_t current = 0;
+    while (current < elements) {
+        size_t read_size = std::min(block_elements, elements - current);
+        size_t got = read_data_up_to(input, nums, start_element_file + current, current, read_size);
+        current += got;
+        if (got < read_size) break;
+    }
+    return current;
+}
+
+template <typename Record>
+void write_chunk(File& output, const Record* nums, size_t start_element_file, size_t elements, size_t block_elements) {
+    size_t current = 0;
+    while (current < elements) {
+        size_t write_size = std::min(block_elements, elements - current);
+        write_data(output, nums + current, start_element_file + current, write_size);
+        current += write_size;
+    }
+}
@@ -11,10 +11,20 @@
 #include <limits>
 #include <filesystem>
 #include <chrono>
+#include <cstring>
 #include <optional>
 
-using Number = int64_t;
-
+#include "command_line.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "planner.hpp"
+#include "record.hpp"
+#include "sort_config.hpp"
+#include "sort_kernels.hpp"
+#include "top_k.hpp"
+#include "verify.hpp"
+
+template <typename Record>
 size_t write_input_data(const std::string& filename, size_t file_size) {
 
     std::ofstream file(filename, std::ios::binary | std::ios::trunc);
@@ -24,17 +34,15 @@ size_t write_input_data(const std::string& filename, size_t file_size) {
     }
 
     std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<Number> dist(std::numeric_limits<Number>::min(), std::numeric_limits<Number>::max());
-    // std::uniform_int_distribution<Number> dist(-20, 20);
+    std::mt19937_64 gen(rd());
 
-    size_t n_elems = file_size / sizeof(Number);
-    std::vector<Number> nums(n_elems);
+    size_t n_elems = file_size / sizeof(Record);
+    std::vector<Record> nums(n_elems);
     for (size_t i = 0; i < n_elems; i++) {
-        nums[i] = dist(gen);
+        nums[i] = RecordTraits<Record>::random(gen);
     }
 
-    size_t current_size_byte = nums.size() * sizeof(Number);    
+    size_t current_size_byte = nums.size() * sizeof(Record);
     file.write(reinterpret_cast<char *>(nums.data()), current_size_byte);
 
     file.close();
@@ -42,466 +50,181 @@ size_t write_input_data(const std::string& filename, size_t file_size) {
     return n_elems;
 }
 
-void read_data(std::fstream& file, std::vector<Number>& nums, size_t start_element_file, size_t start_element_buffer, size_t read_elements) {
-    std::streampos start_pos = start_element_file * sizeof(Number);
-    size_t read_bytes = read_elements * sizeof(Number);
-
-    file.seekg(start_pos);
-    file.read(reinterpret_cast<char*>(nums.data() + start_element_buffer), read_bytes);
-    // file.seekg(0);
-}
+template <typename Record>
+void prepare(size_t filesize, std::string& in_filename, std::string& out_filename) {
 
-void copy_file(std::string src_name, std::string dst_name) {
-    std::ofstream file(dst_name, std::ios::binary | std::ios::trunc);
-    if (!file.is_open()) {
-        std::cerr << "Error: (copy file) Unable to open file " << dst_name << std::endl;
-        return;
-    }
-    try {
-        std::filesystem::copy(src_name, dst_name, std::filesystem::copy_options::overwrite_existing);
-        // std::cout << "File copied successfully." << std::endl;
-    } catch (const std::filesystem::filesystem_error& e) {
-        std::cerr << "File copy failed: " << e.what() << std::endl;
+    write_input_data<Record>(in_filename, filesize);
+    std::ofstream file_output(out_filename, std::ios::trunc);
+    if (!file_output.is_open()) {
+        std::cout << "file not opened: " << out_filename << std::endl;
     }
+    file_output.close();
 }
 
-std::fstream file_open_and_clear(std::string filename) {
-    std::fstream file_output(filename, std::ios::trunc | std::ios::binary | std::ios::in | std::ios::out);
-    return file_output;
-}
 
-std::fstream file_open(std::string filename) {
-    std::fstream file_input(filename, std::ios::binary | std::ios::in | std::ios::out);
-    return file_input;
-}
 
-
-void print_block(std::fstream& file, size_t start_element, size_t block_size_elems) {
-    std::vector<Number> block(block_size_elems);
-    read_data(file, block, start_element, 0, block_size_elems);
-    std::cout << "block starting at: " << start_element << " and ending at: " << start_element + block_size_elems << std::endl;
-    for (auto elem : block) {
-        std::cout << elem << ", ";
+// check the sorted file against the hash of the records that were sorted, one streaming pass over the output
+template <typename Record>
+void test(File& file_sorted, const MultisetHash& input_hash) {
+    VerifyResult check = verify_sorted<Record>(file_sorted, aligned_elements<Record>(16 * 1024 * 1024));
+    if (!check.sorted()) {
+        std::cout << "element at index: " << check.first_unsorted << " is smaller than the one before it" << std::endl;
     }
-    std::cout << std::endl;
-}
-
-void merge(std::vector<Number>& nums, size_t i_left, size_t i_mid, size_t i_right) {
-    size_t left_size = i_mid - i_left + 1;
-    size_t right_size = i_right - i_mid;
-
-    std::vector<Number> left(nums.begin() + i_left, nums.begin() + i_mid + 1);
-    std::vector<Number> right(nums.begin() + i_mid + 1, nums.begin() + i_right + 1);
-
-    size_t i = 0;
-    size_t j = 0;
-    size_t k = i_left;
-    while (i < left_size && j < right_size) {
-        if (left[i] <= right[j]) {
-            nums[k] = left[i];
-            i++;
-        }
-        else {
-            nums[k] = right[j];
-            j++;
-        }
-        k++;
-    } 
-
-    while (i < left_size) {
-        nums[k] = left[i];
-        i++;
-        k++;
+    if (!(check.hash == input_hash)) {
+        std::cout << "output has " << check.hash.count << " elements that are not the " << input_hash.count << " elements of the input" << std::endl;
     }
-
-    while (j < right_size) {
-        nums[k] = right[j];
-        j++;
-        k++;
+    if (check.sorted() && check.hash == input_hash) {
+        std::cout << "test passed" << std::endl;
+    } else {
+        std::cout << "test failed" << std::endl;
     }
 }
 
-void merge_sort(std::vector<Number>& nums, size_t i_left, size_t i_right) {
-    if (i_left >= i_right) return;
-
-    size_t i_mid = i_left + (i_right- i_left) / 2;
-    merge_sort(nums, i_left, i_mid);
-    merge_sort(nums, i_mid + 1, i_right);
-    merge(nums, i_left, i_mid, i_right);
-}
-
-void sort_internal(std::fstream& input, std::fstream& output, size_t internal_memory_size, size_t block_size, size_t& current_element_file, size_t max_element_file) {
-    size_t max_elems_main = internal_memory_size / sizeof(Number);
-    size_t max_elems_block = block_size / sizeof(Number);
-    std::vector<Number> nums(max_elems_main);
-    
-    size_t current_block = 0;
-    while (current_block < max_elems_main && current_element_file + max_elems_block < max_element_file) {
-        read_data(input, nums, current_element_file, current_block, max_elems_block);
-        current_element_file += max_elems_block;
-        current_block += max_elems_block;
-    }
-
-    if (current_element_file + max_elems_block >= max_element_file) {
-        size_t read_rest_size = max_element_file - current_element_file;
-        read_data(input, nums, current_element_file, current_block, read_rest_size);
-        current_element_file += read_rest_size;
-        current_block += read_rest_size;
-    }
-
-    // shrink the vector if its not filled
-    nums.resize(current_block);
-    
-    merge_sort(nums, 0, nums.size() - 1);
-    // std::sort(nums.begin(), nums.end());
-    
-    size_t current_elem = 0;
-    while (current_elem < max_elems_main) {
-        output.write(reinterpret_cast<char*>(nums.data() + current_elem), max_elems_block * sizeof(Number));
-        current_elem += max_elems_block;
+template <typename Record>
+void internal_mergesort_file(std::string& in_filename, std::string out_filename, size_t input_file_size, SimdLevel simd) {
+    auto in = file_open(in_filename, IoBackend::stream);
+    auto out = file_open_and_clear(out_filename, IoBackend::stream);
+    size_t file_elements = input_file_size / sizeof(Record);
+    std::vector<Record> nums(file_elements);
+    std::vector<Record> scratch(file_elements);
+
+    read_data(*in, nums, 0, 0, file_elements);
+    MultisetHash input_hash;
+    input_hash.add(nums.data(), nums.size());
+
+    MergeInt64 kernel = select_merge_int64(simd);
+    if constexpr (std::is_same_v<Record, int64_t>) {
+        std::cout << "merge kernel: " << merge_int64_name(kernel) << std::endl;
     }
-    size_t rest = max_elems_main - current_elem;
-    if (rest > 0) {
-        output.write(reinterpret_cast<char*>(nums.data() + current_elem), rest * sizeof(Number));
-        current_elem += rest;
-    }  
-}
+    auto start_time = std::chrono::high_resolution_clock::now();
+    merge_sort(nums.data(), scratch.data(), nums.size(), kernel);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+    if (duration < std::chrono::microseconds(1000)) {
+        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::microseconds>(duration).count() << " µs\n";
+    } else
+        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() << " ms\n";
 
-size_t partition(std::fstream& input, size_t file_size, std::fstream& output, size_t internal_memory_size, size_t block_size) {
-    size_t current_element_file = 0;
-    size_t max_element_file = file_size / sizeof(Number);
-    size_t partitions = 0;
-    while (current_element_file < max_element_file) {
-        sort_internal(input, output, internal_memory_size, block_size, current_element_file, max_element_file);
-        partitions++;
-    }
-    return partitions;
-}
+    write_data(*out, nums.data(), 0, file_elements);
 
-void debug_write(std::vector<Number> buffer, size_t start, size_t write_size_elements) {
-    std::cout << "writing: " << std::endl;
-    std::cout << "[";
-    for (size_t i = start; i < write_size_elements; i++) {
-        std::cout << buffer[i] << (i < write_size_elements - 1 ? ", " : "");
-    }
-    std::cout << "]" << std::endl;
+    test<Record>(*out, input_hash);
 }
 
 /**
- * input here is the output file of the partition phase
- * output file is empty
- * chunks are the two consecutive sorted intervals in the previous output
+ * block size and run generation for the memory, printed before the sort starts
+ * with plan_block the block size is chosen (see plan_sort), the run generation as well unless choose_run_generation
+ * is false because --runs was given; with calibrate (block size auto) the device of the run files is measured
+ * for it first, otherwise the plan is the largest block with the fewest passes
+ * an input file is opened and sized first, false if that fails or it is not a whole number of records,
+ * then its order is sampled for the length of the runs (see evaluate_plan)
  */
-void external_merge_chunks(std::fstream& input, std::fstream& output, size_t internal_memory_size, size_t block_size, size_t iteration, size_t chunk_1_start, size_t chunk_2_start, size_t chunk_elements) {
-    // at iteration 0 the sorted chunks in the file have the size internal_memory_size
-    // the chunk size doubles with each iteration
-    
-    // chunk_1 and chunk_2 point to the current position in the input file
-    size_t chunk_1 = chunk_1_start;
-    size_t chunk_2 = chunk_2_start;
-    size_t block_elements = block_size / sizeof(Number);
-
-    std::vector<Number> block_1(block_elements);
-    std::vector<Number> block_2(block_elements);
-    std::vector<Number> output_buffer(block_elements);
-
-    read_data(input, block_1, chunk_1, 0, block_elements);
-    chunk_1 += block_elements;
-    read_data(input, block_2, chunk_2, 0, block_elements);
-    chunk_2 += block_elements;
-
-    size_t i = 0, j = 0, k = 0;
-    size_t elements_written = 0;
-    while (elements_written < chunk_elements * 2) {
-        while (i < block_elements && j < block_elements && k < block_elements) {
-            if (block_1[i] <= block_2[j]) {
-                output_buffer[k] = block_1[i];
-                i++;
-            }
-            else {
-                output_buffer[k] = block_2[j];
-                j++;
-            }
-            k++;
+template <typename Record>
+bool plan_sort_external(const std::string& in_filename, const std::string& out_filename, size_t input_file_size, size_t internal_memory_size, size_t& block_size, SortOptions& options, bool plan_block, bool calibrate, bool choose_run_generation) {
+    double ascending_pairs = 0;
+    if (!is_pipe_name(in_filename)) {
+        std::unique_ptr<File> input = file_open(in_filename, IoBackend::pread);
+        if (!input) {
+            std::cerr << "Error: (plan) Unable to open file " << in_filename << std::endl;
+            return false;
         }
-
-        // get a new block from file if i or j = block elements 
-        // write output buffer to file if k = block elements
-        if (i == block_elements) { 
-            // dont read beginning of next chunk
-            // cant get new block from chunk1 -> write all from chunk2
-            if (chunk_1 < chunk_2_start) {
-                read_data(input, block_1, chunk_1, 0, block_elements);
-                chunk_1 += block_elements;
-                i = 0;
-            } else {
-                std::fill(block_1.begin(), block_1.end(), std::numeric_limits<Number>::max());
-                i = 0;
-            }
-        }
-        else if (j == block_elements) {
-            if (chunk_2 < chunk_2_start + chunk_elements) {
-                read_data(input, block_2, chunk_2, 0, block_elements);
-                chunk_2 += block_elements;
-                j = 0;
-            } else {
-                std::fill(block_2.begin(), block_2.end(), std::numeric_limits<Number>::max());
-                j = 0;
-            }
+        size_t file_size = input->size();
+        if (file_size % sizeof(Record) != 0) {
+            std::cerr << "Error: (plan) " << in_filename << " has " << file_size << " bytes, which is not a whole number of "
+                      << sizeof(Record) << " byte " << RecordTraits<Record>::name << " records" << std::endl;
+            return false;
         }
-        else {
-            output.write(reinterpret_cast<char*>(output_buffer.data()), block_elements * sizeof(Number));
-            // debug_write(output_buffer, 0, block_elements);
-            elements_written += block_elements;
-            k = 0;
+        input_file_size = std::min(input_file_size, file_size) / sizeof(Record) * sizeof(Record);
+        try {
+            ascending_pairs = sample_ascending_pairs<Record>(*input, input_file_size);
+        } catch (const std::exception& e) {
+            std::cout << "the input could not be sampled (" << e.what() << "), it is planned as if it was reversed" << std::endl;
         }
-    }  
-    if (k > 0) {
-        output.write(reinterpret_cast<char*>(output_buffer.data()), k * sizeof(Number));
     }
-    
-}
-
-// merge chunks of possibly non equal size
-void external_merge_chunks_neq(std::fstream& input, std::fstream& output, size_t internal_memory_size, size_t block_size,  size_t chunk_1_start, size_t chunk_1_size, size_t chunk_2_start, size_t chunk_2_size) {
-    size_t chunk_1 = chunk_1_start;
-    size_t chunk_2 = chunk_2_start;
-    size_t block_elements = block_size / sizeof(Number);
-
-    std::vector<Number> block_1(block_elements);
-    std::vector<Number> block_2(block_elements);
-    std::vector<Number> output_buffer(block_elements);
-
-    read_data(input, block_1, chunk_1, 0, block_elements);
-    chunk_1 += block_elements;
-    read_data(input, block_2, chunk_2, 0, block_elements);
-    chunk_2 += block_elements;
-
-    size_t i = 0, j = 0, k = 0;
-    size_t elements_written = 0;
-    while (elements_written < chunk_1_size + chunk_2_size) {
-        while (i < block_elements && j < block_elements && k < block_elements) {
-            if (block_1[i] <= block_2[j]) {
-                output_buffer[k] = block_1[i];
-                i++;
-            }
-            else {
-                output_buffer[k] = block_2[j];
-                j++;
-            }
-            k++;
+    if (selects_in_memory<Record>(internal_memory_size, options)) {
+        std::cout << "plan: the first " << options.limit << " records fit into memory, they are selected with a heap in one pass over the input" << std::endl;
+        return true;
+    }
+    if (!plan_block) {
+        if (block_size > max_block_size(internal_memory_size)) {
+            block_size = max_block_size(internal_memory_size);
+            std::cout << "the block size is more than a sixth of the memory, a merge would not fit, it is lowered to "
+                      << block_size / 1024 << " KB" << std::endl;
         }
+        print_plan(std::cout, evaluate_plan<Record>(input_file_size, internal_memory_size, block_size, options.run_generation, DeviceProfile(), options, ascending_pairs));
+        return true;
+    }
 
-        // get a new block from file if i or j = block elements 
-        // write output buffer to file if k = block elements
-        if (i == block_elements) { 
-            // dont read beginning of next chunk
-            // cant get new block from chunk1 -> write all from chunk2
-            if (chunk_1 < chunk_1_start + chunk_1_size) {
-                read_data(input, block_1, chunk_1, 0, block_elements);
-                chunk_1 += block_elements;
-                i = 0;
-            } else {
-                std::fill(block_1.begin(), block_1.end(), std::numeric_limits<Number>::max());
-                i = 0;
-            }
+    // an input that is sorted in memory does not need the device numbers
+    DeviceProfile device;
+    SortPlan plan = plan_sort<Record>(input_file_size, internal_memory_size, device, options, choose_run_generation, ascending_pairs);
+    if (calibrate && plan.merge_passes > 0) {
+        // the first drive stands for all of them
+        std::filesystem::path directory = scratch_directories(options, std::filesystem::absolute(is_pipe_name(out_filename) ? "." : out_filename).parent_path()).front();
+        try {
+            device = calibrate_device(directory, options.io_backend);
+            plan = plan_sort<Record>(input_file_size, internal_memory_size, device, options, choose_run_generation, ascending_pairs);
+        } catch (const std::exception& e) {
+            std::cout << "device calibration failed (" << e.what() << "), planning without it" << std::endl;
         }
-        else if (j == block_elements) {
-            if (chunk_2 < chunk_2_start + chunk_2_size) {
-                read_data(input, block_2, chunk_2, 0, block_elements);
-                chunk_2 += block_elements;
-                j = 0;
-            } else {
-                std::fill(block_2.begin(), block_2.end(), std::numeric_limits<Number>::max());
-                j = 0;
-            }
-        }
-        else {
-            output.write(reinterpret_cast<char*>(output_buffer.data()), block_elements * sizeof(Number));
-            // debug_write(output_buffer, 0, block_elements);
-            elements_written += block_elements;
-            k = 0;
-        }
-    }  
-    if (k > 0) {
-        output.write(reinterpret_cast<char*>(output_buffer.data()), k * sizeof(Number));
     }
-
+    block_size = plan.block_size;
+    options.run_generation = plan.run_generation;
+    print_plan(std::cout, plan);
+    return true;
 }
 
-// merge all chunks in a file
-void external_merge_file(std::fstream& input, std::fstream& output, size_t internal_memory_size, size_t block_size, size_t iteration, size_t& file_size_elements) {
-
-    size_t chunk_elments = static_cast<size_t>(internal_memory_size / sizeof(Number) * pow(2, iteration)); // chunk size doubles at each iteration
-    size_t chunk_1_start = 0;
-    size_t chunk_2_start = chunk_1_start + chunk_elments;
-
-    while (chunk_2_start + chunk_elments <= file_size_elements) {
-        external_merge_chunks(input, output, internal_memory_size, block_size, iteration, chunk_1_start, chunk_2_start, chunk_elments); 
-        chunk_1_start = chunk_2_start + chunk_elments;
-        chunk_2_start = chunk_1_start + chunk_elments;
-    }
-
-    // odd number of chunks: keep last chunk till end and merge then
-    // decrease file_size elements for subsequent iterations
-    // check if difference to original in calling code
-    // have to write last chunk from input to output every time
-    if ((file_size_elements / chunk_elments) % 2 != 0) {
-        file_size_elements = file_size_elements - chunk_elments;
+template <typename Record>
+int run_sort_external(std::string& in_filename, std::string& out_filename, size_t input_file_size, size_t internal_memory_size, size_t block_size, SortOptions options, bool plan_block, bool calibrate, bool choose_run_generation, bool stats_json) {
+    if (options.sort_algorithm == SortAlgorithm::radix && RecordTraits<Record>::radix_bits == 0) {
+        std::cout << "records of type " << RecordTraits<Record>::name << " have no integer key, runs are merge sorted" << std::endl;
+    } else if (options.sort_algorithm == SortAlgorithm::radix && options.order == SortOrder::descending) {
+        std::cout << "the descending order has no radix key, runs are merge sorted" << std::endl;
     }
-}
-
-void copy_chunk(std::fstream& in, std::fstream& out, size_t start_elem, size_t end_elem, size_t block_size_elems) {
-    size_t i = start_elem;
-    while (i < end_elem) {
-        std::vector<Number> buffer(block_size_elems);
-        read_data(in, buffer, i, 0, block_size_elems);
-        // out.seekp(i * sizeof(Number) );
-        out.write(reinterpret_cast<char*>(buffer.data()), block_size_elems * sizeof(Number));
-        // out.seekp(0);
-        i += block_size_elems;
+    if (options.strategy == SortStrategy::distribution && is_pipe_name(in_filename)) {
+        std::cout << "a pipe can not be sampled for a distribution sort, its runs are merged" << std::endl;
     }
-}
 
-/**
- * TODO: if initial partitions are odd, keep last chunk until end and merge it then
- */
-std::fstream external_merge(std::string& filename_partitioned_input, std::string& filename_empty_output, size_t internal_memory_size, size_t block_size, size_t file_size_elements, size_t initial_partitions) {
-
-    size_t max_iterations = static_cast<size_t>(floor(log2(initial_partitions)));
-    size_t iteration = 0;
-
-    size_t file_size_elements_orig = file_size_elements;
-    std::fstream current_in = file_open(filename_partitioned_input);
-    std::string current_in_name = filename_partitioned_input;
-    std::fstream current_out = file_open_and_clear(filename_empty_output);
-    std::string current_out_name = filename_empty_output;
-    while (iteration < max_iterations) {
-        external_merge_file(current_in, current_out, internal_memory_size, block_size, iteration, file_size_elements);
-        // std::cout << "outfile after iteration: " << iteration << std::endl;
-        
-        if (file_size_elements_orig != file_size_elements) { 
-            // write last chunk to current out
-            // std::cout << "COPY CHUNK" << std::endl;
-            copy_chunk(current_in, current_out, file_size_elements, file_size_elements_orig, block_size / sizeof(Number));
-        }
-        // std::cout << "current in: " << std::endl;
-        // print_block(current_in, 0, file_size_elements_orig);
-        // std::cout << "current out: " << std::endl;
-        // print_block(current_out, 0, file_size_elements_orig);
-        current_in.close();
-        current_out.close();
-        current_in_name.swap(current_out_name);
-        current_in = file_open(current_in_name);
-        current_out = file_open_and_clear(current_out_name);
-        iteration++;
+    if constexpr (std::is_same_v<Record, int64_t>) {
+        MergeInt64 kernel = options.order == SortOrder::ascending ? select_merge_int64(options.simd) : nullptr;
+        std::cout << "merge kernel: " << merge_int64_name(kernel) << std::endl;
     }
-    // merge remaining chunk
-    if (file_size_elements_orig != file_size_elements) {
-        external_merge_chunks_neq(current_in, current_out, internal_memory_size, block_size, 0, file_size_elements, file_size_elements, file_size_elements_orig - file_size_elements);
-        current_in.close();
-        return current_out;
-    } else {
-        current_out.close();
-        return current_in;
-    }   
-}
 
-void prepare(size_t filesize, std::string& in_filename, std::string& out_filename) {
-    
-    size_t n_elements = write_input_data(in_filename, filesize);    
-    std::ofstream file_output(out_filename, std::ios::trunc);
-    if (!file_output.is_open()) {
-        std::cout << "file not opened: " << out_filename << std::endl;
+    if (!plan_sort_external<Record>(in_filename, out_filename, input_file_size, internal_memory_size, block_size, options, plan_block, calibrate, choose_run_generation)) {
+        std::cout << "sorting failed" << std::endl;
+        return 1;
     }
-    file_output.close();
-}
-
 
+    auto start_time = std::chrono::high_resolution_clock::now();
 
-void test(std::fstream& file_unsorted, std::fstream& file_sorted, size_t file_element_size) {
-    std::vector<Number> unsorted_nums(file_element_size);
-    read_data(file_unsorted, unsorted_nums, 0, 0, file_element_size);
-    std::sort(unsorted_nums.begin(), unsorted_nums.end());
+    SortStats stats;
+    auto result = sort_file_external<Record>(in_filename, out_filename, input_file_size, internal_memory_size, block_size, options, stats);
 
-    std::vector<Number> test_output(file_element_size);
-    read_data(file_sorted, test_output, 0, 0, file_element_size);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+    if (duration < std::chrono::microseconds(1000)) {
+        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::microseconds>(duration).count() << " µs\n";
+    } else
+        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() << " ms\n";
 
-    bool found_unequal = false;
-    for (size_t i = 0; i < unsorted_nums.size(); i++) {
-        auto a = unsorted_nums[i];
-        auto b = test_output[i];
-        if (a != b) {
-            found_unequal = true;
-            std::cout << "elements at index: " << i << " not equal. correct element: " << a << " incorrect element: " << b << std::endl;
-        }
+    if (!result) {
+        std::cout << "sorting failed" << std::endl;
+        return 1;
     }
-    if (!found_unequal) {
-        std::cout << "test passed" << std::endl;
+    if (stats_json) {
+        print_stats_json(std::cout, stats);
     } else {
-        std::cout << "test failed" << std::endl;
+        print_stats(std::cout, stats);
     }
-}
 
-std::optional<std::fstream> sort_file_external(std::string& in_filename, std::string& out_filename, size_t input_file_size, size_t internal_memory_size, size_t block_size) {
-    
-    std::fstream file_input = file_open(in_filename);
-    if (!file_input.is_open()) {
-        std::cerr << "Error: (sort external input) Unable to open file " << in_filename << std::endl;
-        return std::nullopt;
-    }
-    
-    std::fstream file_output = file_open_and_clear(out_filename);
-    if (!file_output.is_open()) {
-        std::cerr << "Error: (sort external output) Unable to open file " << out_filename << std::endl;
-        return std::nullopt;
+    // the sort verified its output against the input hash unless that was turned off, stdout can not be read back
+    if (is_pipe_name(out_filename)) {
+        std::cout << "output is a pipe, it is not verified" << std::endl;
+    } else if (!options.verify) {
+        std::cout << "output not verified (--verify=off)" << std::endl;
     }
-    size_t initial_partitions = partition(file_input, input_file_size, file_output, internal_memory_size, block_size);
-    std::cout << "initial partitions: " << initial_partitions << std::endl;
-
-    // std::cout << "input" << std::endl;
-    // print_block(file_input, 0, input_file_size / sizeof(Number));
-    // std::cout << "partition output" << std::endl;
-    // print_block(file_output, 0, input_file_size / sizeof(Number));
-
-    // merge phase
-    file_input.close();
-    file_output.close();
-    
-    std::fstream result = external_merge(out_filename, in_filename, internal_memory_size, block_size, input_file_size / sizeof(Number), initial_partitions);
-    return result;
-}
-
-void internal_mergesort_file(std::string& in_filename, std::string out_filename, size_t input_file_size) {
-    copy_file(in_filename, std::string(DATA_PATH"original_input"));
-
-    std::fstream in(in_filename);
-    std::fstream out(out_filename);
-    size_t file_elements = input_file_size / sizeof(Number);
-    std::vector<Number> nums(file_elements);
-    
-    read_data(in, nums, 0, 0, file_elements);
-
-    auto start_time = std::chrono::high_resolution_clock::now();
-    merge_sort(nums, 0, nums.size() - 1);
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-    if (duration < std::chrono::microseconds(1000)) {
-        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::microseconds>(duration).count() << " µs\n";
-    } else 
-        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() << " ms\n";
-    
-    out.write(reinterpret_cast<char*>(nums.data()), input_file_size);    
-    
-    auto original_input = file_open(std::string(DATA_PATH"original_input"));
-    test(original_input, out, input_file_size / sizeof(Number));
-
-    original_input.close();
-    in.close();
-    out.close();
+    return 0;
 }
 
-
 int main(int argc, char* argv[]) {
 
     std::string in_filename;
@@ -509,17 +232,40 @@ int main(int argc, char* argv[]) {
     size_t input_file_size;
     size_t block_size = 1024 * 1024 * 16;
     size_t internal_memory_size = 64 * 1024 * 1024;
-
-    // if (argc > 1)
-    //     std::cout << argv[1] << std::endl;
+    // without a block size (or with auto) the planner picks it, and the run generation unless --runs is given
+    bool plan_block = true;
+    // the device is only calibrated for a block size of auto, it writes a probe file of its own
+    bool calibrate = false;
+    bool choose_run_generation = true;
+    SortOptions options;
+    RecordType record_type = RecordType::i64;
+    bool stats_json = false;
+
+    std::vector<std::string> args;
+    for (int i = 2; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--stats=json" || arg == "--stats=text") {
+            stats_json = arg == "--stats=json";
+        } else if (arg.rfind("--", 0) == 0) {
+            choose_run_generation = choose_run_generation && arg.rfind("--runs=", 0) != 0;
+            if (!parse_option(arg, options, record_type)) {
+                std::cout << "unknown option or bad value: " << arg << std::endl;
+                return 1;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
 
     if (argc > 1 && std::strcmp(argv[1], "gen-input") == 0) {
-        if (argc > 4) {
-            size_t input_file_size = std::stoul(argv[2]) * 1024 * 1024;
-            in_filename = std::string(argv[3]);
-            out_filename = std::string(argv[4]);
-            prepare(input_file_size, in_filename, out_filename);
-            return 0;
+        if (args.size() >= 3) {
+            size_t input_file_size = std::stoul(args[0]) * 1024 * 1024;
+            in_filename = args[1];
+            out_filename = args[2];
+            return with_record_type(record_type, [&](auto record) {
+                prepare<decltype(record)>(input_file_size, in_filename, out_filename);
+                return 0;
+            });
         }
         else {
             std::cout << "specify file size in MB and input and output filename" << std::endl;
@@ -527,9 +273,9 @@ int main(int argc, char* argv[]) {
         }
     }
     else if (argc > 1 && std::strcmp(argv[1], "sort-internal") == 0) {
-        if (argc == 4) {
-            in_filename = std::string(argv[2]);
-            out_filename = std::string(argv[3]);
+        if (args.size() == 2) {
+            in_filename = args[0];
+            out_filename = args[1];
             std::string file_size_string;
             for (char ch : in_filename) {
                 if (std::isdigit(ch)) {
@@ -537,73 +283,72 @@ int main(int argc, char* argv[]) {
                 }
             }
             input_file_size = std::stoul(file_size_string) * 1024 * 1024;
-            std::cout << "sorting file of " << file_size_string << " MB internally" << std::endl;            
-            internal_mergesort_file(in_filename, out_filename, input_file_size);
-            return 0;
+            std::cout << "sorting file of " << file_size_string << " MB internally" << std::endl;
+            return with_record_type(record_type, [&](auto record) {
+                internal_mergesort_file<decltype(record)>(in_filename, out_filename, input_file_size, options.simd);
+                return 0;
+            });
         } else {
             std::cout << "specify two filenames" << std::endl;
             return 1;
         }
     }
     else if (argc > 1 && std::strcmp(argv[1], "sort-external") == 0) {
-        if (argc == 5) {
-            in_filename = std::string(argv[2]);
-            out_filename = std::string(argv[3]);
-            input_file_size = std::stoul(argv[4]) * 1024 * 1024;
+        // the sorted records go to stdout, everything else to stderr
+        if (args.size() >= 2 && is_pipe_name(args[1])) {
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
+        // without a size, or with size -, a file is sorted completely and stdin until it ends
+        auto parse_size = [](const std::string& size) {
+            return size == "-" ? unknown_size : std::stoul(size) * 1024 * 1024;
+        };
+        if (args.size() == 2) {
+            in_filename = args[0];
+            out_filename = args[1];
+            input_file_size = unknown_size;
         }
-        else if (argc == 7) {
-            in_filename = std::string(argv[2]);
-            out_filename = std::string(argv[3]);
-            input_file_size = std::stoul(argv[4]) * 1024 * 1024;
-            block_size = std::stoul(argv[5]) * 1024 * 1024;
-            internal_memory_size = std::stoul(argv[6]) * 1024 * 1024;
-            std::cout << "block size: " << block_size / 1024 / 1024 << "  MB,  main memory size: " << internal_memory_size / 1024 / 1024 << " MB" << std::endl;
+        else if (args.size() == 3) {
+            in_filename = args[0];
+            out_filename = args[1];
+            input_file_size = parse_size(args[2]);
+        }
+        else if (args.size() == 5) {
+            in_filename = args[0];
+            out_filename = args[1];
+            input_file_size = parse_size(args[2]);
+            plan_block = args[3] == "auto";
+            calibrate = plan_block;
+            if (!plan_block) {
+                block_size = std::stoul(args[3]) * 1024 * 1024;
+            }
+            internal_memory_size = std::stoul(args[4]) * 1024 * 1024;
         }
         else {
-            std::cout << "specify: input filename, output filename, input file size in MB. optionally: block size and main memory size" << std::endl;
+            std::cout << "specify: input filename, output filename, input file size in MB. optionally: block size (or auto) and main memory size" << std::endl;
             return 1;
         }
     }
     else {
         std::cout << "command line arguments are: " << std::endl;
         std::cout << "gen-input <filesize in MB> " << std::endl;
-        std::cout << "sort-external <input_filename> <output_filename> (block size MB) (internal memory size MB)" << std::endl;
-        std::cout << "sort-internal <input_filename> <output_filename>" << std::endl; 
-        return 1;
-    }
-
-    
-    copy_file(in_filename, std::string(DATA_PATH"input_copy"));
-    
-    auto copy_filename = std::string(DATA_PATH"input_copy");
-
-    auto copyfile = file_open(copy_filename);
-    // print_block(copyfile, 0, input_file_size / sizeof(Number));
-
-    auto start_time = std::chrono::high_resolution_clock::now();
-
-    auto result = sort_file_external(copy_filename, out_filename, input_file_size, internal_memory_size, block_size);
-
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-    if (duration < std::chrono::microseconds(1000)) {
-        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::microseconds>(duration).count() << " µs\n";
-    } else 
-        std::cout << "Duration: " << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() << " ms\n";
-    
-    if (!result.has_value()) {
-        std::cout << "sorting failed" << std::endl;
+        std::cout << "sort-external <input_filename> <output_filename> (input size MB) (block size MB|auto) (internal memory size MB)" << std::endl;
+        std::cout << "    without a block size the block size and run generation are planned for the memory, with auto the device is calibrated for it first" << std::endl;
+        std::cout << "    - as input or output filename reads stdin or writes stdout, without an input size (or with -) the whole input is sorted" << std::endl;
+        std::cout << "    options: --threads=<n> (default: all cores), --sort=merge|radix (default: merge), --runs=sort|replacement (default: sort)," << std::endl;
+        std::cout << "             --strategy=merge|distribute runs and merge passes or sampled key range buckets (default: merge)," << std::endl;
+        std::cout << "             --io=stream|pread|mmap|direct (default: pread), --simd=auto|scalar|avx2|avx512 int64 merge kernel (default: auto)," << std::endl;
+        std::cout << "             --tmp=<dir>[,<dir>...] for the run files, one per drive (default: directory of the output file), --compress=on|off compressed runs (default: off)," << std::endl;
+        std::cout << "             --stats=text|json report of every phase (default: text), --progress=<seconds> progress on stderr," << std::endl;
+        std::cout << "             --verify=on|off streaming check that the output is the sorted input (default: on)," << std::endl;
+        std::cout << "             --checkpoint=<file> manifest of the finished runs, a sort run again with it resumes from there," << std::endl;
+        std::cout << "             --smallest=<k> only the first k records of the sorted output, --largest=<k> the last k, largest first (no radix sort or SIMD merge)" << std::endl;
+        std::cout << "sort-internal <input_filename> <output_filename>" << std::endl;
+        std::cout << "all commands take --record=i64|u64|u32|f64|kv16|sb100 (default: i64)" << std::endl;
         return 1;
     }
 
-    // print_block(result.value(), 0, input_file_size / sizeof(Number));
-
-    auto input_unsorted = file_open(in_filename);
-    test(input_unsorted, result.value(), input_file_size / sizeof(Number));
-
-    input_unsorted.close();
-    result.value().close();
-
-    
-    return 0;
-}
\ No newline at end of file
+    return with_record_type(record_type, [&](auto record) {
+        using Record = decltype(record);
+        return run_sort_external<Record>(in_filename, out_filename, input_file_size, internal_memory_size, block_size, options, plan_block, calibrate, choose_run_generation, stats_json);
+    });
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "buffer.hpp"
+#include "distribution_sort.hpp"
+#include "external_merge.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_generation.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+// throughput and request latency of the device that holds the run files, 0 if it was not measured
+struct DeviceProfile {
+    double read_bytes_per_second = 0;
+    double write_bytes_per_second = 0;
+    double latency_seconds = 0;
+    // O_DIRECT, or the sort's backend if the file system does not take O_DIRECT
+    IoBackend backend = IoBackend::direct;
+
+    bool measured() const {
+        return read_bytes_per_second > 0 && write_bytes_per_second > 0;
+    }
+};
+
+/**
+ * short calibration of the device behind directory: a probe file is written and read back front to back
+ * in 1 MB requests, then read at random 4 KB offsets for the latency of a request that has to seek
+ * the probe goes through O_DIRECT so the page cache, which just saw the data, does not answer for the device
+ * throws if the probe file can not be written
+ */
+inline DeviceProfile calibrate_device(const std::filesystem::path& directory, IoBackend backend, size_t probe_bytes = 32 * 1024 * 1024) {
+    const size_t request_bytes = 1024 * 1024;
+    const size_t small_bytes = io_alignment;
+    const size_t small_reads = 64;
+    probe_bytes = std::max(request_bytes, probe_bytes / request_bytes * request_bytes);
+
+    DeviceProfile profile;
+    std::string name = (directory / ("external-sort-" + std::to_string(getpid()) + "-calibration.tmp")).string();
+    std::unique_ptr<File> file = file_open_and_clear(name, IoBackend::direct);
+    if (!file) {
+        profile.backend = backend;
+        file = file_create(name, backend);
+    }
+    Buffer<unsigned char> buffer(request_bytes);
+    std::mt19937_64 gen(probe_bytes);
+    for (auto& byte : buffer) {
+        byte = static_cast<unsigned char>(gen());
+    }
+    try {
+        auto start = StatsClock::now();
+        for (size_t offset = 0; offset < probe_bytes; offset += request_bytes) {
+            file->write(buffer.data(), offset, request_bytes);
+        }
+        file->close();
+        profile.write_bytes_per_second = probe_bytes / std::max(1e-9, seconds_since(start));
+
+        start = StatsClock::now();
+        for (size_t offset = 0; offset < probe_bytes; offset += request_bytes) {
+            file->read(buffer.data(), offset, request_bytes);
+        }
+        profile.read_bytes_per_second = probe_bytes / std::max(1e-9, seconds_since(start));
+
+        start = StatsClock::now();
+        for (size_t i = 0; i < small_reads; i++) {
+            size_t offset = gen() % (probe_bytes / small_bytes) * small_bytes;
+            file->read(buffer.data(), offset, small_bytes);
+        }
+        double transfer = small_bytes / profile.read_bytes_per_second;
+        profile.latency_seconds = std::max(0.0, seconds_since(start) / small_reads - transfer);
+    } catch (...) {
+        file.reset();
+        std::error_code error;
+        std::filesystem::remove(name, error);
+        throw;
+    }
+    file.reset();
+    std::error_code error;
+    std::filesystem::remove(name, error);
+    return profile;
+}
+
+/**
+ * fraction of the neighbouring records in order (not descending) in pieces spread over the input,
+ * about 0.5 for random input, 1 for sorted and 0 for reversed input
+ * samples pieces of piece_elements records at pieces places, the whole input if it is smaller
+ * the reads go around io_counters, they are not part of the sort
+ */
+template <typename Record>
+double sample_ascending_pairs(File& input, size_t file_size, size_t pieces = 16, size_t piece_elements = 1024) {
+    size_t elements = file_size / sizeof(Record);
+    if (elements < 2) return 1;
+    piece_elements = std::min(piece_elements, elements);
+    pieces = std::min(pieces, elements / piece_elements);
+    std::vector<Record> piece(piece_elements);
+    size_t pairs = 0;
+    size_t ascending = 0;
+    for (size_t i = 0; i < pieces; i++) {
+        size_t start = (elements - piece_elements) / std::max<size_t>(1, pieces - 1) * i;
+        input.read(piece.data(), start * sizeof(Record), piece_elements * sizeof(Record));
+        for (size_t j = 1; j < piece_elements; j++) {
+            ascending += !RecordTraits<Record>::less(piece[j], piece[j - 1]);
+        }
+        pairs += piece_elements - 1;
+    }
+    return static_cast<double>(ascending) / pairs;
+}
+
+/**
+ * length of the replacement selection runs in heaps for the fraction of the neighbouring records that are in order
+ * (see sample_ascending_pairs): random input (0.5) gives runs of about twice the heap, reversed input (0) runs
+ * of the heap and the runs get longer the more of the input is in order, sorted input is one run
+ * a model for inputs whose order is the same everywhere, an input that is not sampled is planned like reversed input
+ */
+inline double selection_run_factor(double ascending_pairs) {
+    const double max_factor = 1e9;
+    return ascending_pairs >= 1 ? max_factor : std::min(max_factor, 1 / (1 - ascending_pairs));
+}
+
+/**
+ * memory loads of the run generation that start a run of their own, for the fraction of the neighbouring records
+ * that are in order (see sample_ascending_pairs): a load only extends the run before it if all of its records are
+ * in order, which random input never is and sorted input always is
+ */
+inline double new_run_fraction(double ascending_pairs, size_t load_elements) {
+    return 1 - std::pow(std::clamp(ascending_pairs, 0.0, 1.0), static_cast<double>(load_elements));
+}
+
+/**
+ * memory layout of a sort and what it is expected to cost
+ * the numbers follow the code: runs of internal_memory_size / 4, fewer if the loads extend the run before them
+ * (see new_run_fraction), or replacement selection runs of selection_run_factor heaps,
+ * fan_in = internal_memory_size / (2 * block_size) - 1 ways of two blocks each (read ahead one block per way),
+ * and merge workers that read block_size / threads per request
+ */
+struct SortPlan {
+    size_t input_size = 0;
+    bool input_size_known = true;
+    size_t internal_memory_size = 0;
+    size_t block_size = 0;
+    size_t merge_request_size = 0;
+    size_t fan_in = 0;
+    RunGeneration run_generation = RunGeneration::sort;
+    // replacement selection runs in heaps, see selection_run_factor
+    double run_factor = 1;
+    // memory loads of sorted runs, the runs are fewer if loads extend the run before them
+    size_t memory_loads = 0;
+    // runs are key range buckets of a distribution sort, there are no merge passes
+    bool distribution = false;
+    size_t run_size = 0;
+    size_t runs = 0;
+    size_t merge_passes = 0;
+    DeviceProfile device;
+    // I/O time of the run generation and all merge passes, 0 without a measured device
+    double predicted_seconds = 0;
+};
+
+// the plan that the sort runs with these sizes, input_size may be unknown_size
+// a block larger than max_block_size is planned as that, like the sort lowers it
+// ascending_pairs is the sampled order of the input (see sample_ascending_pairs), the default of 0 is reversed input
+template <typename Record>
+SortPlan evaluate_plan(size_t input_size, size_t internal_memory_size, size_t block_size, RunGeneration run_generation, const DeviceProfile& device, const SortOptions& options, double ascending_pairs = 0) {
+    // stdin of unknown length is planned as if it was 64 times the memory
+    const size_t unknown_input_factor = 64;
+    SortPlan plan;
+    plan.input_size_known = input_size != unknown_size;
+    plan.input_size = plan.input_size_known ? input_size : unknown_input_factor * internal_memory_size;
+    plan.internal_memory_size = internal_memory_size;
+    block_size = std::min(block_size, max_block_size(internal_memory_size));
+    plan.block_size = block_size;
+    plan.fan_in = std::max<size_t>(3, internal_memory_size / (2 * block_size)) - 1;
+    size_t threads = merge_threads<Record>(internal_memory_size, block_size, plan.fan_in, options.threads);
+    plan.merge_request_size = aligned_elements<Record>(block_size / threads) * sizeof(Record);
+    plan.run_generation = run_generation;
+    plan.device = device;
+
+    plan.distribution = options.strategy == SortStrategy::distribution && plan.input_size_known
+        && distribution_buckets<Record>(plan.input_size, internal_memory_size) > 1;
+    if (plan.distribution) {
+        plan.runs = distribution_buckets<Record>(plan.input_size, internal_memory_size);
+        plan.run_size = plan.input_size / plan.runs;
+    } else if (run_generation == RunGeneration::replacement_selection) {
+        // runs of run_factor heaps, what is left in the heap at the end is one more run
+        size_t heap_bytes = internal_memory_size - 4 * std::min(block_size, internal_memory_size / 8);
+        size_t heap_size = std::max<size_t>(1, heap_bytes / sizeof(SelectionEntry<Record>)) * sizeof(Record);
+        plan.run_factor = selection_run_factor(ascending_pairs);
+        plan.run_size = std::max<size_t>(heap_size, static_cast<size_t>(std::min<double>(plan.input_size, plan.run_factor * heap_size)));
+        plan.runs = plan.input_size <= heap_size || plan.run_size >= plan.input_size ? 1 : 1 + (plan.input_size - heap_size + plan.run_size - 1) / plan.run_size;
+    } else {
+        // the first load starts a run, every other one only if it does not extend the run before it
+        size_t load_elements = aligned_elements<Record>(internal_memory_size / 4);
+        size_t load_size = load_elements * sizeof(Record);
+        plan.memory_loads = std::max<size_t>(1, (plan.input_size + load_size - 1) / load_size);
+        double new_runs = (plan.memory_loads - 1) * new_run_fraction(ascending_pairs, load_elements);
+        plan.runs = 1 + std::min(plan.memory_loads - 1, static_cast<size_t>(std::ceil(new_runs)));
+        plan.run_size = std::max(load_size, plan.input_size / plan.runs);
+    }
+
+    // intermediate passes until at most fan_in runs are left, then the last pass, unless one run is renamed
+    size_t runs = plan.distribution ? 1 : plan.runs;
+    while (runs > plan.fan_in) {
+        runs = (runs + plan.fan_in - 1) / plan.fan_in;
+        plan.merge_passes++;
+    }
+    if (runs > 1) {
+        plan.merge_passes++;
+    }
+
+    if (device.measured()) {
+        // every pass reads and writes the whole input, each request pays the latency once
+        auto pass_seconds = [&](size_t request_size) {
+            double bytes = static_cast<double>(plan.input_size);
+            return bytes / device.read_bytes_per_second + bytes / device.write_bytes_per_second
+                + 2 * bytes / request_size * device.latency_seconds;
+        };
+        plan.predicted_seconds = pass_seconds(block_size) + plan.merge_passes * pass_seconds(plan.merge_request_size);
+        if (plan.distribution) {
+            // the distribution writes every bucket in blocks of its share of the memory
+            size_t input_block = std::min(block_size, internal_memory_size / 8);
+            plan.predicted_seconds += pass_seconds(std::min(block_size, (internal_memory_size - 2 * input_block) / (2 * plan.runs)));
+        }
+    }
+    return plan;
+}
+
+/**
+ * the block size (and, if choose_run_generation, the run generation) that minimize the predicted I/O time
+ * for a memory cap: large blocks pay the request latency less often, small ones give a larger fan-in
+ * and fewer passes; block sizes are powers of two from 64 KB (or the page aligned block
+ * of the record, if that is larger) up to a sixth of the memory
+ * without device numbers it is the largest block with the fewest passes
+ * replacement selection is only picked if its longer runs save an intermediate merge pass,
+ * its heap costs more CPU per record than a pass that only moves the data once more
+ * the runs of both follow the sampled order of the input, ascending_pairs (see evaluate_plan), the default of 0
+ * assumes the worst, reversed input
+ * every merge way holds two blocks, the one being merged and the one being read ahead, the depth is not planned
+ */
+template <typename Record>
+SortPlan plan_sort(size_t input_size, size_t internal_memory_size, const DeviceProfile& device, const SortOptions& options, bool choose_run_generation, double ascending_pairs = 0) {
+    const size_t min_block_size = std::max<size_t>(64 * 1024, aligned_elements<Record>(0) * sizeof(Record));
+    size_t largest_block_size = std::max(min_block_size, max_block_size(internal_memory_size));
+    SortPlan best;
+    bool found = false;
+    for (size_t block_size = min_block_size; block_size <= largest_block_size; block_size *= 2) {
+        SortPlan plan = evaluate_plan<Record>(input_size, internal_memory_size, block_size, options.run_generation, device, options, ascending_pairs);
+        if (choose_run_generation) {
+            for (RunGeneration run_generation : {RunGeneration::sort, RunGeneration::replacement_selection}) {
+                SortPlan candidate = evaluate_plan<Record>(input_size, internal_memory_size, block_size, run_generation, device, options, ascending_pairs);
+                if (candidate.merge_passes < plan.merge_passes && plan.merge_passes > 1) {
+                    plan = candidate;
+                }
+            }
+        }
+        bool better = device.measured() ? plan.predicted_seconds < best.predicted_seconds : plan.merge_passes <= best.merge_passes;
+        if (!found || better) {
+            best = plan;
+            found = true;
+        }
+    }
+    return best;
+}
+
+inline void print_plan(std::ostream& out, const SortPlan& plan) {
+    const double MB = 1024.0 * 1024.0;
+    auto size = [](size_t bytes) {
+        return bytes < 1024 * 1024 ? std::to_string(bytes / 1024) + " KB" : std::to_string(bytes / 1024 / 1024) + " MB";
+    };
+    std::ios_base::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(1);
+    if (plan.device.measured()) {
+        out << "device: read " << plan.device.read_bytes_per_second / MB << " MB/s, write " << plan.device.write_bytes_per_second / MB
+            << " MB/s, latency " << std::setprecision(3) << plan.device.latency_seconds * 1000 << " ms"
+            << (plan.device.backend == IoBackend::direct ? "" : " (page cache, no O_DIRECT)") << std::setprecision(1) << std::endl;
+    }
+    out << "plan: " << size(plan.internal_memory_size) << " memory for " << size(plan.input_size)
+        << (plan.input_size_known ? "" : " (input size unknown, assumed)") << std::endl;
+    out << "  block size " << size(plan.block_size) << ", merge requests of " << size(plan.merge_request_size) << std::endl;
+    out << "  " << plan.runs << (plan.distribution ? " buckets of " : " runs of ") << size(plan.run_size) << " by "
+        << (plan.distribution ? "sampled splitters" : plan.run_generation == RunGeneration::sort ? "sorting memory loads" : "replacement selection")
+        << (plan.distribution ? ", then sorted one by one" : ", fan-in " + std::to_string(plan.fan_in) + ", " + std::to_string(plan.merge_passes) + " merge passes") << std::endl;
+    if (plan.run_generation == RunGeneration::replacement_selection && !plan.distribution) {
+        out << "  runs of " << std::min(plan.run_factor, 100.0) << (plan.run_factor > 100 ? "+" : "") << " heaps expected from the order of the input" << std::endl;
+    }
+    if (plan.run_generation == RunGeneration::sort && !plan.distribution && plan.runs < plan.memory_loads) {
+        out << "  " << plan.memory_loads - plan.runs << " of " << plan.memory_loads << " memory loads expected to extend the run before them, from the order of the input" << std::endl;
+    }
+    if (plan.fan_in < 4 && plan.runs > plan.fan_in && !plan.distribution) {
+        out << "  the block size leaves a fan-in of " << plan.fan_in << ", a smaller block would need fewer passes" << std::endl;
+    }
+    if (plan.distribution && plan.run_size > plan.internal_memory_size / 4) {
+        out << "  the buckets are larger than a memory load, each one is merge sorted on its own" << std::endl;
+    }
+    if (plan.predicted_seconds > 0) {
+        out << "  predicted I/O time " << std::setprecision(2) << plan.predicted_seconds << " s" << std::endl;
+    }
+    out.flags(flags);
+}
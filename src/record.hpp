@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <random>
+#include <type_traits>
+
+/**
+ * RecordTraits<Record> describes how the sort pipeline orders fixed width records
+ *   less(a, b)    strict weak order on the keys of two records
+ *   radix_bits    width of radix_key in bits, 0 if the key does not fit into an integer
+ *   radix_key(r)  unsigned integer that orders like the key, used by the radix sort
+ *   random(gen)   record with a uniformly distributed key, used by gen-input
+ *   name          name of the record type on the command line
+ * everything is static and inline, so the comparisons in the inner loops are resolved at compile time
+ */
+template <typename Record>
+struct RecordTraits;
+
+template <typename Record>
+bool equivalent(const Record& a, const Record& b) {
+    return !RecordTraits<Record>::less(a, b) && !RecordTraits<Record>::less(b, a);
+}
+
+template <typename Integer>
+struct IntegerTraits {
+    static constexpr unsigned radix_bits = sizeof(Integer) * 8;
+
+    static bool less(Integer a, Integer b) {
+        return a < b;
+    }
+
+    // flip the sign bit so negative numbers order before positive ones
+    static uint64_t radix_key(Integer value) {
+        using Unsigned = std::make_unsigned_t<Integer>;
+        if constexpr (std::is_signed_v<Integer>) {
+            return static_cast<Unsigned>(value) ^ (Unsigned(1) << (radix_bits - 1));
+        } else {
+            return value;
+        }
+    }
+
+    static Integer random(std::mt19937_64& gen) {
+        std::uniform_int_distribution<Integer> dist(std::numeric_limits<Integer>::min(), std::numeric_limits<Integer>::max());
+        return dist(gen);
+    }
+};
+
+template <>
+struct RecordTraits<int64_t> : IntegerTraits<int64_t> {
+    static constexpr const char* name = "i64";
+};
+
+template <>
+struct RecordTraits<uint64_t> : IntegerTraits<uint64_t> {
+    static constexpr const char* name = "u64";
+};
+
+template <>
+struct RecordTraits<uint32_t> : IntegerTraits<uint32_t> {
+    static constexpr const char* name = "u32";
+};
+
+// NaN is not ordered and must not appear in the input
+template <>
+struct RecordTraits<double> {
+    static constexpr const char* name = "f64";
+    static constexpr unsigned radix_bits = 64;
+
+    static bool less(double a, double b) {
+        return a < b;
+    }
+
+    // negative numbers have all bits flipped so their order reverses, positive ones only the sign bit
+    static uint64_t radix_key(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits & (uint64_t(1) << 63) ? ~bits : bits | (uint64_t(1) << 63);
+    }
+
+    static double random(std::mt19937_64& gen) {
+        std::uniform_real_distribution<double> dist(-1e18, 1e18);
+        return dist(gen);
+    }
+};
+
+// 16 byte record: 8 byte unsigned key followed by an 8 byte payload that is carried along
+struct KeyPayload16 {
+    uint64_t key;
+    uint64_t payload;
+};
+
+template <>
+struct RecordTraits<KeyPayload16> {
+    static constexpr const char* name = "kv16";
+    static constexpr unsigned radix_bits = 64;
+
+    static bool less(const KeyPayload16& a, const KeyPayload16& b) {
+        return a.key < b.key;
+    }
+
+    static uint64_t radix_key(const KeyPayload16& record) {
+        return record.key;
+    }
+
+    static KeyPayload16 random(std::mt19937_64& gen) {
+        return KeyPayload16{gen(), gen()};
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const KeyPayload16& record) {
+    return out << record.key << ":" << record.payload;
+}
+
+// 100 byte record of the Sort Benchmark: 10 byte key compared as unsigned bytes, 90 byte payload
+struct SortBenchmarkRecord {
+    unsigned char key[10];
+    unsigned char payload[90];
+};
+
+template <>
+struct RecordTraits<SortBenchmarkRecord> {
+    static constexpr const char* name = "sb100";
+    static constexpr unsigned radix_bits = 0;
+
+    static bool less(const SortBenchmarkRecord& a, const SortBenchmarkRecord& b) {
+        return std::memcmp(a.key, b.key, sizeof(a.key)) < 0;
+    }
+
+    static SortBenchmarkRecord random(std::mt19937_64& gen) {
+        SortBenchmarkRecord record;
+        for (auto& byte : record.key) {
+            byte = static_cast<unsigned char>(gen());
+        }
+        for (size_t i = 0; i < sizeof(record.payload); i++) {
+            record.payload[i] = static_cast<unsigned char>('A' + i % 26);
+        }
+        return record;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const SortBenchmarkRecord& record) {
+    std::ios_base::fmtflags flags = out.flags();
+    out << std::hex << std::setfill('0');
+    for (auto byte : record.key) {
+        out << std::setw(2) << static_cast<unsigned>(byte);
+    }
+    out.flags(flags);
+    return out;
+}
+
+// the order of RecordTraits<Record>, the default comparator of a Sorter
+template <typename Record>
+struct RecordLess {
+    bool operator()(const Record& a, const Record& b) const {
+        return RecordTraits<Record>::less(a, b);
+    }
+};
+
+// the reverse order of RecordTraits<Record>, largest key first
+template <typename Record>
+struct RecordGreater {
+    bool operator()(const Record& a, const Record& b) const {
+        return RecordTraits<Record>::less(b, a);
+    }
+};
+
+// a record sorted by the comparator Less instead of its RecordTraits, Less is default constructed
+template <typename Record, typename Less>
+struct OrderedBy {
+    Record record;
+};
+
+template <typename Record>
+constexpr bool is_ordered_by = false;
+
+template <typename Record, typename Less>
+constexpr bool is_ordered_by<OrderedBy<Record, Less>> = true;
+
+template <typename Record, typename Less>
+struct RecordTraits<OrderedBy<Record, Less>> {
+    static constexpr const char* name = "custom";
+    static constexpr unsigned radix_bits = 0;
+
+    static bool less(const OrderedBy<Record, Less>& a, const OrderedBy<Record, Less>& b) {
+        return Less{}(a.record, b.record);
+    }
+};
+
+inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+/**
+ * order independent hash of a multiset of records: the sums of two hashes of every record's bytes,
+ * so a sorted output has the hash of its input exactly when it holds the same records (up to collisions)
+ * hashes of parts of the input add up to the hash of the whole input
+ */
+struct MultisetHash {
+    size_t count = 0;
+    uint64_t sum = 0;
+    uint64_t mixed_sum = 0;
+
+    template <typename Record>
+    void add(const Record& record) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&record);
+        uint64_t hash = sizeof(Record);
+        for (size_t i = 0; i < sizeof(Record); i += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes + i, std::min(sizeof(uint64_t), sizeof(Record) - i));
+            hash = mix64(hash ^ word);
+        }
+        count++;
+        sum += hash;
+        mixed_sum += mix64(hash + 0x9e3779b97f4a7c15);
+    }
+
+    template <typename Record>
+    void add(const Record* records, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            add(records[i]);
+        }
+    }
+
+    void add(const MultisetHash& other) {
+        count += other.count;
+        sum += other.sum;
+        mixed_sum += other.mixed_sum;
+    }
+
+    bool operator==(const MultisetHash& other) const = default;
+};
+
+enum class RecordType {
+    i64,
+    u64,
+    u32,
+    f64,
+    kv16,
+    sb100
+};
+
+// call f with a default constructed record of the selected type, f picks the record type up with decltype
+template <typename F>
+int with_record_type(RecordType type, F&& f) {
+    switch (type) {
+    case RecordType::u64: return f(uint64_t{});
+    case RecordType::u32: return f(uint32_t{});
+    case RecordType::f64: return f(double{});
+    case RecordType::kv16: return f(KeyPayload16{});
+    case RecordType::sb100: return f(SortBenchmarkRecord{});
+    case RecordType::i64: break;
+    }
+    return f(int64_t{});
+}
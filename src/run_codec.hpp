@@ -0,0 +1,427 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "io.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+/**
+ * codecs of the frames of compressed run files, a frame holds a fixed number of records and is coded on its own
+ * plain numbers are delta coded: the differences of neighbours in a sorted run are small, they are zigzag coded
+ * and bit packed in groups of 128 with the width of the largest one (frame of reference)
+ * other records are xor coded: every byte is xored with the same byte of the previous record, which turns equal
+ * key prefixes and repeated payload bytes into zeros, and runs of zeros are stored as their length
+ */
+template <typename Record>
+constexpr bool delta_coded = std::is_arithmetic_v<Record> && (sizeof(Record) == 4 || sizeof(Record) == 8);
+
+inline void put_varint(std::vector<char>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline size_t get_varint(const unsigned char*& in) {
+    size_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        unsigned char byte = *in++;
+        value |= size_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+}
+
+template <typename Record>
+void encode_delta(const Record* records, size_t count, std::vector<char>& out) {
+    using Bits = std::conditional_t<sizeof(Record) == 8, uint64_t, uint32_t>;
+    const unsigned bits = sizeof(Bits) * 8;
+    const size_t group = 128;
+    Bits previous;
+    std::memcpy(&previous, records, sizeof(Bits));
+    out.insert(out.end(), reinterpret_cast<const char*>(&previous), reinterpret_cast<const char*>(&previous) + sizeof(Bits));
+
+    Bits zigzag[group];
+    for (size_t start = 1; start < count; start += group) {
+        size_t n = std::min(group, count - start);
+        Bits any = 0;
+        for (size_t i = 0; i < n; i++) {
+            Bits value;
+            std::memcpy(&value, records + start + i, sizeof(Bits));
+            Bits delta = value - previous;
+            previous = value;
+            zigzag[i] = (delta << 1) ^ (Bits(0) - (delta >> (bits - 1)));
+            any |= zigzag[i];
+        }
+        unsigned width = std::bit_width(any);
+        out.push_back(static_cast<char>(width));
+        uint64_t packed = 0;
+        unsigned used = 0;
+        for (size_t i = 0; i < n && width > 0; i++) {
+            uint64_t value = zigzag[i];
+            packed |= value << used;
+            if (used + width >= 64) {
+                out.insert(out.end(), reinterpret_cast<const char*>(&packed), reinterpret_cast<const char*>(&packed) + 8);
+                unsigned left = used + width - 64;
+                packed = left > 0 ? value >> (width - left) : 0;
+                used = left;
+            } else {
+                used += width;
+            }
+        }
+        out.insert(out.end(), reinterpret_cast<const char*>(&packed), reinterpret_cast<const char*>(&packed) + (used + 7) / 8);
+    }
+}
+
+// in has to be readable 8 bytes past the end of the frame
+template <typename Record>
+void decode_delta(const unsigned char* in, Record* records, size_t count) {
+    using Bits = std::conditional_t<sizeof(Record) == 8, uint64_t, uint32_t>;
+    const size_t group = 128;
+    Bits previous;
+    std::memcpy(&previous, in, sizeof(Bits));
+    std::memcpy(records, &previous, sizeof(Bits));
+    in += sizeof(Bits);
+
+    for (size_t start = 1; start < count; start += group) {
+        size_t n = std::min(group, count - start);
+        unsigned width = *in++;
+        uint64_t mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+        size_t position = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t value;
+            if (width <= 56) {
+                uint64_t word;
+                std::memcpy(&word, in + position / 8, 8);
+                value = (word >> (position % 8)) & mask;
+            } else {
+                // too wide for one unaligned load, gather the bits byte by byte
+                value = 0;
+                for (unsigned got = 0; got < width;) {
+                    size_t bit = position + got;
+                    unsigned take = std::min(8 - unsigned(bit % 8), width - got);
+                    value |= uint64_t((in[bit / 8] >> (bit % 8)) & ((1u << take) - 1)) << got;
+                    got += take;
+                }
+            }
+            position += width;
+            Bits zigzag = static_cast<Bits>(value);
+            previous += (zigzag >> 1) ^ (Bits(0) - (zigzag & 1));
+            std::memcpy(records + start + i, &previous, sizeof(Bits));
+        }
+        in += (position + 7) / 8;
+    }
+}
+
+template <typename Record>
+void encode_xor(const Record* records, size_t count, std::vector<char>& out) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(records);
+    const size_t record_bytes = sizeof(Record);
+    size_t total = count * record_bytes;
+    auto coded = [&](size_t k) -> unsigned char {
+        return k < record_bytes ? bytes[k] : bytes[k] ^ bytes[k - record_bytes];
+    };
+    size_t i = 0;
+    while (i < total) {
+        size_t zeros = 0;
+        while (i + zeros < total && coded(i + zeros) == 0) {
+            zeros++;
+        }
+        // a literal run ends at the next run of four zeros, shorter ones cost less as literals
+        size_t literal = i + zeros;
+        size_t end = literal;
+        while (end < total) {
+            size_t k = end;
+            while (k < total && k < end + 4 && coded(k) == 0) {
+                k++;
+            }
+            if (k == total || k == end + 4) break;
+            end = k + 1;
+        }
+        put_varint(out, zeros);
+        put_varint(out, end - literal);
+        for (size_t k = literal; k < end; k++) {
+            out.push_back(static_cast<char>(coded(k)));
+        }
+        i = end;
+    }
+}
+
+template <typename Record>
+void decode_xor(const unsigned char* in, Record* records, size_t count) {
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(records);
+    const size_t record_bytes = sizeof(Record);
+    size_t total = count * record_bytes;
+    auto previous = [&](size_t k) -> unsigned char {
+        return k < record_bytes ? 0 : bytes[k - record_bytes];
+    };
+    size_t i = 0;
+    while (i < total) {
+        size_t zeros = get_varint(in);
+        size_t literal = get_varint(in);
+        for (size_t end = i + zeros; i < end; i++) {
+            bytes[i] = previous(i);
+        }
+        for (size_t end = i + literal; i < end; i++) {
+            bytes[i] = static_cast<unsigned char>(*in++) ^ previous(i);
+        }
+    }
+}
+
+/**
+ * run file whose records are stored in compressed frames, the sort reads and writes it like the plain run file
+ * offsets and sizes are those of the records, the frames go to the underlying file in the order they are completed
+ * and an index of them is appended when the file is closed
+ * the parts of a parallel merge write their ranges at the same time, a frame that two parts share is assembled
+ * in memory until both wrote their piece
+ * the compressed bytes are what the file adds to io_counters
+ */
+template <typename Record>
+class CompressedFile : public File {
+public:
+    static constexpr size_t frame_elements = std::max<size_t>(1, 16384 / sizeof(Record));
+    static constexpr size_t frame_bytes = frame_elements * sizeof(Record);
+
+    // create starts an empty file, otherwise the index is read from the end of file
+    CompressedFile(std::unique_ptr<File> file, bool create) : file(std::move(file)), created(create) {
+        if (!create) {
+            read_index();
+        }
+    }
+
+    ~CompressedFile() override {
+        try {
+            close();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: (compressed file) " << e.what() << std::endl;
+        }
+    }
+
+    void read(void* buffer, size_t offset, size_t bytes) override {
+        if (offset + bytes > logical_size) {
+            throw std::runtime_error("read past the end of a compressed run at offset " + std::to_string(offset));
+        }
+        char* dst = static_cast<char*>(buffer);
+        std::vector<char> stored;
+        for (size_t frame = offset / frame_bytes; frame * frame_bytes < offset + bytes; frame++) {
+            size_t frame_start = frame * frame_bytes;
+            size_t frame_size = std::min(frame_bytes, logical_size - frame_start);
+            size_t copy_begin = std::max(frame_start, offset);
+            size_t copy_end = std::min(frame_start + frame_size, offset + bytes);
+            if (copy_begin == frame_start && copy_end == frame_start + frame_size) {
+                decode_frame(frame, dst + (frame_start - offset), stored);
+                continue;
+            }
+            // the binary searches of the merge split read single records, the last frame is kept for them
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            if (cached_frame != frame) {
+                cache.resize(frame_elements);
+                decode_frame(frame, cache.data(), stored);
+                cached_frame = frame;
+            }
+            std::memcpy(dst + (copy_begin - offset), reinterpret_cast<const char*>(cache.data()) + (copy_begin - frame_start), copy_end - copy_begin);
+        }
+    }
+
+    void write(const void* buffer, size_t offset, size_t bytes) override {
+        const char* src = static_cast<const char*>(buffer);
+        size_t end = offset + bytes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            logical_size = std::max(logical_size, end);
+        }
+        for (size_t frame = offset / frame_bytes; frame * frame_bytes < end; frame++) {
+            size_t frame_start = frame * frame_bytes;
+            size_t copy_begin = std::max(frame_start, offset);
+            size_t copy_end = std::min(frame_start + frame_bytes, end);
+            if (copy_begin == frame_start && copy_end == frame_start + frame_bytes) {
+                store_frame(frame, reinterpret_cast<const Record*>(src + (frame_start - offset)), frame_elements);
+                continue;
+            }
+            std::unique_ptr<PartialFrame> complete;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::unique_ptr<PartialFrame>& partial = partial_frames[frame];
+                if (!partial) {
+                    partial = std::make_unique<PartialFrame>();
+                    partial->records.resize(frame_elements);
+                }
+                std::memcpy(reinterpret_cast<char*>(partial->records.data()) + (copy_begin - frame_start), src + (copy_begin - offset), copy_end - copy_begin);
+                partial->filled += copy_end - copy_begin;
+                if (partial->filled == frame_bytes) {
+                    complete = std::move(partial);
+                    partial_frames.erase(frame);
+                }
+            }
+            if (complete) {
+                store_frame(frame, complete->records.data(), frame_elements);
+            }
+        }
+    }
+
+    size_t size() override {
+        return logical_size;
+    }
+
+    bool counts_io() const override {
+        return true;
+    }
+
+    // store the last frame, which is not full, and the index
+    void close() override {
+        std::lock_guard<std::mutex> lock(close_mutex);
+        if (closed || !created) return;
+        closed = true;
+        for (auto& [frame, partial] : partial_frames) {
+            size_t frame_size = std::min(frame_bytes, logical_size - frame * frame_bytes);
+            if (partial->filled != frame_size) {
+                throw std::runtime_error("compressed run has a gap in the frame at offset " + std::to_string(frame * frame_bytes));
+            }
+            store_frame(frame, partial->records.data(), frame_size / sizeof(Record));
+        }
+        partial_frames.clear();
+        std::vector<uint64_t> index;
+        for (const FrameEntry& entry : frames) {
+            index.push_back(entry.offset);
+            index.push_back(entry.bytes);
+        }
+        index.push_back(logical_size);
+        index.push_back(frames.size());
+        file->write(index.data(), end_of_frames, index.size() * sizeof(uint64_t));
+        io_counters.bytes_written += index.size() * sizeof(uint64_t);
+        file->close();
+    }
+
+private:
+    // where a frame is stored, bytes has raw_frame set if the frame did not get smaller
+    struct FrameEntry {
+        uint64_t offset = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct PartialFrame {
+        Buffer<Record> records;
+        size_t filled = 0;
+    };
+
+    static constexpr uint64_t raw_frame = uint64_t(1) << 63;
+
+    std::unique_ptr<File> file;
+    std::mutex mutex;
+    std::mutex close_mutex;
+    std::mutex cache_mutex;
+    std::vector<FrameEntry> frames;
+    std::map<size_t, std::unique_ptr<PartialFrame>> partial_frames;
+    size_t logical_size = 0;
+    size_t end_of_frames = 0;
+    bool created;
+    bool closed = false;
+    Buffer<Record> cache;
+    size_t cached_frame = SIZE_MAX;
+
+    static void encode(const Record* records, size_t count, std::vector<char>& out) {
+        if constexpr (delta_coded<Record>) {
+            encode_delta(records, count, out);
+        } else {
+            encode_xor(records, count, out);
+        }
+    }
+
+    static void decode(const unsigned char* in, Record* records, size_t count) {
+        if constexpr (delta_coded<Record>) {
+            decode_delta(in, records, count);
+        } else {
+            decode_xor(in, records, count);
+        }
+    }
+
+    void store_frame(size_t frame, const Record* records, size_t count) {
+        std::vector<char> coded;
+        encode(records, count, coded);
+        bool raw = coded.size() >= count * sizeof(Record);
+        const void* data = raw ? static_cast<const void*>(records) : coded.data();
+        size_t bytes = raw ? count * sizeof(Record) : coded.size();
+        size_t offset;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            offset = end_of_frames;
+            end_of_frames += bytes;
+            if (frames.size() <= frame) {
+                frames.resize(frame + 1);
+            }
+            frames[frame] = FrameEntry{offset, raw ? bytes | raw_frame : bytes};
+        }
+        file->write(data, offset, bytes);
+        io_counters.bytes_written += bytes;
+    }
+
+    void decode_frame(size_t frame, void* records, std::vector<char>& stored) {
+        const FrameEntry& entry = frames[frame];
+        size_t bytes = entry.bytes & ~raw_frame;
+        size_t count = std::min(frame_bytes, logical_size - frame * frame_bytes) / sizeof(Record);
+        io_counters.bytes_read += bytes;
+        if (entry.bytes & raw_frame) {
+            file->read(records, entry.offset, bytes);
+            return;
+        }
+        // the decoder may load 8 bytes past the end
+        stored.resize(bytes + 8);
+        file->read(stored.data(), entry.offset, bytes);
+        decode(reinterpret_cast<const unsigned char*>(stored.data()), static_cast<Record*>(records), count);
+    }
+
+    void read_index() {
+        size_t file_size = file->size();
+        uint64_t tail[2];
+        if (file_size < sizeof(tail)) {
+            throw std::runtime_error("compressed run without an index");
+        }
+        file->read(tail, file_size - sizeof(tail), sizeof(tail));
+        logical_size = tail[0];
+        size_t index_bytes = tail[1] * 2 * sizeof(uint64_t) + sizeof(tail);
+        if (index_bytes > file_size) {
+            throw std::runtime_error("compressed run with a broken index");
+        }
+        std::vector<uint64_t> index(tail[1] * 2);
+        file->read(index.data(), file_size - index_bytes, index.size() * sizeof(uint64_t));
+        io_counters.bytes_read += index_bytes;
+        frames.resize(tail[1]);
+        for (size_t frame = 0; frame < frames.size(); frame++) {
+            frames[frame] = FrameEntry{index[2 * frame], index[2 * frame + 1]};
+        }
+        end_of_frames = file_size - index_bytes;
+    }
+};
+
+// a new run file, compressed if options.compress_runs
+template <typename Record>
+std::unique_ptr<File> run_create(const std::string& filename, const SortOptions& options) {
+    std::unique_ptr<File> file = file_create(filename, options.io_backend);
+    if (options.compress_runs) {
+        return std::make_unique<CompressedFile<Record>>(std::move(file), true);
+    }
+    return file;
+}
+
+template <typename Record>
+std::unique_ptr<File> run_open(const std::string& filename, const SortOptions& options) {
+    std::unique_ptr<File> file = file_open(filename, options.io_backend);
+    if (!file) {
+        throw std::runtime_error("unable to open run file " + filename);
+    }
+    if (options.compress_runs) {
+        return std::make_unique<CompressedFile<Record>>(std::move(file), false);
+    }
+    return file;
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_codec.hpp"
+#include "scratch.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+#include "sort_kernels.hpp"
+
+// sort nums[begin, end), a range that is already in order or exactly reversed is found in one pass and not sorted again
+// int64 records are merged with the kernel of options.simd
+template <typename Record>
+void sort_internal(Buffer<Record>& nums, Buffer<Record>& scratch, size_t begin, size_t end, const SortOptions& options) {
+    Record* range = nums.data() + begin;
+    size_t size = end - begin;
+    if (ascending_prefix(range, size) == size) return;
+    if (descending_prefix(range, size) == size) {
+        std::reverse(range, range + size);
+        return;
+    }
+    void (*sort_slice)(Record*, Record*, size_t, MergeInt64) = merge_sort<Record>;
+    if constexpr (RecordTraits<Record>::radix_bits > 0) {
+        if (options.sort_algorithm == SortAlgorithm::radix) {
+            sort_slice = radix_sort<Record>;
+        }
+    }
+    parallel_sort(nums, scratch, begin, end, options.threads, sort_slice, select_merge_int64(options.simd));
+}
+
+/**
+ * run formation as a pipeline: while chunk n is sorted, chunk n + 1 is read
+ * and chunk n - 1 is written to its run file in the background
+ * the read, sort, write and sort scratch buffers share the internal memory,
+ * so runs are internal_memory_size / 4 long
+ * a chunk whose sorted prefix continues the previous run is appended to that run instead of being sorted,
+ * so presorted input becomes one run that is checked and written in a single pass
+ * the input is read front to back until file_size or, for a pipe of unknown_size, until it ends
+ * if options.verify is set or there is a checkpoint, the writer thread adds the records of every run to input_hash
+ * with a checkpoint the runs it has are kept, the input is read from the end of them on and every
+ * closed run is saved to it
+ */
+template <typename Record>
+std::vector<Run> partition(File& input, size_t file_size, ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options, PhaseStats& phase, MultisetHash& input_hash, Checkpoint* checkpoint) {
+    size_t max_element_file = file_size == unknown_size ? unknown_size : whole_records<Record>(file_size, "input");
+    size_t chunk_elements = aligned_elements<Record>(internal_memory_size / 4);
+    size_t block_elements = aligned_elements<Record>(block_size);
+    check_buffer_memory(4 * chunk_elements * sizeof(Record), internal_memory_size, "run generation");
+
+    std::vector<Run> runs;
+    size_t first_element = 0;
+    if (checkpoint != nullptr) {
+        runs = checkpoint->runs();
+        input_hash = checkpoint->hash();
+        first_element = checkpoint->input_elements();
+    }
+    size_t resumed_runs = runs.size();
+    bool hash_input = options.verify || checkpoint != nullptr;
+
+    std::vector<Buffer<Record>> buffers(3, Buffer<Record>(chunk_elements));
+    Buffer<Record> scratch(chunk_elements);
+    std::future<void> writes[3];
+    size_t read_elements[3] = {0, 0, 0};
+    std::future<void> reading;
+    // the last run, kept open by the writer tasks while the following chunks extend it, the hash of its
+    // records and the runs that were closed before it, all only touched by the writer thread
+    std::unique_ptr<File> open_run;
+    Run open_run_info;
+    MultisetHash open_run_hash;
+    std::vector<Run> closed_runs = runs;
+    Record open_run_last{};
+    IoThread reader;
+    IoThread writer;
+    PhaseMeasurement measurement({&reader}, {&writer});
+
+    auto request_read = [&](size_t chunk) {
+        Buffer<Record>& buffer = buffers[chunk % 3];
+        if (writes[chunk % 3].valid()) {
+            wait_io(writes[chunk % 3], phase.write_stall_seconds);
+        }
+        size_t start = first_element + chunk * chunk_elements;
+        size_t elements = start < max_element_file ? std::min(chunk_elements, max_element_file - start) : 0;
+        size_t& read = read_elements[chunk % 3];
+        reading = reader.submit([&input, &buffer, &read, start, elements, block_elements] {
+            read = read_chunk(input, buffer, start, elements, block_elements);
+        });
+    };
+
+    auto close_run = [&] {
+        if (!open_run) return;
+        open_run->close();
+        open_run.reset();
+        open_run_info.hash = open_run_hash;
+        closed_runs.push_back(open_run_info);
+        input_hash.add(open_run_hash);
+        if (checkpoint != nullptr) {
+            // once the manifest has the run, it outlives a failed sort
+            checkpoint->save(closed_runs, input_hash, false);
+            scratch_space.forget(open_run_info.file);
+        }
+    };
+
+    request_read(0);
+    for (size_t chunk = 0;; chunk++) {
+        wait_io(reading, phase.read_stall_seconds);
+        size_t elements = read_elements[chunk % 3];
+        if (elements == 0) break;
+        // a chunk that is not full is the end of the input
+        bool last = elements < chunk_elements;
+        if (!last) {
+            request_read(chunk + 1);
+        }
+        Buffer<Record>& buffer = buffers[chunk % 3];
+        auto sort_start = StatsClock::now();
+        size_t extend = 0;
+        if (runs.size() > resumed_runs && !RecordTraits<Record>::less(buffer[0], open_run_last)) {
+            extend = ascending_prefix(buffer.data(), elements);
+        }
+        std::string file;
+        if (extend > 0) {
+            runs.back().elements += extend;
+        }
+        if (extend < elements) {
+            runs.push_back(Run{scratch_space.create_name(), elements - extend});
+            file = runs.back().file;
+            sort_internal(buffer, scratch, extend, elements, options);
+        }
+        phase.sort_seconds += seconds_since(sort_start);
+        open_run_last = buffer[elements - 1];
+        writes[chunk % 3] = writer.submit([&buffer, &options, &open_run, &open_run_info, &open_run_hash, &close_run, checkpoint, hash_input, file, extend, elements, block_elements] {
+            if (extend > 0) {
+                write_chunk(*open_run, buffer.data(), open_run_info.elements, extend, block_elements);
+                open_run_info.elements += extend;
+                if (hash_input) {
+                    open_run_hash.add(buffer.data(), extend);
+                }
+            }
+            if (extend < elements) {
+                close_run();
+                if (checkpoint != nullptr) {
+                    checkpoint->begin_run(file);
+                }
+                open_run = run_create<Record>(file, options);
+                write_chunk(*open_run, buffer.data() + extend, 0, elements - extend, block_elements);
+                open_run_info = Run{file, elements - extend};
+                open_run_hash = MultisetHash();
+                if (hash_input) {
+                    open_run_hash.add(buffer.data() + extend, elements - extend);
+                }
+            }
+        });
+        if (last) break;
+    }
+    for (auto& write : writes) {
+        if (write.valid()) {
+            wait_io(write, phase.write_stall_seconds);
+        }
+    }
+    close_run();
+    measurement.finish(phase);
+    // the same runs, with the hashes of their records
+    return closed_runs;
+}
+
+// heap entry of replacement selection, ordered by run first so the next run's elements sink below the current ones
+template <typename Record>
+struct SelectionEntry {
+    size_t run;
+    Record value;
+
+    bool operator>(const SelectionEntry& other) const {
+        return run > other.run || (run == other.run && RecordTraits<Record>::less(other.value, value));
+    }
+};
+
+// restore the min heap after heap[position] grew
+template <typename Record>
+void sift_down(std::vector<SelectionEntry<Record>>& heap, size_t position) {
+    size_t size = heap.size();
+    SelectionEntry<Record> entry = heap[position];
+    while (2 * position + 1 < size) {
+        size_t child = 2 * position + 1;
+        if (child + 1 < size && heap[child] > heap[child + 1]) {
+            child++;
+        }
+        if (!(entry > heap[child])) break;
+        heap[position] = heap[child];
+        position = child;
+    }
+    heap[position] = entry;
+}
+
+/**
+ * run formation by replacement selection: a min heap emits the smallest element that can still
+ * extend the current run, elements smaller than the last output are held back for the next run
+ * runs are about twice the heap size on random input and the input is one run if it is already sorted
+ * the heap gets the internal memory that is left after the double buffered input and output blocks,
+ * which take up to an eighth of the memory each
+ * if options.verify is set or there is a checkpoint, every record read is added to input_hash
+ * the runs of a checkpoint are kept and the input is read from the end of them on, the runs are not saved
+ * one by one because the heap carries records from one run to the next, but every run gets the hash of its records
+ */
+template <typename Record>
+std::vector<Run> partition_replacement_selection(File& input, size_t file_size, ScratchSpace& scratch_space, size_t internal_memory_size, size_t block_size, const SortOptions& options, PhaseStats& phase, MultisetHash& input_hash, Checkpoint* checkpoint) {
+    size_t max_element_file = file_size == unknown_size ? unknown_size : whole_records<Record>(file_size, "input");
+    size_t block_elements = aligned_elements<Record>(std::min(block_size, internal_memory_size / 8));
+    size_t block_bytes = 4 * block_elements * sizeof(Record);
+    check_buffer_memory(block_bytes + sizeof(SelectionEntry<Record>), internal_memory_size, "replacement selection");
+    size_t heap_capacity = (internal_memory_size - block_bytes) / sizeof(SelectionEntry<Record>);
+
+    IoThread reader;
+    IoThread writer;
+    PhaseMeasurement measurement({&reader}, {&writer});
+    MergeSource<Record> source;
+    source.block_elements = block_elements;
+    source.next_element_file = checkpoint != nullptr ? checkpoint->input_elements() : 0;
+    source.end_element_file = max_element_file;
+    bool hash_input = options.verify || checkpoint != nullptr;
+    if (checkpoint != nullptr) {
+        input_hash = checkpoint->hash();
+    }
+    source.request(reader, input);
+    bool has_input = source.refill(reader, input);
+
+    std::unique_ptr<File> run_file;
+    Buffer<Record> output_buffer(block_elements);
+    Buffer<Record> output_in_flight(block_elements);
+    BlockWriter<Record> writer_buffer(output_buffer, output_in_flight, writer);
+
+    auto next_input = [&](Record& value) {
+        if (!has_input) return false;
+        value = source.data[source.position++];
+        if (hash_input) {
+            input_hash.add(value);
+        }
+        if (source.position == source.filled) {
+            has_input = source.refill(reader, input);
+        }
+        return true;
+    };
+
+    std::vector<SelectionEntry<Record>> heap;
+    heap.reserve(heap_capacity);
+    Record value;
+    while (heap.size() < heap_capacity && next_input(value)) {
+        heap.push_back(SelectionEntry<Record>{0, value});
+    }
+    std::make_heap(heap.begin(), heap.end(), std::greater<SelectionEntry<Record>>());
+
+    std::vector<Run> runs;
+    if (checkpoint != nullptr) {
+        runs = checkpoint->runs();
+    }
+    size_t resumed_runs = runs.size();
+    size_t current_run = 0;
+    while (!heap.empty()) {
+        SelectionEntry<Record> top = heap[0];
+        if (runs.size() == resumed_runs || top.run != current_run) {
+            // the run file is closed only after its last block reached it
+            writer_buffer.finish();
+            if (run_file) {
+                run_file->close();
+            }
+            runs.push_back(Run{scratch_space.create_name(), 0});
+            if (checkpoint != nullptr) {
+                checkpoint->begin_run(runs.back().file);
+            }
+            run_file = run_create<Record>(runs.back().file, options);
+            writer_buffer.start(*run_file);
+            current_run = top.run;
+        }
+        writer_buffer.push(top.value);
+        runs.back().elements++;
+        if (checkpoint != nullptr) {
+            runs.back().hash.add(top.value);
+        }
+
+        if (next_input(value)) {
+            size_t run = RecordTraits<Record>::less(value, top.value) ? current_run + 1 : current_run;
+            heap[0] = SelectionEntry<Record>{run, value};
+        } else {
+            heap[0] = heap.back();
+            heap.pop_back();
+        }
+        if (!heap.empty()) {
+            sift_down(heap, 0);
+        }
+    }
+    writer_buffer.finish();
+    if (run_file) {
+        run_file->close();
+    }
+    measurement.finish(phase);
+    // the heap work is what the selection thread did while it was not waiting for I/O
+    phase.read_stall_seconds = source.stall_seconds;
+    phase.write_stall_seconds = writer_buffer.stall_seconds();
+    phase.sort_seconds = phase.seconds - phase.read_stall_seconds - phase.write_stall_seconds;
+    return runs;
+}
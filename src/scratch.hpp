@@ -0,0 +1,147 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "sort_config.hpp"
+
+/**
+ * temporary files of one sort, every run lives in its own file in a scratch directory,
+ * so its space is given back as soon as the run is merged
+ * files that are still around when the sort ends (after an error) are removed, except those a checkpoint
+ * lists, which are forgotten once they are in the manifest
+ * names are handed out and forgotten by the sorting thread and the run writer, so the set is locked
+ * with several directories, one per drive, they are split into two halves: the run generation writes to the
+ * first half and every merge pass to the half the previous pass did not write, so each pass reads from one
+ * set of drives and writes to the other, within a half the files go round robin
+ * narrow restricts the files to one half, which is split again for the passes, until widen (see NarrowedScratch)
+ */
+class ScratchSpace {
+public:
+    explicit ScratchSpace(std::vector<std::filesystem::path> directories) : directories(std::move(directories)) {
+        if (this->directories.empty()) {
+            this->directories.push_back(std::filesystem::current_path());
+        }
+    }
+
+    ScratchSpace(const ScratchSpace&) = delete;
+    ScratchSpace& operator=(const ScratchSpace&) = delete;
+
+    ~ScratchSpace() {
+        for (const std::string& name : files) {
+            std::error_code error;
+            std::filesystem::remove(name, error);
+        }
+    }
+
+    // name of a new run file of the current pass, the file is created by whoever writes the run
+    // a file of a resumed sort may have the name already, after a restart the pid can repeat
+    std::string create_name() {
+        std::lock_guard<std::mutex> lock(mutex);
+        // the half of the directories this pass writes to
+        size_t half = (directories.size() + 1) / 2;
+        bool second = pass % 2 == 1 && directories.size() > 1;
+        size_t first = second ? half : 0;
+        size_t count = second ? directories.size() - half : half;
+        std::string name;
+        do {
+            std::string file = "external-sort-" + std::to_string(getpid()) + "-" + std::to_string(next_id++) + ".run";
+            name = (directories[first + next_directory[second]++ % count] / file).string();
+        } while (std::filesystem::exists(name));
+        files.insert(name);
+        return name;
+    }
+
+    // the files created from now on are written by pass number, 0 for the run generation
+    void start_pass(size_t number) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pass = number;
+    }
+
+    size_t current_pass() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pass;
+    }
+
+    // the files created from now on go to the directories of half (0 or 1) alone, from pass 0 on, their passes
+    // alternate between the halves of those directories; a single directory is both halves
+    void narrow(size_t half) {
+        std::lock_guard<std::mutex> lock(mutex);
+        all_directories = directories;
+        saved_pass = pass;
+        size_t middle = (directories.size() + 1) / 2;
+        if (directories.size() > 1) {
+            auto begin = directories.begin() + (half == 0 ? 0 : middle);
+            auto end = half == 0 ? directories.begin() + middle : directories.end();
+            directories = std::vector<std::filesystem::path>(begin, end);
+        }
+        pass = 0;
+    }
+
+    // back to all directories and the pass before narrow
+    void widen() {
+        std::lock_guard<std::mutex> lock(mutex);
+        directories = std::move(all_directories);
+        all_directories.clear();
+        pass = saved_pass;
+    }
+
+    // the run was consumed, delete its file
+    void release(const std::string& name) {
+        std::error_code error;
+        std::filesystem::remove(name, error);
+        std::lock_guard<std::mutex> lock(mutex);
+        files.erase(name);
+    }
+
+    // the file was moved out of the scratch space and is not removed at the end
+    void forget(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        files.erase(name);
+    }
+
+private:
+    std::vector<std::filesystem::path> directories;
+    // the directories while narrowed
+    std::vector<std::filesystem::path> all_directories;
+    size_t saved_pass = 0;
+    std::mutex mutex;
+    std::set<std::string> files;
+    size_t next_id = 0;
+    size_t pass = 0;
+    // next directory of each half
+    size_t next_directory[2] = {0, 0};
+};
+
+// narrows scratch_space to one half while it lives, so it is widened again if the sort of the half throws
+class NarrowedScratch {
+public:
+    NarrowedScratch(ScratchSpace& scratch_space, size_t half) : scratch_space(scratch_space) {
+        scratch_space.narrow(half);
+    }
+
+    NarrowedScratch(const NarrowedScratch&) = delete;
+    NarrowedScratch& operator=(const NarrowedScratch&) = delete;
+
+    ~NarrowedScratch() {
+        scratch_space.widen();
+    }
+
+private:
+    ScratchSpace& scratch_space;
+};
+
+// options.temp_directories, or fallback if there are none
+inline std::vector<std::filesystem::path> scratch_directories(const SortOptions& options, const std::filesystem::path& fallback) {
+    std::vector<std::filesystem::path> directories(options.temp_directories.begin(), options.temp_directories.end());
+    if (directories.empty()) {
+        directories.push_back(fallback);
+    }
+    return directories;
+}
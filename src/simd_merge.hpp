@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <immintrin.h>
+
+#include "sort_config.hpp"
+
+/**
+ * vectorized merge of two sorted int64 arrays with a bitonic merge network
+ * the network merges one vector of each input, writes the lower half and keeps the upper half,
+ * the next vector is loaded from the input with the smaller head, so there is no branch per element
+ * the kernels are compiled for their instruction set with target attributes and picked at runtime,
+ * every sort resolves its SortOptions::simd with select_merge_int64 and passes the kernel down, so
+ * sorts with different levels can run at the same time
+ * there are only int64 kernels, u64 and u32 records are merged by the scalar merge
+ */
+
+// branchless scalar merge for the tails the vector loop leaves over
+inline void merge_int64_tail(const int64_t* a, const int64_t* a_end, const int64_t* b, const int64_t* b_end, int64_t* out) {
+    while (a < a_end && b < b_end) {
+        bool take_b = *b < *a;
+        *out++ = take_b ? *b : *a;
+        b += take_b;
+        a += !take_b;
+    }
+    while (a < a_end) *out++ = *a++;
+    while (b < b_end) *out++ = *b++;
+}
+
+// the vectors of the network are merged, carry holds the upper elements that were not written yet
+inline void merge_int64_finish(const int64_t* carry, size_t carry_size, const int64_t* a, const int64_t* a_end, const int64_t* b, const int64_t* b_end, int64_t* out) {
+    // the shorter rest has less than one vector, merge it with the carry first
+    if (a_end - a > b_end - b) {
+        std::swap(a, b);
+        std::swap(a_end, b_end);
+    }
+    int64_t small[16];
+    merge_int64_tail(carry, carry + carry_size, a, a_end, small);
+    merge_int64_tail(small, small + carry_size + (a_end - a), b, b_end, out);
+}
+
+__attribute__((target("avx2")))
+inline void minmax_avx2(__m256i& low, __m256i& high) {
+    __m256i greater = _mm256_cmpgt_epi64(low, high);
+    __m256i min = _mm256_blendv_epi8(low, high, greater);
+    high = _mm256_blendv_epi8(high, low, greater);
+    low = min;
+}
+
+// sort a bitonic sequence of four
+__attribute__((target("avx2")))
+inline __m256i bitonic_clean_avx2(__m256i v) {
+    __m256i low = v;
+    __m256i high = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+    minmax_avx2(low, high);
+    v = _mm256_blend_epi32(low, high, 0xF0);
+    low = v;
+    high = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 3, 0, 1));
+    minmax_avx2(low, high);
+    return _mm256_blend_epi32(low, high, 0xCC);
+}
+
+// a and b sorted, afterwards a holds the lower and b the upper four of the eight elements, both sorted
+__attribute__((target("avx2")))
+inline void bitonic_merge_avx2(__m256i& a, __m256i& b) {
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 1, 2, 3));
+    minmax_avx2(a, b);
+    a = bitonic_clean_avx2(a);
+    b = bitonic_clean_avx2(b);
+}
+
+__attribute__((target("avx2")))
+inline void merge_int64_avx2(const int64_t* a, const int64_t* a_end, const int64_t* b, const int64_t* b_end, int64_t* out) {
+    const ptrdiff_t lanes = 4;
+    if (a_end - a < lanes || b_end - b < lanes) {
+        merge_int64_tail(a, a_end, b, b_end, out);
+        return;
+    }
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+    a += lanes;
+    b += lanes;
+    bitonic_merge_avx2(low, high);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), low);
+    out += lanes;
+    while (a_end - a >= lanes && b_end - b >= lanes) {
+        bool take_b = *b < *a;
+        low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(take_b ? b : a));
+        b += take_b * lanes;
+        a += !take_b * lanes;
+        bitonic_merge_avx2(low, high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), low);
+        out += lanes;
+    }
+    int64_t carry[lanes];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(carry), high);
+    merge_int64_finish(carry, lanes, a, a_end, b, b_end, out);
+}
+
+// sort a bitonic sequence of eight
+__attribute__((target("avx512f")))
+inline __m512i bitonic_clean_avx512(__m512i v) {
+    const __m512i swap_4 = _mm512_set_epi64(3, 2, 1, 0, 7, 6, 5, 4);
+    const __m512i swap_2 = _mm512_set_epi64(5, 4, 7, 6, 1, 0, 3, 2);
+    const __m512i swap_1 = _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+    __m512i other = _mm512_permutexvar_epi64(swap_4, v);
+    v = _mm512_mask_blend_epi64(0xF0, _mm512_min_epi64(v, other), _mm512_max_epi64(v, other));
+    other = _mm512_permutexvar_epi64(swap_2, v);
+    v = _mm512_mask_blend_epi64(0xCC, _mm512_min_epi64(v, other), _mm512_max_epi64(v, other));
+    other = _mm512_permutexvar_epi64(swap_1, v);
+    return _mm512_mask_blend_epi64(0xAA, _mm512_min_epi64(v, other), _mm512_max_epi64(v, other));
+}
+
+__attribute__((target("avx512f")))
+inline void bitonic_merge_avx512(__m512i& a, __m512i& b) {
+    const __m512i reverse = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    b = _mm512_permutexvar_epi64(reverse, b);
+    __m512i low = _mm512_min_epi64(a, b);
+    __m512i high = _mm512_max_epi64(a, b);
+    a = bitonic_clean_avx512(low);
+    b = bitonic_clean_avx512(high);
+}
+
+__attribute__((target("avx512f")))
+inline void merge_int64_avx512(const int64_t* a, const int64_t* a_end, const int64_t* b, const int64_t* b_end, int64_t* out) {
+    const ptrdiff_t lanes = 8;
+    if (a_end - a < lanes || b_end - b < lanes) {
+        merge_int64_tail(a, a_end, b, b_end, out);
+        return;
+    }
+    __m512i low = _mm512_loadu_si512(a);
+    __m512i high = _mm512_loadu_si512(b);
+    a += lanes;
+    b += lanes;
+    bitonic_merge_avx512(low, high);
+    _mm512_storeu_si512(out, low);
+    out += lanes;
+    while (a_end - a >= lanes && b_end - b >= lanes) {
+        bool take_b = *b < *a;
+        low = _mm512_loadu_si512(take_b ? b : a);
+        b += take_b * lanes;
+        a += !take_b * lanes;
+        bitonic_merge_avx512(low, high);
+        _mm512_storeu_si512(out, low);
+        out += lanes;
+    }
+    int64_t carry[lanes];
+    _mm512_storeu_si512(carry, high);
+    merge_int64_finish(carry, lanes, a, a_end, b, b_end, out);
+}
+
+using MergeInt64 = void (*)(const int64_t*, const int64_t*, const int64_t*, const int64_t*, int64_t*);
+
+// the widest kernel up to level that the CPU supports, nullptr for the generic scalar merge
+// the kernel merges signed keys, so it is only used for int64 records
+inline MergeInt64 select_merge_int64(SimdLevel level) {
+    __builtin_cpu_init();
+    bool any = level == SimdLevel::automatic;
+    if ((any || level == SimdLevel::avx512) && __builtin_cpu_supports("avx512f")) {
+        return merge_int64_avx512;
+    }
+    if ((any || level == SimdLevel::avx512 || level == SimdLevel::avx2) && __builtin_cpu_supports("avx2")) {
+        return merge_int64_avx2;
+    }
+    return nullptr;
+}
+
+inline const char* merge_int64_name(MergeInt64 kernel) {
+    if (kernel == merge_int64_avx512) return "avx512";
+    if (kernel == merge_int64_avx2) return "avx2";
+    return "scalar";
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "record.hpp"
+
+// sorted run, stored in a file of its own
+struct Run {
+    std::string file;
+    size_t elements;
+    // hash of the records, kept with a checkpoint so that a resumed sort can check the run
+    MultisetHash hash{};
+};
+
+// largest block for a memory size: a merge of two ways holds two blocks of every way and two output blocks,
+// a larger block would push even the smallest merge over the memory
+inline size_t max_block_size(size_t internal_memory_size) {
+    return internal_memory_size / 6;
+}
+
+// runs and merge passes, or sampled key range buckets that are sorted one by one
+enum class SortStrategy {
+    merge,
+    distribution
+};
+
+enum class RunGeneration {
+    sort,
+    replacement_selection
+};
+
+enum class SortAlgorithm {
+    merge,
+    radix
+};
+
+// instruction set of the int64 merge kernel, automatic picks the widest one the CPU has
+enum class SimdLevel {
+    automatic,
+    scalar,
+    avx2,
+    avx512
+};
+
+enum class IoBackend {
+    stream,
+    pread,
+    mmap,
+    direct
+};
+
+// order of the sorted output, descending sorts by RecordGreater
+enum class SortOrder {
+    ascending,
+    descending
+};
+
+// tuning knobs of sort-external that are given as --name=value after the positional arguments
+struct SortOptions {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    SortStrategy strategy = SortStrategy::merge;
+    SortAlgorithm sort_algorithm = SortAlgorithm::merge;
+    RunGeneration run_generation = RunGeneration::sort;
+    IoBackend io_backend = IoBackend::pread;
+    // directories of the temporary run files, one per drive (see ScratchSpace), none for the directory of the output file
+    std::vector<std::string> temp_directories;
+    SimdLevel simd = SimdLevel::automatic;
+    // store runs in compressed frames, delta coded for plain numbers and xor coded for other records
+    bool compress_runs = false;
+    // keep only the first limit records of the sorted output (the smallest ones), SIZE_MAX for all of them
+    size_t limit = SIZE_MAX;
+    // a descending sort has no radix key and no SIMD merge kernel, the records are compared through RecordGreater
+    SortOrder order = SortOrder::ascending;
+    // check in one streaming pass that the output is sorted and holds the records of the input
+    bool verify = true;
+    // manifest of finished runs that lets a sort that died go on from there, empty for none
+    std::string checkpoint;
+    // print the progress to std::cerr every progress_seconds, 0 for no progress output
+    double progress_seconds = 0;
+};
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "record.hpp"
+#include "simd_merge.hpp"
+
+// the comparison result selects the source pointer instead of a branch, which compiles to cmov
+template <typename Record>
+void merge_scalar(const Record* a, const Record* a_end, const Record* b, const Record* b_end, Record* out) {
+    while (a < a_end && b < b_end) {
+        bool take_b = RecordTraits<Record>::less(*b, *a);
+        *out++ = *(take_b ? b : a);
+        b += take_b;
+        a += !take_b;
+    }
+    out = std::copy(a, a_end, out);
+    std::copy(b, b_end, out);
+}
+
+// int64 records are merged by the vectorized kernel if there is one (see select_merge_int64), other records ignore it
+template <typename Record>
+void merge(const Record* a, const Record* a_end, const Record* b, const Record* b_end, Record* out, MergeInt64 kernel) {
+    if constexpr (std::is_same_v<Record, int64_t>) {
+        if (kernel != nullptr) {
+            kernel(a, a_end, b, b_end, out);
+            return;
+        }
+    }
+    merge_scalar(a, a_end, b, b_end, out);
+}
+
+template <typename Record>
+void insertion_sort(Record* nums, size_t size) {
+    for (size_t i = 1; i < size; i++) {
+        Record value = nums[i];
+        size_t j = i;
+        while (j > 0 && RecordTraits<Record>::less(value, nums[j - 1])) {
+            nums[j] = nums[j - 1];
+            j--;
+        }
+        nums[j] = value;
+    }
+}
+
+// length of the ascending (non-decreasing) run at the start of nums[0, size)
+template <typename Record>
+size_t ascending_prefix(const Record* nums, size_t size) {
+    size_t end = std::min<size_t>(1, size);
+    while (end < size && !RecordTraits<Record>::less(nums[end], nums[end - 1])) {
+        end++;
+    }
+    return end;
+}
+
+// length of the strictly descending run at the start of nums[0, size), strict so that reversing it is stable
+template <typename Record>
+size_t descending_prefix(const Record* nums, size_t size) {
+    size_t end = std::min<size_t>(1, size);
+    while (end < size && RecordTraits<Record>::less(nums[end], nums[end - 1])) {
+        end++;
+    }
+    return end;
+}
+
+/**
+ * natural merge sort of nums[0, size) like timsort: the ascending and descending runs already in the input
+ * are found first, descending ones are reversed and runs shorter than min_run are extended by insertion sort,
+ * then neighbouring runs are merged in passes that ping-pong between nums and scratch,
+ * which has to hold at least size elements, int64 runs are merged with kernel
+ * random input gives the fixed min_run blocks of a bottom up merge sort, sorted input is one pass over it
+ */
+template <typename Record>
+void merge_sort(Record* nums, Record* scratch, size_t size, MergeInt64 kernel) {
+    const size_t min_run = 32;
+    std::vector<size_t> bounds{0};
+    for (size_t start = 0; start < size;) {
+        size_t length = ascending_prefix(nums + start, size - start);
+        if (length == 1) {
+            length = descending_prefix(nums + start, size - start);
+            std::reverse(nums + start, nums + start + length);
+        }
+        if (length < min_run) {
+            length = std::min(min_run, size - start);
+            insertion_sort(nums + start, length);
+        }
+        start += length;
+        bounds.push_back(start);
+    }
+
+    Record* src = nums;
+    Record* dst = scratch;
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged_bounds;
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            merged_bounds.push_back(bounds[i]);
+            size_t left = bounds[i];
+            size_t mid = bounds[i + 1];
+            size_t right = i + 2 < bounds.size() ? bounds[i + 2] : mid;
+            if (right == mid || !RecordTraits<Record>::less(src[mid], src[mid - 1])) {
+                // runs that are already in order, and an odd run without partner, are only copied
+                std::copy(src + left, src + right, dst + left);
+            } else {
+                merge(src + left, src + mid, src + mid, src + right, dst + left, kernel);
+            }
+        }
+        merged_bounds.push_back(size);
+        bounds = std::move(merged_bounds);
+        std::swap(src, dst);
+    }
+    if (src != nums) {
+        std::copy(src, src + size, nums);
+    }
+}
+
+/**
+ * LSD radix sort of nums[0, size) on 11 bit digits of RecordTraits<Record>::radix_key,
+ * scratch has to hold at least size elements, short inputs are merge sorted with kernel
+ * the histograms of all digits are counted in one pass and digits every element shares are skipped
+ */
+template <typename Record>
+void radix_sort(Record* nums, Record* scratch, size_t size, MergeInt64 kernel) {
+    using Traits = RecordTraits<Record>;
+    static_assert(Traits::radix_bits > 0, "radix sort needs an integer key");
+    const unsigned digit_bits = 11;
+    const size_t buckets = size_t(1) << digit_bits;
+    const unsigned passes = (Traits::radix_bits + digit_bits - 1) / digit_bits;
+    const size_t prefetch_distance = 64;
+    if (size < 256) {
+        merge_sort(nums, scratch, size, kernel);
+        return;
+    }
+
+    auto digit = [](uint64_t key, unsigned pass) { return (key >> (pass * digit_bits)) & (buckets - 1); };
+
+    std::array<std::array<size_t, buckets>, passes> counts{};
+    for (size_t i = 0; i < size; i++) {
+        uint64_t k = Traits::radix_key(nums[i]);
+        for (unsigned pass = 0; pass < passes; pass++) {
+            counts[pass][digit(k, pass)]++;
+        }
+    }
+
+    Record* src = nums;
+    Record* dst = scratch;
+    for (unsigned pass = 0; pass < passes; pass++) {
+        std::array<size_t, buckets>& offsets = counts[pass];
+        if (offsets[digit(Traits::radix_key(src[0]), pass)] == size) {
+            continue;
+        }
+        size_t sum = 0;
+        for (auto& offset : offsets) {
+            size_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < size; i++) {
+            __builtin_prefetch(src + i + prefetch_distance);
+            const Record& value = src[i];
+            dst[offsets[digit(Traits::radix_key(value), pass)]++] = value;
+        }
+        std::swap(src, dst);
+    }
+    if (src != nums) {
+        std::copy(src, src + size, nums);
+    }
+}
+
+// run every task on its own thread, the calling thread takes the first one
+inline void run_parallel(std::vector<std::function<void()>>& tasks) {
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < tasks.size(); i++) {
+        workers.emplace_back(tasks[i]);
+    }
+    if (!tasks.empty()) {
+        tasks[0]();
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * number of elements taken from a (the rest from b) for the first diagonal elements of merge(a, b)
+ * this is the merge path split that lets several threads merge disjoint parts of one output
+ */
+template <typename Record>
+size_t co_rank(const Record* a, size_t a_size, const Record* b, size_t b_size, size_t diagonal) {
+    size_t low = diagonal > b_size ? diagonal - b_size : 0;
+    size_t high = std::min(diagonal, a_size);
+    while (low < high) {
+        size_t i = low + (high - low) / 2;
+        size_t j = diagonal - i;
+        if (j > 0 && i < a_size && !RecordTraits<Record>::less(b[j - 1], a[i])) {
+            low = i + 1;
+        } else {
+            high = i;
+        }
+    }
+    return low;
+}
+
+/**
+ * sort nums[begin, end) with up to threads threads
+ * every thread sorts a slice with sort_slice, then neighbouring slices are merged into scratch and back,
+ * each merge being split across the threads along its merge path, int64 slices are merged with kernel
+ */
+template <typename Record, typename Allocator>
+void parallel_sort(std::vector<Record, Allocator>& nums, std::vector<Record, Allocator>& scratch, size_t begin, size_t end, size_t threads, void (*sort_slice)(Record*, Record*, size_t, MergeInt64), MergeInt64 kernel) {
+    const size_t min_slice_elements = 1 << 14;
+    size_t size = end - begin;
+    size_t slices = std::max<size_t>(1, std::min(threads, size / min_slice_elements));
+    std::vector<size_t> bounds(slices + 1);
+    for (size_t i = 0; i <= slices; i++) {
+        bounds[i] = begin + size * i / slices;
+    }
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < slices; i++) {
+        size_t left = bounds[i];
+        size_t right = bounds[i + 1];
+        tasks.push_back([&nums, &scratch, left, right, sort_slice, kernel] {
+            sort_slice(nums.data() + left, scratch.data() + left, right - left, kernel);
+        });
+    }
+    run_parallel(tasks);
+
+    std::vector<Record, Allocator>* src = &nums;
+    std::vector<Record, Allocator>* dst = &scratch;
+    while (bounds.size() > 2) {
+        size_t pairs = (bounds.size() - 1) / 2;
+        size_t parts = std::max<size_t>(1, threads / pairs);
+        std::vector<size_t> merged_bounds;
+        tasks.clear();
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            merged_bounds.push_back(bounds[i]);
+            const Record* a = src->data() + bounds[i];
+            Record* out = dst->data() + bounds[i];
+            if (i + 2 >= bounds.size()) {
+                // odd slice without partner is carried over
+                size_t count = bounds[i + 1] - bounds[i];
+                tasks.push_back([a, out, count] { std::copy(a, a + count, out); });
+                continue;
+            }
+            size_t a_size = bounds[i + 1] - bounds[i];
+            const Record* b = src->data() + bounds[i + 1];
+            size_t b_size = bounds[i + 2] - bounds[i + 1];
+            for (size_t part = 0; part < parts; part++) {
+                size_t first = (a_size + b_size) * part / parts;
+                size_t last = (a_size + b_size) * (part + 1) / parts;
+                tasks.push_back([a, a_size, b, b_size, out, first, last, kernel] {
+                    size_t a_first = co_rank(a, a_size, b, b_size, first);
+                    size_t a_last = co_rank(a, a_size, b, b_size, last);
+                    merge(a + a_first, a + a_last, b + (first - a_first), b + (last - a_last), out + first, kernel);
+                });
+            }
+        }
+        merged_bounds.push_back(bounds.back());
+        run_parallel(tasks);
+        bounds = std::move(merged_bounds);
+        std::swap(src, dst);
+    }
+    if (src != &nums) {
+        if (begin == 0) {
+            std::swap(nums, scratch);
+        } else {
+            // nums[0, begin) is not in scratch
+            std::copy(scratch.begin() + begin, scratch.begin() + end, nums.begin() + begin);
+        }
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "record.hpp"
+
+// bytes moved by all files of the process, a sort reports the difference between its start and end
+struct IoCounters {
+    std::atomic<size_t> bytes_read{0};
+    std::atomic<size_t> bytes_written{0};
+};
+
+inline IoCounters io_counters;
+
+using StatsClock = std::chrono::steady_clock;
+
+inline double seconds_since(StatsClock::time_point start) {
+    return std::chrono::duration<double>(StatsClock::now() - start).count();
+}
+
+// wait for an I/O request, the time spent waiting is a stall of the sorting or merging thread
+inline void wait_io(std::future<void>& request, double& stall_seconds) {
+    auto start = StatsClock::now();
+    request.get();
+    stall_seconds += seconds_since(start);
+}
+
+/**
+ * counters of one phase of the sort, the run generation or one merge pass
+ * read and write seconds are the busy time of the I/O threads, the stalls are the time the
+ * sorting or merging thread waited for them: a phase with long stalls is bound by the disk,
+ * one with short stalls and long sort seconds (or many comparisons) by the CPU
+ * a parallel merge adds up the busy and stall times of all its threads
+ */
+struct PhaseStats {
+    std::string name;
+    size_t runs_in = 0;
+    size_t runs_out = 0;
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+    size_t comparisons = 0;
+    double seconds = 0;
+    double read_seconds = 0;
+    double write_seconds = 0;
+    double sort_seconds = 0;
+    double read_stall_seconds = 0;
+    double write_stall_seconds = 0;
+};
+
+// what one external sort did, filled in by sort_file_external
+struct SortStats {
+    // runs, or buckets of a distribution sort
+    size_t runs = 0;
+    bool distribution = false;
+    // buckets that did not fit into memory and were merge sorted
+    size_t merged_buckets = 0;
+    // runs an earlier attempt left in the checkpoint
+    size_t resumed_runs = 0;
+    size_t fan_in = 0;
+    // records of the input and of the output, fewer with options.limit
+    size_t input_records = 0;
+    size_t output_records = 0;
+    // the limit fit into memory and was selected with a heap in one pass, there are no runs
+    bool selected = false;
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+    double seconds = 0;
+    PhaseStats run_generation;
+    std::vector<PhaseStats> merge_passes;
+    // hash of the records the run generation read, the output has to match it
+    MultisetHash input_hash;
+    bool verified = false;
+    double verify_seconds = 0;
+};
+
+// one line per phase, sizes in MB and times in seconds
+inline void print_stats(std::ostream& out, const SortStats& stats) {
+    const double MB = 1024.0 * 1024.0;
+    if (stats.resumed_runs > 0) {
+        out << "resumed from a checkpoint with " << stats.resumed_runs << " runs" << std::endl;
+    }
+    if (stats.output_records < stats.input_records) {
+        out << "output: the first " << stats.output_records << " of " << stats.input_records << " sorted records" << std::endl;
+    }
+    if (stats.selected) {
+        out << "selected in one pass with a heap of " << stats.output_records << " records" << std::endl;
+    } else if (stats.distribution) {
+        out << "buckets: " << stats.runs << " (" << stats.merged_buckets << " too large for memory, merge sorted)" << std::endl;
+    } else {
+        out << "initial partitions: " << stats.runs << std::endl;
+        out << "merge passes: " << stats.merge_passes.size() << " (fan-in " << stats.fan_in << ")" << std::endl;
+    }
+    out << std::left << std::setw(16) << "phase" << std::right
+        << std::setw(8) << "runs" << std::setw(10) << "seconds" << std::setw(10) << "read MB" << std::setw(10) << "write MB"
+        << std::setw(9) << "read s" << std::setw(9) << "write s" << std::setw(9) << "sort s"
+        << std::setw(14) << "read stall s" << std::setw(15) << "write stall s" << std::setw(14) << "comparisons" << std::endl;
+    // runs in > runs out, the run generation only has runs out
+    auto runs = [](const PhaseStats& phase) {
+        std::string out = std::to_string(phase.runs_out);
+        return phase.runs_in > 0 ? std::to_string(phase.runs_in) + ">" + out : out;
+    };
+    auto print_phase = [&](const PhaseStats& phase) {
+        out << std::left << std::setw(16) << phase.name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(8) << runs(phase) << std::setw(10) << phase.seconds
+            << std::setw(10) << std::setprecision(1) << phase.bytes_read / MB << std::setw(10) << phase.bytes_written / MB
+            << std::setprecision(3) << std::setw(9) << phase.read_seconds << std::setw(9) << phase.write_seconds
+            << std::setw(9) << phase.sort_seconds << std::setw(14) << phase.read_stall_seconds
+            << std::setw(15) << phase.write_stall_seconds << std::setw(14) << phase.comparisons << std::endl;
+        out << std::defaultfloat;
+    };
+    print_phase(stats.run_generation);
+    for (const PhaseStats& pass : stats.merge_passes) {
+        print_phase(pass);
+    }
+    out << "bytes read: " << stats.bytes_read << ", bytes written: " << stats.bytes_written << std::endl;
+    if (stats.verified) {
+        if (stats.output_records < stats.input_records) {
+            out << "output verified: sorted and " << stats.output_records << " records (";
+        } else {
+            out << "output verified: sorted and the same " << stats.input_hash.count << " records as the input (";
+        }
+        out << std::fixed << std::setprecision(3) << stats.verify_seconds << " s)" << std::defaultfloat << std::endl;
+    }
+}
+
+inline void print_stats_json(std::ostream& out, const SortStats& stats) {
+    auto print_phase = [&](const PhaseStats& phase) {
+        out << "{\"name\": \"" << phase.name << "\", \"runs_in\": " << phase.runs_in << ", \"runs_out\": " << phase.runs_out
+            << ", \"seconds\": " << phase.seconds << ", \"bytes_read\": " << phase.bytes_read << ", \"bytes_written\": " << phase.bytes_written
+            << ", \"read_seconds\": " << phase.read_seconds << ", \"write_seconds\": " << phase.write_seconds
+            << ", \"sort_seconds\": " << phase.sort_seconds << ", \"read_stall_seconds\": " << phase.read_stall_seconds
+            << ", \"write_stall_seconds\": " << phase.write_stall_seconds << ", \"comparisons\": " << phase.comparisons << "}";
+    };
+    out << "{\"runs\": " << stats.runs << ", \"distribution\": " << (stats.distribution ? "true" : "false")
+        << ", \"merged_buckets\": " << stats.merged_buckets << ", \"selected\": " << (stats.selected ? "true" : "false")
+        << ", \"input_records\": " << stats.input_records << ", \"output_records\": " << stats.output_records << ", \"resumed_runs\": " << stats.resumed_runs << ", \"fan_in\": " << stats.fan_in << ", \"seconds\": " << stats.seconds
+        << ", \"bytes_read\": " << stats.bytes_read << ", \"bytes_written\": " << stats.bytes_written
+        << ", \"verified\": " << (stats.verified ? "true" : "false") << ", \"verify_seconds\": " << stats.verify_seconds << ",\n \"run_generation\": ";
+    print_phase(stats.run_generation);
+    out << ",\n \"merge_passes\": [";
+    for (size_t i = 0; i < stats.merge_passes.size(); i++) {
+        out << (i == 0 ? "\n  " : ",\n  ");
+        print_phase(stats.merge_passes[i]);
+    }
+    out << "]}" << std::endl;
+}
+
+/**
+ * prints the current phase and the bytes it moved to std::cerr every interval, for long sorts
+ * the numbers come from io_counters, so reporting costs the sort nothing
+ */
+class ProgressReporter {
+public:
+    ProgressReporter(double interval_seconds, size_t total_bytes)
+        : interval(interval_seconds), total_bytes(total_bytes), worker([this] { run(); }) {}
+
+    ~ProgressReporter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+    void phase(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        phase_name = name;
+        phase_start = StatsClock::now();
+        phase_read = io_counters.bytes_read;
+        phase_written = io_counters.bytes_written;
+    }
+
+private:
+    std::chrono::duration<double> interval;
+    size_t total_bytes;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::string phase_name = "starting";
+    StatsClock::time_point phase_start = StatsClock::now();
+    size_t phase_read = io_counters.bytes_read;
+    size_t phase_written = io_counters.bytes_written;
+    std::thread worker;
+
+    void run() {
+        const double MB = 1024.0 * 1024.0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cv.wait_for(lock, interval, [this] { return stopping; })) {
+            double seconds = seconds_since(phase_start);
+            double read = (io_counters.bytes_read - phase_read) / MB;
+            double written = (io_counters.bytes_written - phase_written) / MB;
+            std::cerr << "progress: " << phase_name << ", " << std::fixed << std::setprecision(1) << seconds << " s, "
+                      << read << " MB read, " << written << " MB written";
+            // the size of a pipe is not known in advance
+            if (total_bytes != SIZE_MAX) {
+                std::cerr << " of " << total_bytes / MB << " MB";
+            }
+            std::cerr << ", " << (seconds > 0 ? std::max(read, written) / seconds : 0) << " MB/s" << std::defaultfloat << std::endl;
+        }
+    }
+};
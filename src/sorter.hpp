@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "buffer.hpp"
+#include "external_merge.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_codec.hpp"
+#include "run_generation.hpp"
+#include "scratch.hpp"
+#include "simd_merge.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+/**
+ * external sort for a program that produces and consumes the records itself, without input and output files
+ * records are pushed in batches, every internal_memory_size / 4 of them are sorted and written to a run
+ * in the temporary directory in the background while the next ones are pushed
+ * the first pull ends the input: if everything fit into memory it is sorted there and no file is written,
+ * otherwise the runs are merged until one merge of at most fan_in runs is left, which is streamed to the caller
+ *
+ *   Sorter<int64_t> sorter(256 << 20, 4 << 20, options);
+ *   sorter.push(batch.data(), batch.size());
+ *   for (int64_t value : sorter) ...
+ *
+ * the block size is lowered to max_block_size(internal_memory_size) if it is larger
+ * the comparator is a type, so the comparisons stay inline like those of RecordTraits, a descending order is
+ * Less = RecordGreater<Record> and not options.order, which throws std::invalid_argument
+ * errors are thrown as std::runtime_error
+ */
+template <typename Record, typename Less = RecordLess<Record>>
+class Sorter {
+    // with a comparator of its own the records are sorted as OrderedBy, which has the same layout
+    using Stored = std::conditional_t<std::is_same_v<Less, RecordLess<Record>>, Record, OrderedBy<Record, Less>>;
+
+public:
+    class iterator;
+
+    Sorter(size_t internal_memory_size, size_t block_size, SortOptions sort_options = SortOptions())
+        : internal_memory_size(internal_memory_size), block_size(std::min(block_size, max_block_size(internal_memory_size))), options(std::move(sort_options)),
+          scratch_space(scratch_directories(options, std::filesystem::temp_directory_path())),
+          chunk_elements(aligned_elements<Stored>(internal_memory_size / 4)),
+          filling(chunk_elements), in_flight(chunk_elements), scratch(chunk_elements),
+          measurement({}, {&writer}) {
+        if (options.order != SortOrder::ascending) {
+            throw std::invalid_argument("a Sorter sorts by its comparator, use RecordGreater for a descending order");
+        }
+        stats.run_generation.name = "run generation";
+    }
+
+    Sorter(const Sorter&) = delete;
+    Sorter& operator=(const Sorter&) = delete;
+
+    void push(const Record* records, size_t count) {
+        if (finished) {
+            throw std::logic_error("records pushed after the sorted output was pulled");
+        }
+        while (count > 0) {
+            size_t take = std::min(count, chunk_elements - filled);
+            for (size_t i = 0; i < take; i++) {
+                filling[filled + i] = wrap(records[i]);
+            }
+            filled += take;
+            records += take;
+            count -= take;
+            if (filled == chunk_elements) {
+                write_run();
+            }
+        }
+    }
+
+    void push(const std::vector<Record>& records) {
+        push(records.data(), records.size());
+    }
+
+    // copy up to max records of the sorted output into out, returns how many, 0 once everything was pulled
+    // (or the first options.limit records)
+    size_t pull(Record* out, size_t max) {
+        finish();
+        max = std::min(max, options.limit - pulled);
+        size_t n = 0;
+        if (stream) {
+            Stored record;
+            while (n < max && stream->next(record)) {
+                out[n++] = unwrap(record);
+            }
+        } else {
+            while (n < max && position < filled) {
+                out[n++] = unwrap(filling[position++]);
+            }
+        }
+        pulled += n;
+        return n;
+    }
+
+    iterator begin() {
+        return iterator(this);
+    }
+
+    iterator end() {
+        return iterator();
+    }
+
+    // run generation and merge passes so far, complete once the input is finished
+    const SortStats& sort_stats() const {
+        return stats;
+    }
+
+private:
+    size_t internal_memory_size;
+    size_t block_size;
+    SortOptions options;
+    ScratchSpace scratch_space;
+    size_t chunk_elements;
+    Buffer<Stored> filling;
+    Buffer<Stored> in_flight;
+    Buffer<Stored> scratch;
+    size_t filled = 0;
+    size_t position = 0;
+    size_t pulled = 0;
+    bool finished = false;
+    std::vector<Run> runs;
+    SortStats stats;
+    std::unique_ptr<MergeStream<Stored>> stream;
+    IoThread writer;
+    std::future<void> writing;
+    PhaseMeasurement measurement;
+
+    static Stored wrap(const Record& record) {
+        if constexpr (std::is_same_v<Stored, Record>) {
+            return record;
+        } else {
+            return Stored{record};
+        }
+    }
+
+    static const Record& unwrap(const Stored& record) {
+        if constexpr (std::is_same_v<Stored, Record>) {
+            return record;
+        } else {
+            return record.record;
+        }
+    }
+
+    // sort the filled buffer and write it to a new run while the other buffer is filled
+    void write_run() {
+        auto sort_start = StatsClock::now();
+        sort_internal(filling, scratch, 0, filled, options);
+        stats.run_generation.sort_seconds += seconds_since(sort_start);
+        if (writing.valid()) {
+            wait_io(writing, stats.run_generation.write_stall_seconds);
+        }
+
+        std::swap(filling, in_flight);
+        runs.push_back(Run{scratch_space.create_name(), filled});
+        std::string file = runs.back().file;
+        size_t elements = filled;
+        size_t block_elements = aligned_elements<Stored>(block_size);
+        writing = writer.submit([this, file, elements, block_elements] {
+            std::unique_ptr<File> output = run_create<Stored>(file, options);
+            write_chunk(*output, in_flight.data(), 0, elements, block_elements);
+            output->close();
+        });
+        filled = 0;
+    }
+
+    void finish() {
+        if (finished) return;
+        finished = true;
+        if (runs.empty()) {
+            // everything fit into memory
+            auto sort_start = StatsClock::now();
+            sort_internal(filling, scratch, 0, filled, options);
+            stats.run_generation.sort_seconds += seconds_since(sort_start);
+            measurement.finish(stats.run_generation);
+            return;
+        }
+        if (filled > 0) {
+            write_run();
+        }
+        wait_io(writing, stats.run_generation.write_stall_seconds);
+        measurement.finish(stats.run_generation);
+        stats.runs = runs.size();
+        stats.run_generation.runs_out = runs.size();
+        // the merge gets the memory of the run buffers
+        Buffer<Stored>().swap(filling);
+        Buffer<Stored>().swap(in_flight);
+        Buffer<Stored>().swap(scratch);
+
+        MergePasses<Stored> passes(scratch_space, internal_memory_size, block_size, options, stats, nullptr);
+        runs = passes.reduce(std::move(runs));
+        stats.fan_in = passes.fan_in;
+        stream = std::make_unique<MergeStream<Stored>>(runs, aligned_elements<Stored>(block_size), options);
+    }
+};
+
+// input iterator over the sorted output, every step pulls one record
+template <typename Record, typename Less>
+class Sorter<Record, Less>::iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Record;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Record*;
+    using reference = const Record&;
+
+    // the end of the output
+    iterator() = default;
+
+    explicit iterator(Sorter* sorter) : sorter(sorter) {
+        ++*this;
+    }
+
+    reference operator*() const {
+        return current;
+    }
+
+    pointer operator->() const {
+        return &current;
+    }
+
+    iterator& operator++() {
+        if (sorter->pull(&current, 1) == 0) {
+            sorter = nullptr;
+        }
+        return *this;
+    }
+
+    void operator++(int) {
+        ++*this;
+    }
+
+    bool operator==(const iterator& other) const {
+        return sorter == other.sorter;
+    }
+
+private:
+    Sorter* sorter = nullptr;
+    Record current{};
+};
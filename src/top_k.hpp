@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "buffer.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+// heap entry of select_smallest, equal records are ordered by their position in the input
+template <typename Record>
+struct SelectedRecord {
+    Record record;
+    size_t index;
+
+    bool operator<(const SelectedRecord& other) const {
+        return RecordTraits<Record>::less(record, other.record) || (!RecordTraits<Record>::less(other.record, record) && index < other.index);
+    }
+};
+
+// options.limit heap entries fit into half the memory, then they are selected in one pass over the input instead of sorting it
+template <typename Record>
+bool selects_in_memory(size_t internal_memory_size, const SortOptions& options) {
+    return options.limit <= internal_memory_size / 2 / sizeof(SelectedRecord<Record>);
+}
+
+// put entry in place of the largest entry of the max-heap heap[0, size) and sift it down
+template <typename Record>
+void replace_heap_top(SelectedRecord<Record>* heap, size_t size, const SelectedRecord<Record>& entry) {
+    size_t hole = 0;
+    for (size_t child = 1; child < size; child = 2 * hole + 1) {
+        if (child + 1 < size && heap[child] < heap[child + 1]) {
+            child++;
+        }
+        if (!(entry < heap[child])) break;
+        heap[hole] = heap[child];
+        hole = child;
+    }
+    heap[hole] = entry;
+}
+
+/**
+ * the first options.limit records of the sorted input in one streaming pass, for a limit that fits into memory
+ * (see selects_in_memory): a max-heap holds the smallest records seen so far with the largest of them on top,
+ * a record that is not smaller than the top is passed over after one comparison, which is almost every record
+ * of a long input; at the end the heap is sorted and written to out_filename
+ * of records with equal keys the ones that came first are kept, in input order: the heap orders them by their index,
+ * a later record equal to the top is passed over and an earlier one is evicted last
+ * the input is read in double buffered blocks, a pipe until it ends
+ * if options.verify is set, the records are added to input_hash
+ * returns the number of records of the input
+ */
+template <typename Record>
+size_t select_smallest(File& input, size_t file_size, const std::string& out_filename, size_t internal_memory_size, size_t block_size, const SortOptions& options, PhaseStats& phase, MultisetHash& input_hash) {
+    size_t block_elements = aligned_elements<Record>(std::min(block_size, internal_memory_size / 8));
+    size_t limit = options.limit;
+    Buffer<SelectedRecord<Record>> heap(limit);
+    size_t size = 0;
+    size_t elements = 0;
+
+    IoThread reader;
+    IoThread writer;
+    PhaseMeasurement measurement({&reader}, {&writer});
+    MergeSource<Record> source;
+    source.block_elements = block_elements;
+    source.end_element_file = file_size == unknown_size ? unknown_size : whole_records<Record>(file_size, "input");
+    source.request(reader, input);
+    while (source.refill(reader, input)) {
+        const Record* records = source.data;
+        size_t i = 0;
+        for (; i < source.filled && size < limit; i++) {
+            heap[size++] = SelectedRecord<Record>{records[i], elements + i};
+            std::push_heap(heap.data(), heap.data() + size);
+        }
+        // a record equal to the top came after it and is passed over like a larger one
+        for (; i < source.filled && size > 0; i++) {
+            if (RecordTraits<Record>::less(records[i], heap[0].record)) {
+                replace_heap_top(heap.data(), size, SelectedRecord<Record>{records[i], elements + i});
+            }
+        }
+        if (options.verify) {
+            input_hash.add(records, source.filled);
+        }
+        elements += source.filled;
+    }
+    auto sort_start = StatsClock::now();
+    std::sort_heap(heap.data(), heap.data() + size);
+    double sort_seconds = seconds_since(sort_start);
+
+    // the records leave the heap entries through one block
+    std::unique_ptr<File> output = file_create(out_filename, options.io_backend);
+    std::future<void> writing = writer.submit([&output, &heap, size, block_elements] {
+        Buffer<Record> block(block_elements);
+        for (size_t start = 0; start < size; start += block_elements) {
+            size_t count = std::min(block_elements, size - start);
+            for (size_t i = 0; i < count; i++) {
+                block[i] = heap[start + i].record;
+            }
+            write_data(*output, block.data(), start, count);
+        }
+        output->close();
+    });
+    wait_io(writing, phase.write_stall_seconds);
+    measurement.finish(phase);
+    phase.runs_out = 1;
+    phase.read_stall_seconds = source.stall_seconds;
+    phase.sort_seconds = sort_seconds;
+    return elements;
+}
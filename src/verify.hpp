@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+
+#include "buffer.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "sort_kernels.hpp"
+
+struct VerifyResult {
+    size_t elements = 0;
+    // index of the first record that is smaller than the one before it, elements if there is none
+    size_t first_unsorted = 0;
+    MultisetHash hash;
+
+    bool sorted() const {
+        return first_unsorted == elements;
+    }
+};
+
+/**
+ * check that file holds sorted records and hash them, in one sequential pass with two blocks of memory
+ * the next block is read in the background while the current one is checked
+ * comparing the hash with the one of the input (see MultisetHash) shows that nothing was lost or duplicated
+ * throws if the file ends inside a record
+ */
+template <typename Record>
+VerifyResult verify_sorted(File& file, size_t block_elements) {
+    VerifyResult result;
+    result.elements = whole_records<Record>(file.size(), "output");
+    result.first_unsorted = result.elements;
+    Buffer<Record> blocks[2] = {Buffer<Record>(block_elements), Buffer<Record>(block_elements)};
+    IoThread reader;
+    auto request = [&](size_t block) {
+        size_t start = block * block_elements;
+        size_t count = std::min(block_elements, result.elements - start);
+        Buffer<Record>& buffer = blocks[block % 2];
+        return reader.submit([&file, &buffer, start, count] { read_data(file, buffer, start, 0, count); });
+    };
+
+    std::future<void> reading;
+    if (result.elements > 0) {
+        reading = request(0);
+    }
+    Record previous{};
+    for (size_t block = 0; block * block_elements < result.elements; block++) {
+        reading.get();
+        size_t start = block * block_elements;
+        size_t count = std::min(block_elements, result.elements - start);
+        if (start + count < result.elements) {
+            reading = request(block + 1);
+        }
+        const Record* records = blocks[block % 2].data();
+        if (result.sorted()) {
+            if (start > 0 && RecordTraits<Record>::less(records[0], previous)) {
+                result.first_unsorted = start;
+            } else if (size_t ordered = ascending_prefix(records, count); ordered < count) {
+                result.first_unsorted = start + ordered;
+            }
+        }
+        result.hash.add(records, count);
+        previous = records[count - 1];
+    }
+    return result;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// the tests are plain programs, a failed check is reported and the program exits with 1 at the end
+inline int check_failures = 0;
+
+#define CHECK(condition)                                                                          \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            check_failures++;                                                                     \
+        }                                                                                         \
+    } while (false)
+
+inline int check_result() {
+    if (check_failures > 0) {
+        std::cerr << check_failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
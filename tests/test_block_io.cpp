@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_block_io.in";
+const std::string output_name = "test_block_io.out";
+
+void write_file(const std::string& name, const std::vector<int64_t>& values) {
+    std::unique_ptr<File> file = file_open_and_clear(name, IoBackend::pread);
+    write_data(*file, values.data(), 0, values.size());
+}
+
+std::vector<int64_t> read_file(File& file, size_t elements) {
+    std::vector<int64_t> values(elements);
+    read_data(file, values, 0, 0, elements);
+    return values;
+}
+
+// the requests of an IoThread run one after the other in the order they were submitted
+void check_io_thread_order() {
+    std::vector<size_t> order;
+    std::vector<std::future<void>> done;
+    {
+        IoThread thread;
+        for (size_t i = 0; i < 100; i++) {
+            done.push_back(thread.submit([&order, i] { order.push_back(i); }));
+        }
+        done.back().get();
+    }
+    std::vector<size_t> expected(100);
+    std::iota(expected.begin(), expected.end(), 0);
+    CHECK(order == expected);
+}
+
+// read [start, end) of the input through a MergeSource, the next block is always in flight while one is consumed
+void check_merge_source(const std::vector<int64_t>& values, size_t start, size_t end, size_t block_elements) {
+    std::unique_ptr<File> input = file_open(input_name, IoBackend::pread);
+    IoThread reader;
+    MergeSource<int64_t> source;
+    source.block_elements = block_elements;
+    source.next_element_file = start;
+    source.end_element_file = end;
+    source.request(reader, *input);
+
+    std::vector<int64_t> read;
+    while (source.refill(reader, *input)) {
+        CHECK(source.filled > 0 && source.filled <= block_elements);
+        CHECK(source.pending.valid() == (start + read.size() + source.filled < end));
+        read.insert(read.end(), source.data, source.data + source.filled);
+    }
+    CHECK(std::equal(read.begin(), read.end(), values.begin() + start, values.begin() + end) && read.size() == end - start);
+}
+
+// push values through a BlockWriter with small buffers, everything reaches the file once finish returns
+void check_block_writer(const std::vector<int64_t>& values, size_t block_elements) {
+    Buffer<int64_t> buffer(block_elements);
+    Buffer<int64_t> in_flight(block_elements);
+    IoThread writer;
+    BlockWriter<int64_t> output(buffer, in_flight, writer);
+    // the writer is reused between files, like between merge passes
+    for (size_t round = 0; round < 2; round++) {
+        std::unique_ptr<File> file = file_open_and_clear(output_name, IoBackend::pread);
+        output.start(*file);
+        for (int64_t value : values) {
+            output.push(value);
+        }
+        output.finish();
+        CHECK(read_file(*file, values.size()) == values);
+        CHECK(std::filesystem::file_size(output_name) == values.size() * sizeof(int64_t));
+    }
+}
+
+int main() {
+    std::mt19937_64 random(2);
+    std::vector<int64_t> values(10007);
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+    write_file(input_name, values);
+
+    check_io_thread_order();
+    for (size_t block_elements : {1, 7, 1024, 20000}) {
+        check_merge_source(values, 0, values.size(), block_elements);
+        check_merge_source(values, 123, 5000, block_elements);
+        check_merge_source(values, 42, 42, block_elements);
+        check_block_writer(values, block_elements);
+    }
+
+    // a block of half the memory is lowered to max_block_size, the sort still has to come out sorted
+    const size_t memory = 24 * 1024;
+    std::string in_filename = input_name;
+    std::string out_filename = output_name;
+    SortStats stats;
+    auto result = sort_file_external<int64_t>(in_filename, out_filename, values.size() * sizeof(int64_t), memory, memory / 2, SortOptions(), stats);
+    CHECK(result != nullptr);
+    if (result) {
+        std::vector<int64_t> expected = values;
+        std::sort(expected.begin(), expected.end());
+        CHECK(read_file(*result, values.size()) == expected);
+    }
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    return check_result();
+}
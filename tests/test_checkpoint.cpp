@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.hpp"
+#include "checkpoint.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+
+const std::string input_name = "test_checkpoint.in";
+const std::string output_name = "test_checkpoint.out";
+const std::string manifest_name = "test_checkpoint.manifest";
+const std::string run_directory = "test_checkpoint_runs";
+
+SortOptions checkpoint_options(IoBackend backend) {
+    SortOptions options;
+    options.threads = 2;
+    options.io_backend = backend;
+    options.checkpoint = manifest_name;
+    options.temp_directories = {run_directory};
+    return options;
+}
+
+std::unique_ptr<File> sort(SortStats& stats, IoBackend backend = IoBackend::pread) {
+    return sort_file_external<int64_t>(input_name, output_name, unknown_size, 1024 * 1024, 64 * 1024, checkpoint_options(backend), stats);
+}
+
+std::string read_manifest() {
+    std::ifstream file(manifest_name);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+size_t run_files() {
+    size_t files = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(run_directory)) {
+        files += entry.path().extension() == ".run";
+    }
+    return files;
+}
+
+/**
+ * sort in a child process and kill -9 it as soon as the manifest holds what killed_at is looking for,
+ * like a machine that goes down in the middle of the sort; false if the sort finished before
+ */
+bool sort_and_kill(const std::string& killed_at, IoBackend backend = IoBackend::pread) {
+    pid_t child = fork();
+    if (child == 0) {
+        SortStats stats;
+        _exit(sort(stats, backend) ? 0 : 1);
+    }
+    while (true) {
+        if (read_manifest().find(killed_at) != std::string::npos) {
+            kill(child, SIGKILL);
+            int status;
+            waitpid(child, &status, 0);
+            return WIFSIGNALED(status);
+        }
+        int status;
+        if (waitpid(child, &status, WNOHANG) == child) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+// the resumed sort goes on from the runs of the manifest, its output is the sorted input and no file is left over
+void check_resume(const std::vector<int64_t>& expected, IoBackend backend = IoBackend::pread) {
+    SortStats stats;
+    std::unique_ptr<File> result = sort(stats, backend);
+    CHECK(result != nullptr);
+    CHECK(stats.resumed_runs > 0);
+    CHECK(stats.verified);
+    if (result) {
+        std::vector<int64_t> sorted(result->size() / sizeof(int64_t));
+        read_data(*result, sorted, 0, 0, sorted.size());
+        CHECK(sorted == expected);
+    }
+    CHECK(!std::filesystem::exists(manifest_name));
+    CHECK(run_files() == 0);
+}
+
+int main() {
+    std::filesystem::create_directory(run_directory);
+    std::mt19937_64 random(41);
+    // 128 runs of a quarter MB, merged with a fan-in of 7 in several passes
+    std::vector<int64_t> values(32 * 1024 * 1024 / sizeof(int64_t));
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+    std::unique_ptr<File> input = file_create(input_name, IoBackend::pread);
+    input->write(values.data(), 0, values.size() * sizeof(int64_t));
+    input->close();
+    input.reset();
+    std::sort(values.begin(), values.end());
+
+    // killed during the run generation, after the first runs were saved
+    std::filesystem::remove(manifest_name);
+    CHECK(sort_and_kill("\nrun "));
+    check_resume(values);
+
+    // killed during the merge passes, the runs of the generation or of an intermediate pass are kept
+    std::filesystem::remove(manifest_name);
+    CHECK(sort_and_kill("state merging"));
+    check_resume(values);
+
+    // a run that lost its end after it was saved is caught by its size, the sort starts over
+    std::filesystem::remove(manifest_name);
+    CHECK(sort_and_kill("state merging"));
+    std::string manifest = read_manifest();
+    size_t run_line = manifest.find("\nrun ");
+    CHECK(run_line != std::string::npos);
+    if (run_line != std::string::npos) {
+        std::istringstream fields(manifest.substr(run_line + 5));
+        size_t elements, bytes;
+        uint64_t sum, mixed_sum;
+        std::string path;
+        fields >> elements >> bytes >> sum >> mixed_sum;
+        std::getline(fields >> std::ws, path);
+        std::filesystem::resize_file(path, bytes - sizeof(int64_t));
+        SortStats stats;
+        std::unique_ptr<File> result = sort(stats);
+        CHECK(result != nullptr);
+        CHECK(stats.resumed_runs == 0);
+        CHECK(stats.verified);
+        CHECK(run_files() == 0);
+    }
+
+    // a run that was changed after it was saved is caught by its hash, the sort starts over
+    std::filesystem::remove(manifest_name);
+    CHECK(sort_and_kill("state merging"));
+    manifest = read_manifest();
+    run_line = manifest.find("\nrun ");
+    CHECK(run_line != std::string::npos);
+    if (run_line != std::string::npos) {
+        std::istringstream fields(manifest.substr(run_line + 5));
+        size_t elements, bytes;
+        uint64_t sum, mixed_sum;
+        std::string path;
+        fields >> elements >> bytes >> sum >> mixed_sum;
+        std::getline(fields >> std::ws, path);
+        std::fstream run(path, std::ios::binary | std::ios::in | std::ios::out);
+        run.seekp(100);
+        run.put('\x5a');
+        run.close();
+        SortStats stats;
+        std::unique_ptr<File> result = sort(stats);
+        CHECK(result != nullptr);
+        CHECK(stats.resumed_runs == 0);
+        CHECK(stats.verified);
+        CHECK(run_files() == 0);
+    }
+
+    // the runs a merge replaced are listed as delete, a manifest loaded after a crash removes them
+    {
+        std::filesystem::remove(manifest_name);
+        std::vector<std::string> names{run_directory + "/a.run", run_directory + "/b.run", run_directory + "/ab.run", run_directory + "/c.run"};
+        for (const std::string& name : names) {
+            std::ofstream(name) << "12345678";
+        }
+        Checkpoint first(manifest_name, input_name, values.size() * sizeof(int64_t), "i64", false);
+        MultisetHash hash;
+        first.save({Run{names[0], 1}, Run{names[1], 1}}, hash, true);
+        first.begin_run(names[3]);
+        first.save({Run{names[2], 1}}, hash, true);
+        // the sort dies here, before it removed a.run and b.run, and while c.run was being written
+        Checkpoint second(manifest_name, input_name, values.size() * sizeof(int64_t), "i64", false);
+        CHECK(second.merging());
+        CHECK(second.runs().size() == 1 && second.runs()[0].file == names[2]);
+        CHECK(!std::filesystem::exists(names[0]) && !std::filesystem::exists(names[1]) && !std::filesystem::exists(names[3]));
+        CHECK(std::filesystem::exists(names[2]));
+        second.finish();
+        std::filesystem::remove(names[2]);
+    }
+
+    // a direct run that ends inside a page is measured for the manifest after close but while it is still open,
+    // the size it keeps once the file is gone, so the run is resumed
+    {
+        std::filesystem::remove(manifest_name);
+        std::string name = run_directory + "/direct.run";
+        std::vector<int64_t> records(values.begin(), values.begin() + 1001);
+        std::unique_ptr<File> run = file_create(name, IoBackend::direct);
+        run->write(records.data(), 0, records.size() * sizeof(int64_t));
+        run->close();
+        MultisetHash hash;
+        hash.add(records.data(), records.size());
+        Checkpoint first(manifest_name, input_name, values.size() * sizeof(int64_t), "i64", false);
+        first.save({Run{name, records.size(), hash}}, hash, true);
+        run.reset();
+        Checkpoint second(manifest_name, input_name, values.size() * sizeof(int64_t), "i64", false);
+        CHECK(second.runs().size() == 1);
+        CHECK(std::filesystem::exists(name) && std::filesystem::file_size(name) == records.size() * sizeof(int64_t));
+        second.finish();
+        std::filesystem::remove(name);
+    }
+
+    // O_DIRECT pads the last page of a run until the run is closed, the manifest has to hold the real sizes;
+    // the last run of this input ends inside a page, so a padded size would make the resumed sort start over
+    {
+        std::vector<int64_t> ragged(values.size() + 1001);
+        for (auto& value : ragged) {
+            value = int64_t(random());
+        }
+        std::unique_ptr<File> ragged_input = file_create(input_name, IoBackend::pread);
+        ragged_input->write(ragged.data(), 0, ragged.size() * sizeof(int64_t));
+        ragged_input->close();
+        ragged_input.reset();
+        std::sort(ragged.begin(), ragged.end());
+        std::filesystem::remove(manifest_name);
+        CHECK(sort_and_kill("state merging", IoBackend::direct));
+        check_resume(ragged, IoBackend::direct);
+    }
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    std::filesystem::remove_all(run_directory);
+    return check_result();
+}
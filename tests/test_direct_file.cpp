@@ -0,0 +1,71 @@
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "io.hpp"
+
+const std::string file_name = "test_direct_file.bin";
+
+int main() {
+    std::unique_ptr<File> file = file_open_and_clear(file_name, IoBackend::direct);
+    if (!file) {
+        // tmpfs and some other file systems do not take O_DIRECT
+        std::cout << "O_DIRECT is not supported here, skipped" << std::endl;
+        std::filesystem::remove(file_name);
+        return check_result();
+    }
+    std::mt19937_64 random(11);
+    std::vector<char> expected(5 * io_alignment + 123);
+    for (auto& byte : expected) {
+        byte = char(random());
+    }
+
+    // pieces that start and end inside pages, written out of order so that pages are read, changed and written back
+    struct Piece {
+        size_t offset;
+        size_t bytes;
+    };
+    std::vector<Piece> pieces{{3000, 2000}, {0, 17}, {17, 2983}, {5000, 3 * io_alignment}, {5000 + 3 * io_alignment, expected.size() - 5000 - 3 * io_alignment}};
+    for (const Piece& piece : pieces) {
+        file->write(expected.data() + piece.offset, piece.offset, piece.bytes);
+    }
+    CHECK(file->size() == expected.size());
+
+    // unaligned reads, across pages and up to the last byte
+    for (const Piece& piece : std::vector<Piece>{{0, 1}, {1, io_alignment}, {4095, 2}, {100, expected.size() - 100}, {expected.size() - 1, 1}, {0, expected.size()}}) {
+        std::vector<char> read(piece.bytes);
+        file->read(read.data(), piece.offset, piece.bytes);
+        CHECK(std::memcmp(read.data(), expected.data() + piece.offset, piece.bytes) == 0);
+    }
+    // a read past the end throws instead of returning the page padding
+    bool past_end = false;
+    try {
+        char byte;
+        file->read(&byte, expected.size(), 1);
+    } catch (const std::runtime_error&) {
+        past_end = true;
+    }
+    CHECK(past_end);
+
+    // an aligned read into a page aligned buffer goes to the file directly
+    Buffer<char> aligned(io_alignment);
+    file->read(aligned.data(), io_alignment, io_alignment);
+    CHECK(std::memcmp(aligned.data(), expected.data() + io_alignment, io_alignment) == 0);
+
+    // the padding of the last page is cut off once the file is closed, the bytes are the same through the page cache
+    file.reset();
+    CHECK(std::filesystem::file_size(file_name) == expected.size());
+    std::unique_ptr<File> plain = file_open(file_name, IoBackend::pread);
+    std::vector<char> read(expected.size());
+    plain->read(read.data(), 0, read.size());
+    CHECK(read == expected);
+    plain.reset();
+    std::filesystem::remove(file_name);
+    return check_result();
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_file_backends.in";
+const std::string output_name = "test_file_backends.out";
+
+const IoBackend backends[] = {IoBackend::stream, IoBackend::pread, IoBackend::mmap};
+
+// positional writes out of order, reads of ranges and the size have to agree on every backend
+void check_file(IoBackend backend, const std::vector<int64_t>& values) {
+    std::unique_ptr<File> file = file_open_and_clear(output_name, backend);
+    CHECK(file != nullptr);
+    if (!file) return;
+    size_t half = values.size() / 2;
+    write_data(*file, values.data() + half, half, values.size() - half);
+    write_data(*file, values.data(), 0, half);
+    CHECK(file->size() == values.size() * sizeof(int64_t));
+
+    std::vector<int64_t> read(values.size());
+    read_data(*file, read, 0, 0, values.size());
+    CHECK(read == values);
+    std::vector<int64_t> middle(100);
+    read_data(*file, middle, 1000, 0, 100);
+    CHECK(std::equal(middle.begin(), middle.end(), values.begin() + 1000));
+
+    // only the mapped backend hands out the file contents without a copy
+    const int64_t* view = static_cast<const int64_t*>(file->view(8 * sizeof(int64_t), 16 * sizeof(int64_t)));
+    CHECK((view != nullptr) == (backend == IoBackend::mmap));
+    if (view != nullptr) {
+        CHECK(std::equal(view, view + 16, values.begin() + 8));
+    }
+    file.reset();
+    CHECK(file_open(output_name, backend) != nullptr);
+    CHECK(file_open("test_file_backends.missing", backend) == nullptr);
+}
+
+// a MergeSource reads the same records whether the blocks are copied or viewed in place
+void check_merge_source(IoBackend backend, const std::vector<int64_t>& values, size_t block_elements) {
+    std::unique_ptr<File> input = file_open(input_name, backend);
+    IoThread reader;
+    MergeSource<int64_t> source;
+    source.block_elements = block_elements;
+    source.next_element_file = 17;
+    source.end_element_file = values.size();
+    source.request(reader, *input);
+
+    std::vector<int64_t> read;
+    while (source.refill(reader, *input)) {
+        read.insert(read.end(), source.data, source.data + source.filled);
+    }
+    CHECK(std::equal(read.begin(), read.end(), values.begin() + 17) && read.size() == values.size() - 17);
+}
+
+int main() {
+    std::mt19937_64 random(8);
+    std::vector<int64_t> values(50021);
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+    {
+        std::unique_ptr<File> file = file_open_and_clear(input_name, IoBackend::pread);
+        write_data(*file, values.data(), 0, values.size());
+    }
+    std::vector<int64_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+
+    for (IoBackend backend : backends) {
+        check_file(backend, values);
+        for (size_t block_elements : {1000, 4096, 60000}) {
+            check_merge_source(backend, values, block_elements);
+        }
+
+        // the whole sort with several runs and merge passes through the backend
+        SortOptions options;
+        options.io_backend = backend;
+        std::string in_filename = input_name;
+        std::string out_filename = output_name;
+        SortStats stats;
+        auto result = sort_file_external<int64_t>(in_filename, out_filename, values.size() * sizeof(int64_t), 64 * 1024, 4096, options, stats);
+        CHECK(result != nullptr);
+        if (result) {
+            std::vector<int64_t> sorted(values.size());
+            read_data(*result, sorted, 0, 0, values.size());
+            CHECK(sorted == expected);
+        }
+    }
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    return check_result();
+}
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "distribution_sort.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "scratch.hpp"
+
+const std::string input_name = "test_heavy_keys.in";
+const std::string output_name = "test_heavy_keys.out";
+const size_t memory = 1024 * 1024;
+const size_t block_size = 64 * 1024;
+
+template <typename Record>
+void write_input(const std::vector<Record>& records) {
+    std::unique_ptr<File> file = file_create(input_name, IoBackend::pread);
+    file->write(records.data(), 0, records.size() * sizeof(Record));
+    file->close();
+}
+
+template <typename Record>
+std::vector<Record> read_all(const std::string& name, size_t elements) {
+    std::unique_ptr<File> file = file_open(name, IoBackend::pread);
+    std::vector<Record> records(elements);
+    read_data(*file, records, 0, 0, elements);
+    return records;
+}
+
+SortOptions distribution_options() {
+    SortOptions options;
+    options.threads = 2;
+    options.strategy = SortStrategy::distribution;
+    return options;
+}
+
+// 70 % of the records are 7, 20 % are -3, the rest is spread over all keys
+std::vector<int64_t> heavy_input(size_t elements) {
+    std::mt19937_64 random(22);
+    std::vector<int64_t> values(elements);
+    for (auto& value : values) {
+        uint64_t pick = random() % 10;
+        value = pick < 7 ? 7 : pick < 9 ? -3 : int64_t(random());
+    }
+    return values;
+}
+
+// the distribution puts every record of a heavy key into its equal key bucket, which holds nothing else
+void check_buckets(const std::vector<int64_t>& values) {
+    write_input(values);
+    std::unique_ptr<File> input = file_open(input_name, IoBackend::pread);
+    ScratchSpace scratch_space({std::filesystem::current_path()});
+    PhaseStats phase;
+    MultisetHash input_hash;
+    std::vector<Bucket> buckets = distribute<int64_t>(*input, values.size() * sizeof(int64_t), scratch_space, memory, block_size, distribution_options(), phase, input_hash);
+
+    MultisetHash expected_hash;
+    expected_hash.add(values.data(), values.size());
+    CHECK(input_hash == expected_hash);
+    size_t elements = 0;
+    size_t equal_key_buckets = 0;
+    int64_t previous_last = INT64_MIN;
+    for (const Bucket& bucket : buckets) {
+        std::vector<int64_t> records = read_all<int64_t>(bucket.file, bucket.elements);
+        elements += bucket.elements;
+        if (records.empty()) continue;
+        // the buckets are key ranges in order
+        auto [smallest, largest] = std::minmax_element(records.begin(), records.end());
+        CHECK(*smallest >= previous_last);
+        previous_last = *largest;
+        if (bucket.equal_keys) {
+            equal_key_buckets++;
+            CHECK(*smallest == *largest);
+            CHECK(bucket.elements == size_t(std::count(values.begin(), values.end(), *smallest)));
+        } else {
+            CHECK(std::count(records.begin(), records.end(), 7) == 0);
+            CHECK(std::count(records.begin(), records.end(), -3) == 0);
+        }
+    }
+    CHECK(elements == values.size());
+    CHECK(equal_key_buckets == 2);
+}
+
+// a distribution sort of values, the heavy buckets are larger than a memory load but are not merge sorted
+template <typename Record>
+void check_sort(std::vector<Record> values) {
+    write_input(values);
+    SortStats stats;
+    std::unique_ptr<File> result = sort_file_external<Record>(input_name, output_name, unknown_size, memory, block_size, distribution_options(), stats);
+    CHECK(result != nullptr);
+    CHECK(stats.distribution);
+    CHECK(stats.verified);
+    CHECK(stats.input_records == values.size());
+    CHECK(stats.merged_buckets == 0);
+    std::vector<Record> sorted = read_all<Record>(output_name, values.size());
+    CHECK(std::is_sorted(sorted.begin(), sorted.end(), [](const Record& a, const Record& b) { return RecordTraits<Record>::less(a, b); }));
+    MultisetHash expected_hash, output_hash;
+    expected_hash.add(values.data(), values.size());
+    output_hash.add(sorted.data(), sorted.size());
+    CHECK(output_hash == expected_hash);
+}
+
+int main() {
+    // 4 MB, the bucket of 7 alone is more than ten memory loads, the other keys fit into the buckets they leave
+    std::vector<int64_t> values = heavy_input(memory / 2);
+    check_buckets(values);
+    check_sort(values);
+
+    // a single key, all records land in its equal key bucket
+    check_sort(std::vector<int64_t>(memory / 2, 42));
+
+    // heavy keys with payloads: the equal key bucket is copied as it is and keeps every payload
+    std::mt19937_64 random(23);
+    std::vector<KeyPayload16> records(memory / 4);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i] = KeyPayload16{random() % 4 == 0 ? random() : 1000, i};
+    }
+    check_sort(records);
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    return check_result();
+}
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "verify.hpp"
+
+const std::string input_name = "test_input_size.in";
+const std::string output_name = "test_input_size.out";
+
+void write_bytes(const std::string& name, size_t bytes) {
+    std::mt19937_64 random(5);
+    std::vector<char> data(bytes);
+    for (auto& byte : data) {
+        byte = char(random());
+    }
+    std::unique_ptr<File> file = file_create(name, IoBackend::pread);
+    file->write(data.data(), 0, data.size());
+    file->close();
+}
+
+std::unique_ptr<File> sort(size_t input_file_size, SortStats& stats) {
+    SortOptions options;
+    options.threads = 2;
+    return sort_file_external<int64_t>(input_name, output_name, input_file_size, 1024 * 1024, 64 * 1024, options, stats);
+}
+
+int main() {
+    // an input that ends inside a record is rejected instead of losing its tail
+    write_bytes(input_name, 1000003);
+    SortStats ragged;
+    CHECK(sort(unknown_size, ragged) == nullptr);
+    CHECK(sort(1000003, ragged) == nullptr);
+    // also when only a part of it is sorted, the file itself is broken
+    CHECK(sort(4096, ragged) == nullptr);
+
+    // whole records are sorted and verified, also the ones of a pipe or of several memory loads
+    write_bytes(input_name, 1000000);
+    SortStats whole;
+    std::unique_ptr<File> result = sort(unknown_size, whole);
+    CHECK(result != nullptr);
+    CHECK(whole.verified);
+    CHECK(whole.input_records == 125000);
+    CHECK(whole.output_records == 125000);
+    result.reset();
+
+    // a size given for the input that is not a whole number of records is cut to the records before it
+    SortStats prefix;
+    result = sort(1001, prefix);
+    CHECK(result != nullptr);
+    CHECK(prefix.verified);
+    CHECK(prefix.input_records == 125);
+    result.reset();
+
+    // the phases and the verification do not take a size that ends inside a record either
+    CHECK(whole_records<int64_t>(1000000, "input") == 125000);
+    bool thrown = false;
+    try {
+        whole_records<KeyPayload16>(1000000 + 8, "input");
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    write_bytes(output_name, 1000003);
+    std::unique_ptr<File> file = file_open(output_name, IoBackend::pread);
+    thrown = false;
+    try {
+        verify_sorted<int64_t>(*file, aligned_elements<int64_t>(0));
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    file.reset();
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    return check_result();
+}
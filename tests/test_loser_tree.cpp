@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "check.hpp"
+#include "external_merge.hpp"
+#include "record.hpp"
+
+// sorted runs of random lengths up to max_length, some empty, with keys from a small range so that there are ties
+std::vector<std::vector<KeyPayload16>> random_runs(std::mt19937_64& random, size_t ways, size_t max_length) {
+    std::vector<std::vector<KeyPayload16>> runs(ways);
+    for (size_t way = 0; way < ways; way++) {
+        size_t length = random() % (max_length + 1);
+        for (size_t i = 0; i < length; i++) {
+            // the payload tells which way and position a record came from
+            runs[way].push_back(KeyPayload16{random() % 50, way << 32 | i});
+        }
+        std::stable_sort(runs[way].begin(), runs[way].end(), [](const KeyPayload16& a, const KeyPayload16& b) { return a.key < b.key; });
+    }
+    return runs;
+}
+
+// the merge of the runs, equal keys in the order of their ways
+std::vector<KeyPayload16> expected_merge(const std::vector<std::vector<KeyPayload16>>& runs) {
+    std::vector<KeyPayload16> all;
+    for (const auto& run : runs) {
+        all.insert(all.end(), run.begin(), run.end());
+    }
+    std::stable_sort(all.begin(), all.end(), [](const KeyPayload16& a, const KeyPayload16& b) { return a.key < b.key; });
+    return all;
+}
+
+bool same(const std::vector<KeyPayload16>& a, const std::vector<KeyPayload16>& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const KeyPayload16& x, const KeyPayload16& y) {
+        return x.key == y.key && x.payload == y.payload;
+    });
+}
+
+void check_loser_tree(const std::vector<std::vector<KeyPayload16>>& runs) {
+    LoserTree<KeyPayload16> tree(runs.size());
+    std::vector<size_t> positions(runs.size(), 0);
+    for (size_t way = 0; way < runs.size(); way++) {
+        if (runs[way].empty()) {
+            tree.set_exhausted(way);
+        } else {
+            tree.set(way, runs[way].data());
+        }
+    }
+    tree.build();
+    std::vector<KeyPayload16> merged;
+    while (!tree.empty()) {
+        size_t way = tree.winner();
+        merged.push_back(tree.winner_record());
+        if (++positions[way] < runs[way].size()) {
+            tree.push(runs[way].data() + positions[way]);
+        } else {
+            tree.pop();
+        }
+    }
+    CHECK(same(merged, expected_merge(runs)));
+}
+
+int main() {
+    std::mt19937_64 random(3);
+    for (size_t ways = 1; ways <= 17; ways++) {
+        for (size_t round = 0; round < 20; round++) {
+            check_loser_tree(random_runs(random, ways, 40));
+        }
+    }
+
+    // a tree of no ways has no winner, it is rejected
+    bool rejected = false;
+    try {
+        LoserTree<KeyPayload16> tree(0);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+    return check_result();
+}
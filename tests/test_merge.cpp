@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_merge.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+// sorted runs of random lengths up to max_length, with keys from key_range so that there are ties across the parts
+std::vector<std::vector<KeyPayload16>> random_runs(std::mt19937_64& random, size_t ways, size_t max_length, uint64_t key_range) {
+    std::vector<std::vector<KeyPayload16>> runs(ways);
+    for (size_t way = 0; way < ways; way++) {
+        size_t length = random() % (max_length + 1);
+        for (size_t i = 0; i < length; i++) {
+            // the payload tells which way and position a record came from
+            runs[way].push_back(KeyPayload16{random() % key_range, way << 32 | i});
+        }
+        std::stable_sort(runs[way].begin(), runs[way].end(), [](const KeyPayload16& a, const KeyPayload16& b) { return a.key < b.key; });
+    }
+    return runs;
+}
+
+// the merge of the runs, equal keys in the order of their ways
+std::vector<KeyPayload16> expected_merge(const std::vector<std::vector<KeyPayload16>>& runs) {
+    std::vector<KeyPayload16> all;
+    for (const auto& run : runs) {
+        all.insert(all.end(), run.begin(), run.end());
+    }
+    std::stable_sort(all.begin(), all.end(), [](const KeyPayload16& a, const KeyPayload16& b) { return a.key < b.key; });
+    return all;
+}
+
+bool same(const std::vector<KeyPayload16>& a, const std::vector<KeyPayload16>& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const KeyPayload16& x, const KeyPayload16& y) {
+        return x.key == y.key && x.payload == y.payload;
+    });
+}
+
+std::vector<Run> write_runs(const std::vector<std::vector<KeyPayload16>>& runs) {
+    std::vector<Run> files;
+    for (size_t way = 0; way < runs.size(); way++) {
+        files.push_back(Run{"test_merge_" + std::to_string(way) + ".run", runs[way].size()});
+        std::unique_ptr<File> file = file_create(files.back().file, IoBackend::pread);
+        if (!runs[way].empty()) {
+            file->write(runs[way].data(), 0, runs[way].size() * sizeof(KeyPayload16));
+        }
+    }
+    return files;
+}
+
+void remove_runs(const std::vector<Run>& runs) {
+    for (const Run& run : runs) {
+        std::filesystem::remove(run.file);
+    }
+}
+
+// the parts of split_merge cover every run from its start to its end without overlapping
+void check_split(const std::vector<std::vector<KeyPayload16>>& runs, size_t parts) {
+    std::vector<Run> files = write_runs(runs);
+    std::vector<std::unique_ptr<File>> inputs;
+    std::vector<size_t> lengths;
+    for (const Run& run : files) {
+        inputs.push_back(file_open(run.file, IoBackend::pread));
+        lengths.push_back(run.elements);
+    }
+    std::vector<std::vector<size_t>> bounds = split_merge<KeyPayload16>(inputs, lengths, parts);
+    CHECK(bounds.size() == parts + 1);
+    CHECK(bounds[0] == std::vector<size_t>(runs.size(), 0));
+    CHECK(bounds[parts] == lengths);
+    for (size_t part = 0; part < parts; part++) {
+        for (size_t way = 0; way < runs.size(); way++) {
+            CHECK(bounds[part][way] <= bounds[part + 1][way]);
+        }
+    }
+    inputs.clear();
+    remove_runs(files);
+}
+
+// merge the runs with one worker per thread, so the merge is split into that many key ranges
+std::vector<KeyPayload16> parallel_merge(const std::vector<std::vector<KeyPayload16>>& runs, size_t threads, size_t block_elements) {
+    std::vector<Run> files = write_runs(runs);
+    std::vector<std::unique_ptr<MergeWorker<KeyPayload16>>> workers;
+    for (size_t thread = 0; thread < threads; thread++) {
+        workers.push_back(std::make_unique<MergeWorker<KeyPayload16>>(runs.size(), block_elements));
+    }
+    SortOptions options;
+    PhaseStats phase;
+    std::unique_ptr<File> output = file_create("test_merge.out", IoBackend::pread);
+    size_t elements = external_merge_runs<KeyPayload16>(files, 0, files.size(), workers, *output, 0, options, phase);
+
+    std::unique_ptr<File> result = file_open("test_merge.out", IoBackend::pread);
+    std::vector<KeyPayload16> merged(result->size() / sizeof(KeyPayload16));
+    CHECK(merged.size() == elements);
+    if (!merged.empty()) {
+        result->read(merged.data(), 0, merged.size() * sizeof(KeyPayload16));
+    }
+    result.reset();
+    remove_runs(files);
+    std::filesystem::remove("test_merge.out");
+    return merged;
+}
+
+int main() {
+    std::mt19937_64 random(13);
+    const size_t block_elements = aligned_elements<KeyPayload16>(0);
+    for (size_t ways : {2, 3, 8}) {
+        // few keys give splitters with long ranges of equal records, many keys hardly any ties
+        for (uint64_t key_range : {5, 50, 1000000}) {
+            auto runs = random_runs(random, ways, 12 * block_elements, key_range);
+            std::vector<KeyPayload16> expected = expected_merge(runs);
+            for (size_t parts : {2, 3, 7}) {
+                check_split(runs, parts);
+            }
+            CHECK(same(parallel_merge(runs, 1, block_elements), expected));
+            // the ranges of a split merge are written at their own offsets, ties stay in the order of the ways
+            CHECK(same(parallel_merge(runs, 4, block_elements), expected));
+        }
+    }
+    return check_result();
+}
@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "sort_kernels.hpp"
+
+// every allocation of the program is counted, so a sort that copies the records shows up
+size_t allocated_bytes = 0;
+
+void* operator new(size_t size) {
+    allocated_bytes += size;
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+// sort a copy with merge_sort, compare with std::sort and check that it works in nums and scratch,
+// it only allocates the bounds of its runs, a word per 32 records, never room for the records
+void check_merge_sort(std::vector<int64_t> values) {
+    std::vector<int64_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+    std::vector<int64_t> scratch(values.size());
+    size_t bytes_before = allocated_bytes;
+    merge_sort(values.data(), scratch.data(), values.size(), nullptr);
+    CHECK(allocated_bytes - bytes_before <= values.size() * sizeof(int64_t) / 2 + 256);
+    CHECK(values == expected);
+}
+
+std::vector<int64_t> random_values(std::mt19937_64& random, size_t size, uint64_t key_range) {
+    std::vector<int64_t> values(size);
+    for (auto& value : values) {
+        value = int64_t(random() % key_range);
+    }
+    return values;
+}
+
+int main() {
+    std::mt19937_64 random(4);
+    // runs of 32 are insertion sorted, the sizes around it and odd ones leave a partial run at the end
+    for (size_t size : {0, 1, 2, 31, 32, 33, 64, 1000, 4097, 100003}) {
+        check_merge_sort(random_values(random, size, ~uint64_t(0)));
+        check_merge_sort(random_values(random, size, 3));
+        std::vector<int64_t> sorted = random_values(random, size, ~uint64_t(0));
+        std::sort(sorted.begin(), sorted.end());
+        check_merge_sort(sorted);
+        std::reverse(sorted.begin(), sorted.end());
+        check_merge_sort(sorted);
+    }
+
+    // the branch free merge against std::merge, including one side empty
+    for (size_t round = 0; round < 100; round++) {
+        std::vector<int64_t> a = random_values(random, random() % 50, 20);
+        std::vector<int64_t> b = random_values(random, random() % 50, 20);
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        std::vector<int64_t> merged(a.size() + b.size());
+        std::vector<int64_t> expected(a.size() + b.size());
+        merge(a.data(), a.data() + a.size(), b.data(), b.data() + b.size(), merged.data(), nullptr);
+        std::merge(a.begin(), a.end(), b.begin(), b.end(), expected.begin());
+        CHECK(merged == expected);
+    }
+    return check_result();
+}
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "run_generation.hpp"
+#include "scratch.hpp"
+#include "sort_config.hpp"
+#include "sort_kernels.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_natural_runs.in";
+const size_t memory = 1024 * 1024;
+// the run generation sorts a quarter of the memory at a time
+const size_t load = memory / 4 / sizeof(int64_t);
+
+// run generation over values, checks that every run is sorted and that they hold the values
+std::vector<Run> generate_runs(const std::vector<int64_t>& values) {
+    std::unique_ptr<File> file = file_create(input_name, IoBackend::pread);
+    file->write(values.data(), 0, values.size() * sizeof(int64_t));
+    file->close();
+    std::unique_ptr<File> input = file_open(input_name, IoBackend::pread);
+
+    ScratchSpace scratch_space({std::filesystem::current_path()});
+    SortOptions options;
+    options.threads = 2;
+    PhaseStats phase;
+    MultisetHash input_hash;
+    std::vector<Run> runs = partition<int64_t>(*input, values.size() * sizeof(int64_t), scratch_space, memory, 64 * 1024, options, phase, input_hash, nullptr);
+
+    std::vector<int64_t> run_values;
+    for (const Run& run : runs) {
+        std::unique_ptr<File> run_file = file_open(run.file, IoBackend::pread);
+        std::vector<int64_t> records(run.elements);
+        read_data(*run_file, records, 0, 0, run.elements);
+        CHECK(std::is_sorted(records.begin(), records.end()));
+        run_values.insert(run_values.end(), records.begin(), records.end());
+    }
+    std::vector<int64_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+    std::sort(run_values.begin(), run_values.end());
+    CHECK(run_values == expected);
+    // the run generation hashes the input as it reads it
+    MultisetHash values_hash;
+    values_hash.add(values.data(), values.size());
+    CHECK(input_hash == values_hash);
+    input.reset();
+    std::filesystem::remove(input_name);
+    return runs;
+}
+
+int main() {
+    // the prefixes: ties count as ascending, a descending run is strict so that reversing it is stable
+    std::vector<int64_t> prefix{1, 2, 2, 5, 3, 3, 1};
+    CHECK(ascending_prefix(prefix.data(), 0) == 0);
+    CHECK(ascending_prefix(prefix.data(), 1) == 1);
+    CHECK(ascending_prefix(prefix.data(), prefix.size()) == 4);
+    CHECK(descending_prefix(prefix.data() + 3, 4) == 2);
+    CHECK(descending_prefix(prefix.data() + 4, 3) == 1);
+    CHECK(descending_prefix(prefix.data(), 0) == 0);
+    std::vector<int64_t> sorted_values{-3, -3, 0, 7};
+    CHECK(ascending_prefix(sorted_values.data(), sorted_values.size()) == sorted_values.size());
+
+    // the natural merge sort takes presorted and reversed input, records with equal keys keep their order
+    std::mt19937_64 random(31);
+    for (size_t size : {size_t(0), size_t(1), size_t(100), size_t(10000)}) {
+        std::vector<KeyPayload16> records(size);
+        for (size_t i = 0; i < size; i++) {
+            records[i] = KeyPayload16{random() % 50, i};
+        }
+        // ascending, descending and random stretches next to each other
+        std::sort(records.begin(), records.begin() + size / 3, [](const KeyPayload16& a, const KeyPayload16& b) { return a.key < b.key; });
+        std::sort(records.begin() + size / 3, records.begin() + 2 * size / 3, [](const KeyPayload16& a, const KeyPayload16& b) { return a.key > b.key; });
+        std::vector<KeyPayload16> expected = records;
+        std::stable_sort(expected.begin(), expected.end(), [](const KeyPayload16& a, const KeyPayload16& b) { return a.key < b.key; });
+        std::vector<KeyPayload16> scratch(size);
+        merge_sort(records.data(), scratch.data(), size, nullptr);
+        CHECK(std::equal(records.begin(), records.end(), expected.begin(), expected.end(), [](const KeyPayload16& a, const KeyPayload16& b) {
+            return a.key == b.key && a.payload == b.payload;
+        }));
+    }
+
+    // sorted input is one run across all memory loads
+    std::vector<int64_t> values(5 * load + 17);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = int64_t(4 * i) - 1000;
+    }
+    std::vector<Run> runs = generate_runs(values);
+    CHECK(runs.size() == 1);
+    CHECK(runs.size() == 1 && runs[0].elements == values.size());
+
+    // a load that starts below the end of the run before it starts a run of its own
+    std::vector<int64_t> saw(3 * load);
+    for (size_t i = 0; i < saw.size(); i++) {
+        saw[i] = int64_t(i % load);
+    }
+    CHECK(generate_runs(saw).size() == 3);
+
+    // a load whose sorted prefix continues the run extends it by the prefix, its rest starts a new run
+    // that the sorted loads after it extend in turn
+    for (size_t i = 2 * load + load / 2; i < 3 * load; i++) {
+        values[i] = int64_t(random() % 1000);
+    }
+    runs = generate_runs(values);
+    CHECK(runs.size() == 2);
+    if (runs.size() == 2) {
+        CHECK(runs[0].elements == 2 * load + load / 2);
+        CHECK(runs[1].elements == values.size() - runs[0].elements);
+    }
+    return check_result();
+}
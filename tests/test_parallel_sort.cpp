@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "io.hpp"
+#include "run_generation.hpp"
+#include "scratch.hpp"
+#include "sort_config.hpp"
+#include "sort_kernels.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_parallel_sort.in";
+
+std::vector<int64_t> random_values(std::mt19937_64& random, size_t size, uint64_t key_range) {
+    std::vector<int64_t> values(size);
+    for (auto& value : values) {
+        value = int64_t(random() % key_range);
+    }
+    return values;
+}
+
+// sort a copy with threads threads, every slice with merge_sort and with radix_sort, and compare with std::sort
+void check_parallel_sort(const std::vector<int64_t>& values, size_t threads) {
+    std::vector<int64_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+    for (auto sort_slice : {merge_sort<int64_t>, radix_sort<int64_t>}) {
+        std::vector<int64_t> sorted = values;
+        std::vector<int64_t> scratch(values.size());
+        parallel_sort(sorted, scratch, 0, sorted.size(), threads, sort_slice, nullptr);
+        CHECK(sorted == expected);
+    }
+}
+
+// the first diagonal elements of merge(a, b) are the merge of a[0, i) and b[0, diagonal - i)
+void check_co_rank(std::mt19937_64& random) {
+    std::vector<int64_t> a = random_values(random, random() % 30, 10);
+    std::vector<int64_t> b = random_values(random, random() % 30, 10);
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    std::vector<int64_t> merged(a.size() + b.size());
+    std::merge(a.begin(), a.end(), b.begin(), b.end(), merged.begin());
+    for (size_t diagonal = 0; diagonal <= merged.size(); diagonal++) {
+        size_t i = co_rank(a.data(), a.size(), b.data(), b.size(), diagonal);
+        CHECK(i <= a.size() && diagonal - i <= b.size());
+        std::vector<int64_t> prefix(diagonal);
+        std::merge(a.begin(), a.begin() + i, b.begin(), b.begin() + (diagonal - i), prefix.begin());
+        CHECK(std::equal(prefix.begin(), prefix.end(), merged.begin()));
+    }
+}
+
+// the pipelined partition writes run files of a quarter of the memory, each the sorted chunk of the input
+void check_partition(const std::vector<int64_t>& values, size_t memory, size_t block_size, const SortOptions& options) {
+    {
+        std::unique_ptr<File> file = file_open_and_clear(input_name, IoBackend::pread);
+        write_data(*file, values.data(), 0, values.size());
+    }
+    std::unique_ptr<File> input = file_open(input_name, IoBackend::pread);
+    ScratchSpace scratch_space({std::filesystem::current_path()});
+    PhaseStats phase;
+    MultisetHash input_hash;
+    std::vector<Run> runs = partition<int64_t>(*input, values.size() * sizeof(int64_t), scratch_space, memory, block_size, options, phase, input_hash, nullptr);
+
+    const size_t chunk_elements = memory / 4 / sizeof(int64_t);
+    CHECK(runs.size() == (values.size() + chunk_elements - 1) / chunk_elements);
+    size_t start = 0;
+    for (const Run& run : runs) {
+        CHECK(run.elements == std::min(chunk_elements, values.size() - start));
+        std::unique_ptr<File> run_file = file_open(run.file, IoBackend::pread);
+        std::vector<int64_t> run_values(run.elements);
+        read_data(*run_file, run_values, 0, 0, run.elements);
+        std::vector<int64_t> expected(values.begin() + start, values.begin() + start + run.elements);
+        std::sort(expected.begin(), expected.end());
+        CHECK(run_values == expected);
+        start += run.elements;
+    }
+    CHECK(start == values.size());
+}
+
+int main() {
+    std::mt19937_64 random(3);
+    // below 2^14 elements per thread a slice is not split further
+    for (size_t size : {0, 1, 1000, (1 << 14) - 1, 1 << 15, 100003}) {
+        for (size_t threads : {1, 2, 3, 4, 8}) {
+            check_parallel_sort(random_values(random, size, ~uint64_t(0)), threads);
+            check_parallel_sort(random_values(random, size, 5), threads);
+        }
+    }
+    for (size_t round = 0; round < 200; round++) {
+        check_co_rank(random);
+    }
+
+    const size_t memory = 256 * 1024;
+    for (size_t threads : {1, 4}) {
+        for (SortAlgorithm sort_algorithm : {SortAlgorithm::merge, SortAlgorithm::radix}) {
+            SortOptions options;
+            options.threads = threads;
+            options.sort_algorithm = sort_algorithm;
+            check_partition(random_values(random, 100003, ~uint64_t(0)), memory, 4096, options);
+            check_partition(random_values(random, 8192, ~uint64_t(0)), memory, 4096, options);
+            check_partition({}, memory, 4096, options);
+        }
+    }
+
+    std::filesystem::remove(input_name);
+    return check_result();
+}
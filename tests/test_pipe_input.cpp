@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+
+const std::string output_name = "test_pipe_input.out";
+
+/**
+ * sort bytes that arrive through a pipe on stdin, of a size the sort is not told
+ * a thread writes them in pieces that end inside records, so the reads have to put the records together
+ */
+std::unique_ptr<File> sort_pipe(const std::vector<char>& bytes, const SortOptions& options, SortStats& stats) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        CHECK(false);
+        return nullptr;
+    }
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+    std::thread writer([&bytes, fd = fds[1]] {
+        const size_t piece = 1000;
+        for (size_t offset = 0; offset < bytes.size();) {
+            ssize_t written = write(fd, bytes.data() + offset, std::min(piece, bytes.size() - offset));
+            if (written <= 0) break;
+            offset += written;
+        }
+        close(fd);
+    });
+    std::unique_ptr<File> result = sort_file_external<int64_t>("-", output_name, unknown_size, 1024 * 1024, 64 * 1024, options, stats);
+    writer.join();
+    return result;
+}
+
+std::vector<int64_t> read_output(File& file) {
+    std::vector<int64_t> records(file.size() / sizeof(int64_t));
+    read_data(file, records, 0, 0, records.size());
+    return records;
+}
+
+int main() {
+    std::mt19937_64 random(23);
+    // several memory loads, so the pipe is cut into runs that are merged
+    std::vector<int64_t> values(5 * 1024 * 1024 / 4 / sizeof(int64_t) + 77);
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+    std::vector<char> bytes(reinterpret_cast<const char*>(values.data()), reinterpret_cast<const char*>(values.data() + values.size()));
+    std::vector<int64_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+
+    for (RunGeneration run_generation : {RunGeneration::sort, RunGeneration::replacement_selection}) {
+        SortOptions options;
+        options.threads = 2;
+        options.run_generation = run_generation;
+        SortStats stats;
+        std::unique_ptr<File> result = sort_pipe(bytes, options, stats);
+        CHECK(result != nullptr);
+        if (result) {
+            CHECK(stats.verified);
+            CHECK(stats.runs > 1);
+            CHECK(stats.input_records == values.size());
+            CHECK(read_output(*result) == expected);
+        }
+    }
+
+    // less than a memory load is sorted in memory, an empty pipe gives an empty output
+    {
+        SortOptions options;
+        SortStats stats;
+        std::vector<char> small(bytes.begin(), bytes.begin() + 100 * sizeof(int64_t));
+        std::vector<int64_t> small_expected(values.begin(), values.begin() + 100);
+        std::sort(small_expected.begin(), small_expected.end());
+        std::unique_ptr<File> result = sort_pipe(small, options, stats);
+        CHECK(result != nullptr && stats.input_records == 100 && read_output(*result) == small_expected);
+        SortStats empty_stats;
+        result = sort_pipe({}, options, empty_stats);
+        CHECK(result != nullptr && empty_stats.input_records == 0 && result->size() == 0);
+    }
+
+    // a pipe that ends inside a record fails instead of losing the piece
+    {
+        SortOptions options;
+        SortStats stats;
+        std::vector<char> ragged(bytes.begin(), bytes.begin() + 1000 * sizeof(int64_t) + 3);
+        CHECK(sort_pipe(ragged, options, stats) == nullptr);
+    }
+    std::filesystem::remove(output_name);
+    return check_result();
+}
@@ -0,0 +1,149 @@
+#include <cstdint>
+#include <vector>
+
+#include "check.hpp"
+#include "planner.hpp"
+#include "sort_config.hpp"
+
+const size_t MB = 1024 * 1024;
+const size_t memory = 16 * MB;
+const size_t input_size = 1024 * MB;
+
+SortOptions planner_options() {
+    SortOptions options;
+    options.threads = 4;
+    return options;
+}
+
+// the block sizes plan_sort tries, powers of two from 64 KB to a sixth of the memory
+std::vector<size_t> block_sizes() {
+    std::vector<size_t> sizes;
+    for (size_t block_size = 64 * 1024; block_size <= max_block_size(memory); block_size *= 2) {
+        sizes.push_back(block_size);
+    }
+    return sizes;
+}
+
+// the plan of profile is the one of the lowest predicted time of all block sizes, the first of them on a tie
+void check_fastest(const DeviceProfile& profile, const SortPlan& plan) {
+    SortOptions options = planner_options();
+    CHECK(plan.predicted_seconds > 0);
+    for (size_t block_size : block_sizes()) {
+        SortPlan other = evaluate_plan<int64_t>(input_size, memory, block_size, RunGeneration::sort, profile, options, 0.5);
+        CHECK(other.predicted_seconds >= plan.predicted_seconds);
+        if (block_size < plan.block_size) {
+            CHECK(other.predicted_seconds > plan.predicted_seconds);
+        }
+    }
+}
+
+// replacement selection is only in plan if the sorted loads of its block need more passes, and more than one
+void check_selection_saves_pass(const SortPlan& plan, double ascending_pairs) {
+    SortOptions options = planner_options();
+    SortPlan sorted_loads = evaluate_plan<int64_t>(plan.input_size, memory, plan.block_size, RunGeneration::sort, DeviceProfile(), options, ascending_pairs);
+    if (plan.run_generation == RunGeneration::replacement_selection) {
+        CHECK(plan.merge_passes < sorted_loads.merge_passes);
+        CHECK(sorted_loads.merge_passes > 1);
+    } else {
+        CHECK(plan.merge_passes == sorted_loads.merge_passes);
+    }
+}
+
+int main() {
+    SortOptions options = planner_options();
+    DeviceProfile unmeasured;
+
+    // run lengths of replacement selection in heaps
+    CHECK(selection_run_factor(0) == 1);
+    CHECK(selection_run_factor(0.5) == 2);
+    CHECK(selection_run_factor(0.75) == 4);
+    CHECK(selection_run_factor(1) >= 1e9);
+    CHECK(new_run_fraction(0, 1000) == 1);
+    CHECK(new_run_fraction(1, 1000) == 0);
+    CHECK(new_run_fraction(0.5, 1000) == 1);
+
+    // a block over a sixth of the memory is planned as that, like the sort lowers it
+    SortPlan lowered = evaluate_plan<int64_t>(input_size, memory, memory, RunGeneration::sort, unmeasured, options);
+    CHECK(lowered.block_size == max_block_size(memory));
+    CHECK(lowered.fan_in >= 2);
+
+    // stdin is planned as 64 memory loads of reversed input
+    SortPlan unknown = evaluate_plan<int64_t>(unknown_size, memory, 1 * MB, RunGeneration::sort, unmeasured, options);
+    CHECK(!unknown.input_size_known);
+    CHECK(unknown.input_size == 64 * memory);
+    CHECK(unknown.runs == unknown.memory_loads);
+
+    // sorted memory loads: reversed and random input start a run in every load, sorted input is one run
+    SortPlan reversed = evaluate_plan<int64_t>(input_size, memory, 64 * 1024, RunGeneration::sort, unmeasured, options, 0);
+    CHECK(reversed.memory_loads == input_size / (memory / 4));
+    CHECK(reversed.runs == reversed.memory_loads);
+    CHECK(reversed.merge_passes == 2);
+    SortPlan random = evaluate_plan<int64_t>(input_size, memory, 64 * 1024, RunGeneration::sort, unmeasured, options, 0.5);
+    CHECK(random.runs == random.memory_loads);
+    SortPlan presorted = evaluate_plan<int64_t>(input_size, memory, 64 * 1024, RunGeneration::sort, unmeasured, options, 1);
+    CHECK(presorted.runs == 1);
+    CHECK(presorted.merge_passes == 0);
+
+    // replacement selection: runs of the heap for reversed input, of twice the heap for random input
+    SortPlan selection_reversed = evaluate_plan<int64_t>(input_size, memory, 64 * 1024, RunGeneration::replacement_selection, unmeasured, options, 0);
+    SortPlan selection_random = evaluate_plan<int64_t>(input_size, memory, 64 * 1024, RunGeneration::replacement_selection, unmeasured, options, 0.5);
+    CHECK(selection_reversed.run_factor == 1);
+    CHECK(selection_random.run_factor == 2);
+    CHECK(selection_random.runs < selection_reversed.runs);
+    CHECK(selection_random.runs * 2 <= selection_reversed.runs + 1);
+    CHECK(selection_random.merge_passes == 1);
+    SortPlan selection_presorted = evaluate_plan<int64_t>(input_size, memory, 64 * 1024, RunGeneration::replacement_selection, unmeasured, options, 1);
+    CHECK(selection_presorted.runs == 1);
+    CHECK(selection_presorted.merge_passes == 0);
+
+    // without device numbers: the largest block with the fewest passes
+    SortPlan fewest = plan_sort<int64_t>(input_size, memory, unmeasured, options, false, 0.5);
+    for (size_t block_size : block_sizes()) {
+        SortPlan other = evaluate_plan<int64_t>(input_size, memory, block_size, RunGeneration::sort, unmeasured, options, 0.5);
+        CHECK(other.merge_passes >= fewest.merge_passes);
+        if (block_size > fewest.block_size) {
+            CHECK(other.merge_passes > fewest.merge_passes);
+        }
+    }
+    CHECK(fewest.run_generation == RunGeneration::sort);
+    CHECK(fewest.predicted_seconds == 0);
+
+    // presorted input needs no merge pass, so the largest block is taken
+    SortPlan sorted_plan = plan_sort<int64_t>(input_size, memory, unmeasured, options, true, 1);
+    CHECK(sorted_plan.runs == 1);
+    CHECK(sorted_plan.merge_passes == 0);
+    CHECK(sorted_plan.block_size == block_sizes().back());
+    CHECK(sorted_plan.run_generation == RunGeneration::sort);
+
+    // replacement selection is taken for a block where its runs save a merge pass and the sorted loads need
+    // more than one, so it lets a larger block keep the fewest passes
+    SortPlan chosen_random = plan_sort<int64_t>(input_size, memory, unmeasured, options, true, 0.5);
+    check_selection_saves_pass(chosen_random, 0.5);
+    CHECK(chosen_random.run_generation == RunGeneration::replacement_selection);
+    CHECK(chosen_random.merge_passes == 1);
+    CHECK(chosen_random.block_size == 64 * 1024);
+    SortPlan chosen_reversed = plan_sort<int64_t>(input_size, memory, unmeasured, options, true, 0);
+    check_selection_saves_pass(chosen_reversed, 0);
+    CHECK(chosen_reversed.merge_passes == 2);
+    CHECK(chosen_reversed.block_size > chosen_random.block_size);
+    SortPlan chosen_small = plan_sort<int64_t>(64 * MB, memory, unmeasured, options, true, 0.5);
+    check_selection_saves_pass(chosen_small, 0.5);
+    CHECK(chosen_small.merge_passes == 1);
+    // the sorted loads of a small input need a single pass at 64 KB, replacement selection saves nothing there
+    SortPlan small_block = evaluate_plan<int64_t>(64 * MB, memory, 64 * 1024, RunGeneration::sort, unmeasured, options, 0.5);
+    CHECK(small_block.merge_passes == 1);
+
+    // a device without latency pays only for the passes, one with a long latency for every request,
+    // so the second takes larger blocks
+    DeviceProfile fast_requests{500.0 * MB, 400.0 * MB, 0, IoBackend::direct};
+    DeviceProfile slow_requests{500.0 * MB, 400.0 * MB, 0.010, IoBackend::direct};
+    SortPlan fast_plan = plan_sort<int64_t>(input_size, memory, fast_requests, options, false, 0.5);
+    SortPlan slow_plan = plan_sort<int64_t>(input_size, memory, slow_requests, options, false, 0.5);
+    check_fastest(fast_requests, fast_plan);
+    check_fastest(slow_requests, slow_plan);
+    CHECK(fast_plan.block_size == 64 * 1024);
+    CHECK(slow_plan.block_size > fast_plan.block_size);
+    CHECK(slow_plan.predicted_seconds > fast_plan.predicted_seconds);
+
+    return check_result();
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "record.hpp"
+#include "sort_kernels.hpp"
+
+// radix sort a copy of values and compare with std::sort, equal keys (ties and -0.0 against 0.0) compare equal
+template <typename Record>
+void check_radix(std::vector<Record> values) {
+    std::vector<Record> expected = values;
+    std::sort(expected.begin(), expected.end());
+    std::vector<Record> scratch(values.size());
+    radix_sort(values.data(), scratch.data(), values.size(), nullptr);
+    CHECK(values == expected);
+}
+
+template <typename Integer>
+std::vector<Integer> random_integers(std::mt19937_64& random, size_t size, Integer low, Integer high) {
+    std::uniform_int_distribution<Integer> distribution(low, high);
+    std::vector<Integer> values(size);
+    for (auto& value : values) {
+        value = distribution(random);
+    }
+    return values;
+}
+
+std::vector<double> random_doubles(std::mt19937_64& random, size_t size, double low, double high) {
+    std::uniform_real_distribution<double> distribution(low, high);
+    std::vector<double> values(size);
+    for (auto& value : values) {
+        value = distribution(random);
+    }
+    return values;
+}
+
+int main() {
+    std::mt19937_64 random(5);
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    const int64_t max = std::numeric_limits<int64_t>::max();
+    // below 256 records the merge sort takes over, above it every digit pass runs
+    for (size_t size : {0, 1, 255, 256, 1000, 100003}) {
+        check_radix(random_integers<int64_t>(random, size, min, max));
+        check_radix(random_integers<int64_t>(random, size, -1000, 1000));
+        check_radix(random_integers<uint64_t>(random, size, 0, std::numeric_limits<uint64_t>::max()));
+        check_radix(random_integers<uint32_t>(random, size, 0, std::numeric_limits<uint32_t>::max()));
+        check_radix(random_doubles(random, size, -1e18, 1e18));
+        check_radix(random_doubles(random, size, -1, 1));
+    }
+
+    // the sign bit flip puts the negative numbers first, digits every key shares are skipped
+    std::vector<int64_t> extremes = random_integers<int64_t>(random, 5000, min, max);
+    for (size_t i = 0; i < extremes.size(); i += 4) {
+        extremes[i] = i % 8 == 0 ? min : i % 3 == 0 ? max : i % 2 == 0 ? -1 : 0;
+    }
+    check_radix(extremes);
+    check_radix(std::vector<int64_t>(3000, -7));
+    check_radix(random_integers<int64_t>(random, 3000, -(int64_t(1) << 40), -(int64_t(1) << 40) + 3));
+
+    // negative doubles have all bits flipped, so -2 sorts before -1 and both before the zeros and infinity after all
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<double> doubles = random_doubles(random, 4000, -1e300, 1e300);
+    for (size_t i = 0; i < doubles.size(); i += 5) {
+        const double specials[] = {-infinity, infinity, -0.0, 0.0, std::numeric_limits<double>::denorm_min(),
+                                   -std::numeric_limits<double>::denorm_min(), std::numeric_limits<double>::lowest(), -1, -2};
+        doubles[i] = specials[i / 5 % 9];
+    }
+    check_radix(doubles);
+
+    // the digit passes are stable, records with equal keys keep the order they came in
+    std::vector<KeyPayload16> records(20000);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i] = KeyPayload16{random() % 100 << 40 | random() % 3, i};
+    }
+    std::vector<KeyPayload16> expected = records;
+    std::stable_sort(expected.begin(), expected.end(), [](const KeyPayload16& a, const KeyPayload16& b) { return a.key < b.key; });
+    std::vector<KeyPayload16> scratch(records.size());
+    radix_sort(records.data(), scratch.data(), records.size(), nullptr);
+    CHECK(std::equal(records.begin(), records.end(), expected.begin(), [](const KeyPayload16& a, const KeyPayload16& b) {
+        return a.key == b.key && a.payload == b.payload;
+    }));
+    return check_result();
+}
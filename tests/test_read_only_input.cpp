@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_read_only_input.in";
+const std::string output_name = "test_read_only_input.out";
+const std::string temp_directory = "test_read_only_input.tmp";
+
+std::vector<int64_t> read_file(const std::string& name, size_t elements) {
+    std::unique_ptr<File> file = file_open(name, IoBackend::pread);
+    std::vector<int64_t> values(elements);
+    read_data(*file, values, 0, 0, elements);
+    return values;
+}
+
+// the input comes out unchanged, the output sorted and the scratch directory empty
+void check_sort(const std::vector<int64_t>& values, size_t memory, IoBackend backend) {
+    {
+        std::unique_ptr<File> file = file_open_and_clear(input_name, IoBackend::pread);
+        write_data(*file, values.data(), 0, values.size());
+    }
+    std::filesystem::permissions(input_name, std::filesystem::perms::owner_read | std::filesystem::perms::group_read | std::filesystem::perms::others_read);
+
+    SortOptions options;
+    options.io_backend = backend;
+    options.temp_directories = {temp_directory};
+    SortStats stats;
+    auto result = sort_file_external<int64_t>(input_name, output_name, values.size() * sizeof(int64_t), memory, 4096, options, stats);
+    CHECK(result != nullptr);
+    result.reset();
+
+    std::vector<int64_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+    CHECK(std::filesystem::file_size(output_name) == values.size() * sizeof(int64_t));
+    CHECK(read_file(output_name, values.size()) == expected);
+    CHECK(std::filesystem::file_size(input_name) == values.size() * sizeof(int64_t));
+    CHECK(read_file(input_name, values.size()) == values);
+    CHECK(std::filesystem::is_empty(temp_directory));
+
+    std::filesystem::permissions(input_name, std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+    std::filesystem::remove(input_name);
+}
+
+int main() {
+    std::filesystem::create_directory(temp_directory);
+    std::mt19937_64 random(10);
+    std::vector<int64_t> values(30011);
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+
+    for (IoBackend backend : {IoBackend::stream, IoBackend::pread, IoBackend::mmap}) {
+        // several merge passes, a single run that is renamed into place, and an empty input
+        check_sort(values, 32 * 1024, backend);
+        check_sort(values, 1024 * 1024, backend);
+        check_sort({}, 32 * 1024, backend);
+    }
+
+    // file_open gives a file that can not be written, even where the permissions would allow it
+    {
+        std::unique_ptr<File> file = file_open_and_clear(input_name, IoBackend::pread);
+        write_data(*file, values.data(), 0, values.size());
+    }
+    bool rejected = false;
+    try {
+        std::unique_ptr<File> file = file_open(input_name, IoBackend::pread);
+        write_data(*file, values.data(), 0, 1);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    std::filesystem::remove_all(temp_directory);
+    return check_result();
+}
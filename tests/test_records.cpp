@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_records.in";
+const std::string output_name = "test_records.out";
+
+// radix_key has to order like less, the radix sort relies on it
+template <typename Record>
+void check_radix_key(const std::vector<Record>& records) {
+    if constexpr (RecordTraits<Record>::radix_bits > 0) {
+        for (size_t i = 0; i + 1 < records.size(); i++) {
+            const Record& a = records[i];
+            const Record& b = records[i + 1];
+            CHECK(RecordTraits<Record>::less(a, b) == (RecordTraits<Record>::radix_key(a) < RecordTraits<Record>::radix_key(b)));
+            CHECK(equivalent(a, b) == (RecordTraits<Record>::radix_key(a) == RecordTraits<Record>::radix_key(b)));
+        }
+    }
+}
+
+// sort random records of one type through the whole pipeline, with several runs and merge passes
+template <typename Record>
+void check_sort(std::mt19937_64& random, size_t elements, const SortOptions& options) {
+    std::vector<Record> records(elements);
+    for (auto& record : records) {
+        record = RecordTraits<Record>::random(random);
+    }
+    check_radix_key(records);
+    {
+        std::unique_ptr<File> file = file_open_and_clear(input_name, IoBackend::pread);
+        write_data(*file, records.data(), 0, records.size());
+    }
+
+    // a block holds whole records and is page aligned, 100 byte records take blocks of 25 pages
+    const size_t block_size = aligned_elements<Record>(4096) * sizeof(Record);
+    const size_t memory = 16 * block_size;
+    std::string in_filename = input_name;
+    std::string out_filename = output_name;
+    SortStats stats;
+    auto result = sort_file_external<Record>(in_filename, out_filename, elements * sizeof(Record), memory, block_size, options, stats);
+    CHECK(result != nullptr);
+    if (!result) {
+        return;
+    }
+    std::vector<Record> sorted(elements);
+    read_data(*result, sorted, 0, 0, elements);
+    std::vector<Record> expected = records;
+    std::stable_sort(expected.begin(), expected.end(), RecordTraits<Record>::less);
+    // the random keys are distinct, so the payloads have to come along with them
+    CHECK(std::memcmp(sorted.data(), expected.data(), elements * sizeof(Record)) == 0);
+}
+
+template <typename Record>
+void check_record_type(std::mt19937_64& random) {
+    for (RunGeneration run_generation : {RunGeneration::sort, RunGeneration::replacement_selection}) {
+        SortOptions options;
+        options.threads = 2;
+        options.run_generation = run_generation;
+        check_sort<Record>(random, 20011, options);
+        if constexpr (RecordTraits<Record>::radix_bits > 0) {
+            options.sort_algorithm = SortAlgorithm::radix;
+            check_sort<Record>(random, 20011, options);
+        }
+    }
+}
+
+int main() {
+    std::mt19937_64 random(7);
+    check_record_type<int64_t>(random);
+    check_record_type<uint64_t>(random);
+    check_record_type<uint32_t>(random);
+    check_record_type<double>(random);
+    check_record_type<KeyPayload16>(random);
+    check_record_type<SortBenchmarkRecord>(random);
+
+    // the keys at the ends of every range order like the numbers they stand for
+    check_radix_key<int64_t>({std::numeric_limits<int64_t>::min(), -1, 0, 1, std::numeric_limits<int64_t>::max()});
+    check_radix_key<uint32_t>({0, 1, std::numeric_limits<uint32_t>::max()});
+    const double infinity = std::numeric_limits<double>::infinity();
+    check_radix_key<double>({-infinity, std::numeric_limits<double>::lowest(), -2, -1, -std::numeric_limits<double>::denorm_min(),
+                             0.0, std::numeric_limits<double>::denorm_min(), 1, 2, infinity});
+
+    // sb100 keys compare as unsigned bytes and only the 10 key bytes count
+    SortBenchmarkRecord a = RecordTraits<SortBenchmarkRecord>::random(random);
+    SortBenchmarkRecord b = a;
+    b.payload[0] ^= 1;
+    CHECK(equivalent(a, b));
+    a.key[9] = 0x7f;
+    b.key[9] = 0x80;
+    CHECK(RecordTraits<SortBenchmarkRecord>::less(a, b));
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    return check_result();
+}
@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "io.hpp"
+#include "run_generation.hpp"
+#include "scratch.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_replacement_selection.in";
+const size_t memory = 1024 * 1024;
+const size_t block_size = 64 * 1024;
+// the heap gets what the four I/O blocks leave of the memory
+const size_t heap_capacity = (memory - 4 * block_size) / sizeof(SelectionEntry<int64_t>);
+
+// run replacement selection over values and check that the runs are sorted and hold the values, returns the run count
+size_t selection_runs(const std::vector<int64_t>& values) {
+    {
+        std::unique_ptr<File> file = file_open_and_clear(input_name, IoBackend::pread);
+        write_data(*file, values.data(), 0, values.size());
+    }
+    std::unique_ptr<File> input = file_open(input_name, IoBackend::pread);
+    ScratchSpace scratch_space({std::filesystem::current_path()});
+    PhaseStats phase;
+    MultisetHash input_hash;
+    std::vector<Run> runs = partition_replacement_selection<int64_t>(*input, values.size() * sizeof(int64_t), scratch_space, memory, block_size, SortOptions(), phase, input_hash, nullptr);
+
+    std::vector<int64_t> run_values;
+    for (const Run& run : runs) {
+        std::unique_ptr<File> run_file = file_open(run.file, IoBackend::pread);
+        std::vector<int64_t> records(run.elements);
+        read_data(*run_file, records, 0, 0, run.elements);
+        CHECK(std::is_sorted(records.begin(), records.end()));
+        run_values.insert(run_values.end(), records.begin(), records.end());
+    }
+    std::vector<int64_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+    std::sort(run_values.begin(), run_values.end());
+    CHECK(run_values == expected);
+    return runs.size();
+}
+
+int main() {
+    std::mt19937_64 random(17);
+    const size_t elements = 20 * heap_capacity + 123;
+    std::vector<int64_t> values(elements);
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+
+    // random input gives runs of about twice the heap
+    size_t random_runs = selection_runs(values);
+    CHECK(random_runs >= elements / (2 * heap_capacity) - 1);
+    CHECK(random_runs <= elements / (2 * heap_capacity) + 2);
+
+    // sorted input is one run, reversed input runs of exactly the heap
+    std::sort(values.begin(), values.end());
+    CHECK(selection_runs(values) == 1);
+    std::reverse(values.begin(), values.end());
+    CHECK(selection_runs(values) == (elements + heap_capacity - 1) / heap_capacity);
+
+    // an input that fits into the heap is one run, an empty one none
+    CHECK(selection_runs(std::vector<int64_t>(values.begin(), values.begin() + heap_capacity)) == 1);
+    CHECK(selection_runs({}) == 0);
+
+    std::filesystem::remove(input_name);
+    return check_result();
+}
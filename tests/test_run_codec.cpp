@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "record.hpp"
+#include "run_codec.hpp"
+
+const std::string run_name = "test_run_codec.run";
+
+template <typename Record>
+bool same_records(const std::vector<Record>& a, const std::vector<Record>& b) {
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(Record)) == 0);
+}
+
+// the codec of the frames alone: the records come back from what encode wrote, the decoder may read 8 bytes past it
+template <typename Record>
+void check_codec(const std::vector<Record>& records) {
+    std::vector<char> coded;
+    std::vector<Record> decoded(records.size());
+    if constexpr (delta_coded<Record>) {
+        encode_delta(records.data(), records.size(), coded);
+        coded.resize(coded.size() + 8);
+        decode_delta(reinterpret_cast<const unsigned char*>(coded.data()), decoded.data(), decoded.size());
+    } else {
+        encode_xor(records.data(), records.size(), coded);
+        coded.resize(coded.size() + 8);
+        decode_xor(reinterpret_cast<const unsigned char*>(coded.data()), decoded.data(), decoded.size());
+    }
+    CHECK(same_records(records, decoded));
+}
+
+/**
+ * write records to a compressed run in pieces of piece records (the pieces cut the frames, so they are
+ * assembled in memory), open it again and read it back whole, frame by frame across the frame boundaries
+ * and record by record around them
+ */
+template <typename Record>
+void check_round_trip(const std::vector<Record>& records, size_t piece) {
+    using Compressed = CompressedFile<Record>;
+    {
+        Compressed run(file_create(run_name, IoBackend::pread), true);
+        for (size_t start = 0; start < records.size(); start += piece) {
+            size_t count = std::min(piece, records.size() - start);
+            run.write(records.data() + start, start * sizeof(Record), count * sizeof(Record));
+        }
+        run.close();
+    }
+    Compressed run(file_open(run_name, IoBackend::pread), false);
+    CHECK(run.size() == records.size() * sizeof(Record));
+    std::vector<Record> read(records.size());
+    if (!records.empty()) {
+        run.read(read.data(), 0, read.size() * sizeof(Record));
+    }
+    CHECK(same_records(records, read));
+
+    std::vector<Record> range(Compressed::frame_elements + 2);
+    for (size_t frame_start = Compressed::frame_elements; frame_start < records.size(); frame_start += Compressed::frame_elements) {
+        size_t first = frame_start - 1;
+        size_t count = std::min(range.size(), records.size() - first);
+        range.resize(count);
+        run.read(range.data(), first * sizeof(Record), count * sizeof(Record));
+        CHECK(same_records(std::vector<Record>(records.begin() + first, records.begin() + first + count), range));
+        range.resize(Compressed::frame_elements + 2);
+        for (size_t i = first; i < first + 3 && i < records.size(); i++) {
+            Record record;
+            run.read(&record, i * sizeof(Record), sizeof(Record));
+            CHECK(std::memcmp(&record, &records[i], sizeof(Record)) == 0);
+        }
+    }
+    bool past_end = false;
+    try {
+        Record record;
+        run.read(&record, records.size() * sizeof(Record), sizeof(Record));
+    } catch (const std::runtime_error&) {
+        past_end = true;
+    }
+    CHECK(past_end);
+}
+
+// every check for a set of records, written at once and in pieces that do not line up with the frames
+template <typename Record>
+void check_records(const std::vector<Record>& records) {
+    check_codec(records);
+    check_round_trip(records, std::max<size_t>(1, records.size()));
+    check_round_trip(records, 1000);
+    check_round_trip(records, 777);
+}
+
+template <typename Record>
+std::vector<Record> random_records(std::mt19937_64& random, size_t count) {
+    std::vector<Record> records(count);
+    for (auto& record : records) {
+        record = RecordTraits<Record>::random(random);
+    }
+    return records;
+}
+
+int main() {
+    std::mt19937_64 random(7);
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    const int64_t max = std::numeric_limits<int64_t>::max();
+    const size_t frame = CompressedFile<int64_t>::frame_elements;
+
+    // lengths around the frames: one record, a frame, a frame and a partial last frame, several frames
+    for (size_t count : {size_t(1), frame - 1, frame, frame + 1, 3 * frame + 123}) {
+        std::vector<int64_t> sorted = random_records<int64_t>(random, count);
+        std::sort(sorted.begin(), sorted.end());
+        check_records(random_records<int64_t>(random, count));
+        check_records(sorted);
+        check_records(std::vector<int64_t>(count, -12345));
+
+        // deltas from INT64_MIN to INT64_MAX and back wrap around and need the full width
+        std::vector<int64_t> extremes(count);
+        for (size_t i = 0; i < count; i++) {
+            extremes[i] = i % 2 == 0 ? min : max;
+        }
+        check_records(extremes);
+        std::vector<int64_t> ramp(count);
+        for (size_t i = 0; i < count; i++) {
+            ramp[i] = min + int64_t(i) * 3;
+        }
+        check_records(ramp);
+
+        check_records(random_records<uint64_t>(random, count));
+        check_records(random_records<uint32_t>(random, count));
+        check_records(std::vector<uint32_t>(count, std::numeric_limits<uint32_t>::max()));
+        check_records(random_records<double>(random, count));
+
+        // xor coding against the previous record: random, all equal (zero runs) and a few changes in long zero runs
+        check_records(random_records<KeyPayload16>(random, count));
+        check_records(std::vector<KeyPayload16>(count, KeyPayload16{42, 7}));
+        std::vector<KeyPayload16> sparse(count, KeyPayload16{1, 2});
+        for (size_t i = 0; i < count; i += 97) {
+            sparse[i].payload = i;
+        }
+        check_records(sparse);
+        check_records(random_records<SortBenchmarkRecord>(random, count / 8 + 1));
+    }
+    check_round_trip(std::vector<int64_t>{}, 1);
+    check_codec(std::vector<int64_t>{max, min});
+    check_codec(std::vector<int64_t>{min, max, min});
+
+    std::filesystem::remove(run_name);
+    return check_result();
+}
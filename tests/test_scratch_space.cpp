@@ -0,0 +1,147 @@
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "scratch.hpp"
+
+const std::filesystem::path root = "test_scratch_space";
+
+std::vector<std::filesystem::path> make_directories(size_t count) {
+    std::vector<std::filesystem::path> directories;
+    for (size_t i = 0; i < count; i++) {
+        directories.push_back(root / "d");
+        directories.back() += std::to_string(i);
+        std::filesystem::create_directories(directories.back());
+    }
+    return directories;
+}
+
+// index of the directory in directories that name is in
+size_t directory_of(const std::string& name, const std::vector<std::filesystem::path>& directories) {
+    std::filesystem::path parent = std::filesystem::path(name).parent_path();
+    for (size_t i = 0; i < directories.size(); i++) {
+        if (parent == directories[i]) return i;
+    }
+    return directories.size();
+}
+
+// directories of the next count names
+std::vector<size_t> next_directories(ScratchSpace& scratch_space, const std::vector<std::filesystem::path>& directories, size_t count) {
+    std::vector<size_t> result;
+    for (size_t i = 0; i < count; i++) {
+        result.push_back(directory_of(scratch_space.create_name(), directories));
+    }
+    return result;
+}
+
+void touch(const std::string& name) {
+    std::ofstream(name) << "run";
+}
+
+int main() {
+    std::filesystem::remove_all(root);
+    std::vector<std::filesystem::path> four = make_directories(4);
+
+    // the run generation writes to the first half, the passes alternate, round robin within a half
+    {
+        ScratchSpace scratch_space(four);
+        CHECK(scratch_space.current_pass() == 0);
+        CHECK((next_directories(scratch_space, four, 4) == std::vector<size_t>{0, 1, 0, 1}));
+        scratch_space.start_pass(1);
+        CHECK(scratch_space.current_pass() == 1);
+        CHECK((next_directories(scratch_space, four, 3) == std::vector<size_t>{2, 3, 2}));
+        scratch_space.start_pass(2);
+        CHECK((next_directories(scratch_space, four, 2) == std::vector<size_t>{0, 1}));
+        scratch_space.start_pass(3);
+        CHECK((next_directories(scratch_space, four, 2) == std::vector<size_t>{3, 2}));
+    }
+
+    // an odd number of directories gives the first half the larger share, one directory is both halves
+    {
+        std::vector<std::filesystem::path> three(four.begin(), four.begin() + 3);
+        ScratchSpace scratch_space(three);
+        CHECK((next_directories(scratch_space, three, 3) == std::vector<size_t>{0, 1, 0}));
+        scratch_space.start_pass(1);
+        CHECK((next_directories(scratch_space, three, 2) == std::vector<size_t>{2, 2}));
+
+        std::vector<std::filesystem::path> one(four.begin(), four.begin() + 1);
+        ScratchSpace single(one);
+        single.start_pass(1);
+        CHECK((next_directories(single, one, 2) == std::vector<size_t>{0, 0}));
+        single.narrow(1);
+        CHECK((next_directories(single, one, 1) == std::vector<size_t>{0}));
+        single.widen();
+    }
+
+    // narrow restricts the files to one half, which is split again for its passes, widen restores both
+    {
+        ScratchSpace scratch_space(four);
+        scratch_space.start_pass(3);
+        scratch_space.narrow(1);
+        CHECK(scratch_space.current_pass() == 0);
+        CHECK((next_directories(scratch_space, four, 2) == std::vector<size_t>{2, 2}));
+        scratch_space.start_pass(1);
+        CHECK((next_directories(scratch_space, four, 2) == std::vector<size_t>{3, 3}));
+        scratch_space.widen();
+        CHECK(scratch_space.current_pass() == 3);
+        std::vector<size_t> widened = next_directories(scratch_space, four, 2);
+        CHECK(widened[0] >= 2 && widened[1] >= 2 && widened[0] != widened[1]);
+        scratch_space.start_pass(0);
+        scratch_space.narrow(0);
+        CHECK((next_directories(scratch_space, four, 2) == std::vector<size_t>{0, 0}));
+        scratch_space.widen();
+        CHECK(scratch_space.current_pass() == 0);
+    }
+
+    // NarrowedScratch widens when it goes out of scope, by an exception too
+    {
+        ScratchSpace scratch_space(four);
+        scratch_space.start_pass(1);
+        try {
+            NarrowedScratch narrowed(scratch_space, 1);
+            CHECK(scratch_space.current_pass() == 0);
+            CHECK(directory_of(scratch_space.create_name(), four) == 2);
+            throw std::runtime_error("sort of the half failed");
+        } catch (const std::runtime_error&) {
+        }
+        CHECK(scratch_space.current_pass() == 1);
+        std::vector<size_t> widened = next_directories(scratch_space, four, 2);
+        CHECK(widened[0] >= 2 && widened[1] >= 2 && widened[0] != widened[1]);
+    }
+
+    // release removes a file at once, forget keeps it, the rest is removed with the scratch space
+    {
+        std::string released, forgotten, left;
+        {
+            ScratchSpace scratch_space(four);
+            released = scratch_space.create_name();
+            forgotten = scratch_space.create_name();
+            left = scratch_space.create_name();
+            CHECK(released != forgotten && forgotten != left && released != left);
+            touch(released);
+            touch(forgotten);
+            touch(left);
+            scratch_space.release(released);
+            CHECK(!std::filesystem::exists(released));
+            scratch_space.forget(forgotten);
+        }
+        CHECK(std::filesystem::exists(forgotten));
+        CHECK(!std::filesystem::exists(left));
+    }
+
+    // a name that is taken by a file (of a resumed sort) is skipped
+    {
+        ScratchSpace first(four);
+        std::string name = first.create_name();
+        touch(name);
+        first.forget(name);
+        ScratchSpace second(four);
+        CHECK(second.create_name() != name);
+    }
+
+    std::filesystem::remove_all(root);
+    return check_result();
+}
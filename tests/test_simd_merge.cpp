@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_merge.hpp"
+#include "io.hpp"
+#include "simd_merge.hpp"
+#include "sort_kernels.hpp"
+
+struct Kernel {
+    std::string name;
+    MergeInt64 merge;
+};
+
+// the kernels the CPU can run, the tail merge stands for the scalar path of the vector kernels
+std::vector<Kernel> supported_kernels() {
+    std::vector<Kernel> kernels{{"tail", merge_int64_tail}};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", merge_int64_avx2});
+    } else {
+        std::cout << "avx2 is not supported, skipped" << std::endl;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.push_back({"avx512", merge_int64_avx512});
+    } else {
+        std::cout << "avx512 is not supported, skipped" << std::endl;
+    }
+    return kernels;
+}
+
+// merge a and b, which are sorted here, with the kernel and compare with std::merge
+void check_merge(const Kernel& kernel, std::vector<int64_t> a, std::vector<int64_t> b) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    std::vector<int64_t> expected(a.size() + b.size());
+    std::merge(a.begin(), a.end(), b.begin(), b.end(), expected.begin());
+    std::vector<int64_t> out(a.size() + b.size());
+    kernel.merge(a.data(), a.data() + a.size(), b.data(), b.data() + b.size(), out.data());
+    if (out != expected) {
+        std::cerr << kernel.name << " merge of " << a.size() << " and " << b.size() << " records differs from std::merge" << std::endl;
+    }
+    CHECK(out == expected);
+}
+
+std::vector<int64_t> random_values(std::mt19937_64& random, size_t size, int64_t low, int64_t high) {
+    std::uniform_int_distribution<int64_t> distribution(low, high);
+    std::vector<int64_t> values(size);
+    for (auto& value : values) {
+        value = distribution(random);
+    }
+    return values;
+}
+
+// merge two runs from files with a worker of small blocks, so the kernel restarts at many block ends
+std::vector<int64_t> worker_merge(const std::vector<int64_t>& a, const std::vector<int64_t>& b, size_t block_elements, MergeInt64 kernel) {
+    std::vector<std::unique_ptr<File>> inputs;
+    std::vector<size_t> begin{0, 0};
+    std::vector<size_t> end{a.size(), b.size()};
+    for (const std::vector<int64_t>* run : {&a, &b}) {
+        std::string name = "test_simd_merge_" + std::to_string(inputs.size()) + ".run";
+        std::unique_ptr<File> file = file_create(name, IoBackend::pread);
+        if (!run->empty()) {
+            file->write(run->data(), 0, run->size() * sizeof(int64_t));
+        }
+        file->close();
+        inputs.push_back(file_open(name, IoBackend::pread));
+    }
+    std::unique_ptr<File> output = file_create("test_simd_merge.out", IoBackend::pread);
+    MergeWorker<int64_t> worker(2, block_elements, kernel);
+    worker.merge(inputs, begin, end, *output, 0);
+    output->close();
+
+    std::unique_ptr<File> result = file_open("test_simd_merge.out", IoBackend::pread);
+    std::vector<int64_t> merged(result->size() / sizeof(int64_t));
+    if (!merged.empty()) {
+        result->read(merged.data(), 0, merged.size() * sizeof(int64_t));
+    }
+    inputs.clear();
+    result.reset();
+    std::filesystem::remove("test_simd_merge_0.run");
+    std::filesystem::remove("test_simd_merge_1.run");
+    std::filesystem::remove("test_simd_merge.out");
+    return merged;
+}
+
+int main() {
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    const int64_t max = std::numeric_limits<int64_t>::max();
+    std::mt19937_64 random(42);
+    for (const Kernel& kernel : supported_kernels()) {
+        // every pair of lengths up to a few vectors covers the inputs shorter than a vector and the carry of the finish
+        for (size_t a_size = 0; a_size <= 40; a_size++) {
+            for (size_t b_size = 0; b_size <= 40; b_size++) {
+                check_merge(kernel, random_values(random, a_size, min, max), random_values(random, b_size, min, max));
+                check_merge(kernel, random_values(random, a_size, 0, 3), random_values(random, b_size, 0, 3));
+            }
+        }
+        for (size_t size : {1000, 4099, 65536}) {
+            check_merge(kernel, random_values(random, size, min, max), random_values(random, size / 3, min, max));
+            check_merge(kernel, random_values(random, size, -5, 5), random_values(random, size, -5, 5));
+        }
+        // one input entirely before the other, and the extremes of the key range
+        std::vector<int64_t> low = random_values(random, 100, min, -1);
+        std::vector<int64_t> high = random_values(random, 100, 0, max);
+        check_merge(kernel, low, high);
+        check_merge(kernel, high, low);
+        check_merge(kernel, std::vector<int64_t>(37, min), std::vector<int64_t>(29, max));
+        check_merge(kernel, {min, min, 0, max, max, max, max, max, max, max}, {min, -1, 1, max, max, max, max, max, max, max, max});
+        std::vector<int64_t> extremes = random_values(random, 500, min, max);
+        for (size_t i = 0; i < extremes.size(); i += 3) {
+            extremes[i] = i % 2 == 0 ? min : max;
+        }
+        check_merge(kernel, extremes, random_values(random, 333, min, max));
+
+        // the merge sort with the kernel sorts like std::sort
+        std::vector<int64_t> values = random_values(random, 10007, min, max);
+        std::vector<int64_t> scratch(values.size());
+        std::vector<int64_t> expected = values;
+        std::sort(expected.begin(), expected.end());
+        merge_sort(values.data(), scratch.data(), values.size(), kernel.merge);
+        CHECK(values == expected);
+
+        // the external merge of two int64 runs goes through the kernel block by block
+        const size_t block_elements = aligned_elements<int64_t>(0);
+        for (size_t round = 0; round < 10; round++) {
+            std::vector<int64_t> a = random_values(random, random() % (5 * block_elements), -500, 500);
+            std::vector<int64_t> b = random_values(random, random() % (5 * block_elements), -500, 500);
+            std::sort(a.begin(), a.end());
+            std::sort(b.begin(), b.end());
+            std::vector<int64_t> merged(a.size() + b.size());
+            std::merge(a.begin(), a.end(), b.begin(), b.end(), merged.begin());
+            CHECK(worker_merge(a, b, block_elements, kernel.merge) == merged);
+        }
+    }
+    // the levels resolve to a kernel the CPU has, scalar to none
+    CHECK(select_merge_int64(SimdLevel::scalar) == nullptr);
+    MergeInt64 avx2 = select_merge_int64(SimdLevel::avx2);
+    CHECK(avx2 == nullptr || avx2 == merge_int64_avx2);
+    return check_result();
+}
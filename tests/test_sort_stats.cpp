@@ -0,0 +1,91 @@
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+#include "sort_config.hpp"
+#include "sort_stats.hpp"
+
+const std::string input_name = "test_sort_stats.in";
+const std::string output_name = "test_sort_stats.out";
+
+// the phases add up to the whole sort and every merge pass takes the runs the one before left
+void check_stats(size_t elements, size_t memory, const SortOptions& options) {
+    const size_t bytes = elements * sizeof(int64_t);
+    SortStats stats;
+    auto result = sort_file_external<int64_t>(input_name, output_name, bytes, memory, 4096, options, stats);
+    CHECK(result != nullptr);
+
+    CHECK(stats.run_generation.runs_out == stats.runs);
+    CHECK(stats.run_generation.bytes_read == bytes);
+    CHECK(stats.run_generation.bytes_written == bytes);
+    if (options.run_generation == RunGeneration::sort) {
+        const size_t chunk_elements = aligned_elements<int64_t>(memory / 4);
+        CHECK(stats.runs == (elements + chunk_elements - 1) / chunk_elements);
+    }
+
+    size_t bytes_read = stats.run_generation.bytes_read;
+    size_t bytes_written = stats.run_generation.bytes_written;
+    double seconds = stats.run_generation.seconds;
+    size_t runs = stats.runs;
+    for (const PhaseStats& pass : stats.merge_passes) {
+        CHECK(pass.runs_in == runs);
+        CHECK(pass.runs_out < pass.runs_in);
+        // a run left over at the end of a pass is carried over without being read
+        CHECK(pass.bytes_read <= bytes && pass.bytes_read == pass.bytes_written);
+        // every record leaves the loser tree after at most one match per level
+        double levels = std::ceil(std::log2(double(stats.fan_in)));
+        CHECK(pass.comparisons > 0 && double(pass.comparisons) <= double(pass.bytes_read / sizeof(int64_t)) * (levels + 1));
+        CHECK(pass.read_stall_seconds <= pass.seconds && pass.write_stall_seconds <= pass.seconds);
+        bytes_read += pass.bytes_read;
+        bytes_written += pass.bytes_written;
+        seconds += pass.seconds;
+        runs = pass.runs_out;
+    }
+    CHECK(runs == 1);
+    if (!stats.merge_passes.empty()) {
+        CHECK(stats.merge_passes.back().bytes_written == bytes);
+    }
+    CHECK(stats.bytes_read == bytes_read);
+    CHECK(stats.bytes_written == bytes_written);
+    CHECK(stats.seconds >= seconds);
+
+    std::ostringstream table;
+    print_stats(table, stats);
+    CHECK(table.str().find("merge pass " + std::to_string(stats.merge_passes.size())) != std::string::npos);
+    std::ostringstream json;
+    print_stats_json(json, stats);
+    CHECK(json.str().find("\"runs\": " + std::to_string(stats.runs)) != std::string::npos);
+}
+
+int main() {
+    std::mt19937_64 random(12);
+    std::vector<int64_t> values(100003);
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+    {
+        std::unique_ptr<File> file = file_open_and_clear(input_name, IoBackend::pread);
+        write_data(*file, values.data(), 0, values.size());
+    }
+
+    for (RunGeneration run_generation : {RunGeneration::sort, RunGeneration::replacement_selection}) {
+        SortOptions options;
+        options.run_generation = run_generation;
+        // the vector kernels of the two way merges do not count comparisons, the loser tree does
+        options.simd = SimdLevel::scalar;
+        // many runs and several passes, then few runs and a single pass
+        check_stats(values.size(), 64 * 1024, options);
+        check_stats(values.size(), 1024 * 1024, options);
+    }
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    return check_result();
+}
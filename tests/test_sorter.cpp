@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "check.hpp"
+#include "record.hpp"
+#include "sorter.hpp"
+
+const size_t memory = 1024 * 1024;
+const size_t block_size = 64 * 1024;
+
+// a memory load of the sorter, a quarter of the memory
+const size_t load = memory / 4 / sizeof(int64_t);
+
+// orders the records by their payload instead of their key
+struct ByPayload {
+    bool operator()(const KeyPayload16& a, const KeyPayload16& b) const {
+        return a.payload < b.payload;
+    }
+};
+
+SortOptions test_options() {
+    SortOptions options;
+    options.threads = 2;
+    options.temp_directories = {std::filesystem::current_path().string()};
+    return options;
+}
+
+// push values in batches of odd sizes
+template <typename Record, typename Less>
+void push_all(Sorter<Record, Less>& sorter, const std::vector<Record>& values) {
+    for (size_t start = 0; start < values.size();) {
+        size_t count = std::min<size_t>(values.size() - start, 1 + start % 4099);
+        sorter.push(values.data() + start, count);
+        start += count;
+    }
+}
+
+// pull everything in pieces of a few hundred records
+template <typename Record, typename Less>
+std::vector<Record> pull_all(Sorter<Record, Less>& sorter) {
+    std::vector<Record> sorted;
+    std::vector<Record> piece(333);
+    while (size_t n = sorter.pull(piece.data(), piece.size())) {
+        sorted.insert(sorted.end(), piece.begin(), piece.begin() + n);
+    }
+    return sorted;
+}
+
+std::vector<int64_t> random_values(std::mt19937_64& random, size_t size) {
+    std::vector<int64_t> values(size);
+    for (auto& value : values) {
+        value = int64_t(random());
+    }
+    return values;
+}
+
+int main() {
+    std::mt19937_64 random(29);
+
+    // less than a memory load is sorted in memory without a run file, the iterator pulls one by one
+    {
+        std::vector<int64_t> values = random_values(random, load / 2);
+        Sorter<int64_t> sorter(memory, block_size, test_options());
+        push_all(sorter, values);
+        std::vector<int64_t> sorted(sorter.begin(), sorter.end());
+        std::sort(values.begin(), values.end());
+        CHECK(sorted == values);
+        CHECK(sorter.sort_stats().runs == 0);
+    }
+
+    // several memory loads are spilled to runs and merged while they are pulled
+    {
+        std::vector<int64_t> values = random_values(random, 7 * load + 5);
+        Sorter<int64_t> sorter(memory, block_size, test_options());
+        push_all(sorter, values);
+        std::vector<int64_t> sorted = pull_all(sorter);
+        std::sort(values.begin(), values.end());
+        CHECK(sorted == values);
+        CHECK(sorter.sort_stats().runs == 8);
+        CHECK(sorter.pull(sorted.data(), 1) == 0);
+        // the input ended with the first pull
+        bool rejected = false;
+        try {
+            sorter.push(values.data(), 1);
+        } catch (const std::logic_error&) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+
+    // a comparator of its own, in memory and spilled
+    for (size_t size : {size_t(1000), 5 * memory / 4 / sizeof(KeyPayload16)}) {
+        std::vector<KeyPayload16> records(size);
+        for (size_t i = 0; i < size; i++) {
+            records[i] = KeyPayload16{random(), random()};
+        }
+        Sorter<KeyPayload16, ByPayload> sorter(memory, block_size, test_options());
+        push_all(sorter, records);
+        std::vector<KeyPayload16> sorted = pull_all(sorter);
+        std::sort(records.begin(), records.end(), ByPayload());
+        CHECK(sorted.size() == records.size());
+        CHECK(std::equal(sorted.begin(), sorted.end(), records.begin(), records.end(), [](const KeyPayload16& a, const KeyPayload16& b) {
+            return a.key == b.key && a.payload == b.payload;
+        }));
+    }
+
+    // the descending order is the comparator RecordGreater, options.order is rejected
+    {
+        std::vector<int64_t> values = random_values(random, 3 * load);
+        Sorter<int64_t, RecordGreater<int64_t>> sorter(memory, block_size, test_options());
+        push_all(sorter, values);
+        std::vector<int64_t> sorted = pull_all(sorter);
+        std::sort(values.begin(), values.end(), std::greater<int64_t>());
+        CHECK(sorted == values);
+
+        SortOptions descending = test_options();
+        descending.order = SortOrder::descending;
+        bool rejected = false;
+        try {
+            Sorter<int64_t> wrong(memory, block_size, descending);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+
+    // with a limit only the first records come out
+    {
+        std::vector<int64_t> values = random_values(random, 3 * load);
+        SortOptions options = test_options();
+        options.limit = 1000;
+        Sorter<int64_t> sorter(memory, block_size, options);
+        push_all(sorter, values);
+        std::vector<int64_t> sorted = pull_all(sorter);
+        std::sort(values.begin(), values.end());
+        CHECK(sorted == std::vector<int64_t>(values.begin(), values.begin() + 1000));
+    }
+    return check_result();
+}
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "external_sort.hpp"
+#include "io.hpp"
+
+const std::string input_name = "test_top_k.in";
+const std::string output_name = "test_top_k.out";
+const size_t memory = 1024 * 1024;
+const size_t block_size = 64 * 1024;
+// the largest limit that is selected in memory, half the memory of heap entries
+const size_t selected_limit = memory / 2 / sizeof(SelectedRecord<int64_t>);
+
+/**
+ * sort the input with a limit and compare the output with the first limit records of expected
+ * selected tells which path the limit has to take: the heap of select_smallest or the limited merges
+ */
+SortStats check_limit(const std::vector<int64_t>& expected, SortOptions options, size_t limit, bool selected) {
+    options.limit = limit;
+    SortStats stats;
+    std::unique_ptr<File> result = sort_file_external<int64_t>(input_name, output_name, unknown_size, memory, block_size, options, stats);
+    CHECK(result != nullptr);
+    CHECK(stats.selected == selected);
+    CHECK(stats.verified);
+    CHECK(stats.input_records == expected.size());
+    size_t output_elements = std::min(limit, expected.size());
+    CHECK(stats.output_records == output_elements);
+    if (!result) return stats;
+    CHECK(result->size() == output_elements * sizeof(int64_t));
+    std::vector<int64_t> output(output_elements);
+    read_data(*result, output, 0, 0, output_elements);
+    CHECK(std::equal(output.begin(), output.end(), expected.begin()));
+    return stats;
+}
+
+/**
+ * kv16 records of 100 keys with their input index as payload, sorted with a limit: of equal keys the ones that came
+ * first are kept and come out in input order, like std::stable_sort gives them
+ */
+void check_stable_limit(SortOptions options, size_t limit, bool selected) {
+    std::mt19937_64 random(25);
+    std::vector<KeyPayload16> records(200000);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i] = KeyPayload16{random() % 100, i};
+    }
+    std::unique_ptr<File> input = file_create(input_name, IoBackend::pread);
+    input->write(records.data(), 0, records.size() * sizeof(KeyPayload16));
+    input->close();
+    input.reset();
+    bool descending = options.order == SortOrder::descending;
+    std::stable_sort(records.begin(), records.end(), [descending](const KeyPayload16& a, const KeyPayload16& b) {
+        return descending ? b.key < a.key : a.key < b.key;
+    });
+
+    options.limit = limit;
+    SortStats stats;
+    std::unique_ptr<File> result = sort_file_external<KeyPayload16>(input_name, output_name, unknown_size, memory, block_size, options, stats);
+    CHECK(result != nullptr);
+    CHECK(stats.selected == selected);
+    if (!result) return;
+    CHECK(result->size() == limit * sizeof(KeyPayload16));
+    std::vector<KeyPayload16> output(limit);
+    read_data(*result, output, 0, 0, limit);
+    CHECK(std::equal(output.begin(), output.end(), records.begin(), [](const KeyPayload16& a, const KeyPayload16& b) {
+        return a.key == b.key && a.payload == b.payload;
+    }));
+}
+
+int main() {
+    // 4 MB, half of the keys from a small range so the records at the limit have equal neighbours
+    std::mt19937_64 random(24);
+    std::vector<int64_t> values(4 * memory / sizeof(int64_t));
+    for (auto& value : values) {
+        value = random() % 2 == 0 ? int64_t(random()) : int64_t(random() % 1000) - 500;
+    }
+    std::unique_ptr<File> input = file_create(input_name, IoBackend::pread);
+    input->write(values.data(), 0, values.size() * sizeof(int64_t));
+    input->close();
+    input.reset();
+    std::vector<int64_t> ascending = values;
+    std::sort(ascending.begin(), ascending.end());
+    std::vector<int64_t> descending = values;
+    std::sort(descending.begin(), descending.end(), std::greater<int64_t>());
+
+    SortOptions options;
+    options.threads = 2;
+    SortOptions limited = options;
+    limited.limit = selected_limit;
+    CHECK(selects_in_memory<int64_t>(memory, limited));
+    limited.limit = selected_limit + 1;
+    CHECK(!selects_in_memory<int64_t>(memory, limited));
+
+    // a limit that fits into half the memory is selected with a heap in one pass
+    check_limit(ascending, options, 1, true);
+    check_limit(ascending, options, 1000, true);
+    check_limit(ascending, options, selected_limit, true);
+
+    // a larger one goes through the runs and merges that stop at the limit
+    check_limit(ascending, options, selected_limit + 1, false);
+    // no run is read past the limit, so the merge reads less than the one of the whole input
+    SortStats third = check_limit(ascending, options, values.size() / 3, false);
+    SortStats whole = check_limit(ascending, options, values.size() * 2, false);
+    CHECK(third.runs > 1 && third.runs == whole.runs);
+    CHECK(third.bytes_read < whole.bytes_read);
+    options.run_generation = RunGeneration::replacement_selection;
+    check_limit(ascending, options, values.size() / 3, false);
+    options.run_generation = RunGeneration::sort;
+    // a distribution sort stops at the bucket that reaches the limit
+    options.strategy = SortStrategy::distribution;
+    check_limit(ascending, options, values.size() / 3, false);
+    options.strategy = SortStrategy::merge;
+
+    // the largest records, largest first, on both paths
+    options.order = SortOrder::descending;
+    check_limit(descending, options, 1000, true);
+    check_limit(descending, options, values.size() / 3, false);
+
+    // many equal keys at the limit, the heap keeps the first of them
+    options.order = SortOrder::ascending;
+    check_stable_limit(options, 5000, true);
+    check_stable_limit(options, 50000, false);
+    options.order = SortOrder::descending;
+    check_stable_limit(options, 5000, true);
+
+    std::filesystem::remove(input_name);
+    std::filesystem::remove(output_name);
+    return check_result();
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "io.hpp"
+#include "record.hpp"
+#include "verify.hpp"
+
+const std::string file_name = "test_verify.bin";
+
+// verify records written to a file, in blocks of one page so that the checks cross block boundaries
+template <typename Record>
+VerifyResult verify(const std::vector<Record>& records) {
+    std::unique_ptr<File> file = file_create(file_name, IoBackend::pread);
+    if (!records.empty()) {
+        file->write(records.data(), 0, records.size() * sizeof(Record));
+    }
+    file->close();
+    std::unique_ptr<File> input = file_open(file_name, IoBackend::pread);
+    VerifyResult result = verify_sorted<Record>(*input, aligned_elements<Record>(0));
+    input.reset();
+    std::filesystem::remove(file_name);
+    return result;
+}
+
+template <typename Record>
+MultisetHash hash_of(const std::vector<Record>& records) {
+    MultisetHash hash;
+    hash.add(records.data(), records.size());
+    return hash;
+}
+
+int main() {
+    std::mt19937_64 random(37);
+    const size_t block = aligned_elements<int64_t>(0);
+    std::vector<int64_t> sorted(10 * block + 7);
+    for (auto& value : sorted) {
+        value = int64_t(random() % 100000) - 50000;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    const MultisetHash input_hash = hash_of(sorted);
+
+    VerifyResult result = verify(sorted);
+    CHECK(result.sorted());
+    CHECK(result.elements == sorted.size());
+    CHECK(result.hash == input_hash);
+    CHECK(verify(std::vector<int64_t>()).sorted());
+
+    // a swapped pair is out of order at the second record, inside a block and across a block boundary
+    for (size_t first : {size_t(10), 3 * block - 1, sorted.size() - 2}) {
+        std::vector<int64_t> swapped = sorted;
+        std::swap(swapped[first], swapped[first + 1]);
+        if (swapped[first] == swapped[first + 1]) {
+            // equal neighbours are in order either way, make them differ
+            swapped[first] += 1;
+        }
+        result = verify(swapped);
+        CHECK(!result.sorted());
+        CHECK(result.first_unsorted == first + 1);
+    }
+
+    // a changed record that keeps the order is only caught by the hash, like a lost or doubled one
+    std::vector<int64_t> changed = sorted;
+    changed[5 * block] = changed[5 * block + 1];
+    result = verify(changed);
+    CHECK(result.sorted());
+    CHECK(!(result.hash == input_hash));
+    std::vector<int64_t> lost(sorted.begin() + 1, sorted.end());
+    CHECK(!(verify(lost).hash == input_hash));
+    std::vector<int64_t> doubled = sorted;
+    doubled.insert(doubled.begin() + 7, doubled[7]);
+    CHECK(!(verify(doubled).hash == input_hash));
+
+    // the hash does not depend on the order, so it holds for the output of any sort of the input
+    std::vector<int64_t> shuffled = sorted;
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    CHECK(hash_of(shuffled) == input_hash);
+
+    // a change in the payload of a record whose key is in order shows in the hash as well
+    std::vector<KeyPayload16> records(3 * aligned_elements<KeyPayload16>(0));
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i] = KeyPayload16{i / 3, random()};
+    }
+    MultisetHash records_hash = hash_of(records);
+    records[100].payload ^= 1;
+    VerifyResult records_result = verify(records);
+    CHECK(records_result.sorted());
+    CHECK(!(records_result.hash == records_hash));
+    return check_result();
+}